@@ -0,0 +1,162 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "adaptlevel.h"
+#include "syncthread.h"
+#include "options.h"
+#include "common.h"
+#include "queue.h"
+#include "error.h"
+
+int adaptlevel_init(cadaptlevel *a)
+{
+    if (!a)
+    {   errprintf("a is NULL\n");
+        return -1;
+    }
+    
+    memset(a, 0, sizeof(cadaptlevel));
+    if (pthread_mutex_init(&a->mutex, NULL)!=0)
+    {   errprintf("pthread_mutex_init failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int adaptlevel_destroy(cadaptlevel *a)
+{
+    if (!a)
+    {   errprintf("a is NULL\n");
+        return -1;
+    }
+    
+    assert(pthread_mutex_destroy(&a->mutex)==0);
+    return 0;
+}
+
+// enable the controller: the level of the blocks will stay between minlevel and maxlevel
+int adaptlevel_set_bounds(cadaptlevel *a, int minlevel, int maxlevel, int startlevel)
+{
+    if (!a || minlevel<1 || maxlevel>ADAPTLEVEL_MAXLEVEL || minlevel>maxlevel)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    assert(pthread_mutex_lock(&a->mutex)==0);
+    a->minlevel=minlevel;
+    a->maxlevel=maxlevel;
+    a->curlevel=max(min(startlevel, maxlevel), minlevel);
+    clock_gettime(CLOCK_MONOTONIC, &a->lastcheck);
+    assert(pthread_mutex_unlock(&a->mutex)==0);
+    return 0;
+}
+
+bool adaptlevel_enabled(cadaptlevel *a)
+{
+    return (a->minlevel>0);
+}
+
+// level to use for the next block: the queue is checked at most once per interval and the
+// level is changed by one step when one side of the queue is waiting for the other one
+int adaptlevel_get_level(cadaptlevel *a)
+{
+    struct timespec now;
+    s64 elapsed;
+    s64 todo;
+    s64 done;
+    int jobs;
+    int level;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    assert(pthread_mutex_lock(&a->mutex)==0);
+    elapsed=(s64)(now.tv_sec-a->lastcheck.tv_sec)*1000LL+(now.tv_nsec-a->lastcheck.tv_nsec)/1000000LL;
+    if (elapsed<ADAPTLEVEL_INTERVAL)
+    {   level=a->curlevel;
+        assert(pthread_mutex_unlock(&a->mutex)==0);
+        return level;
+    }
+    a->lastcheck=now;
+    assert(pthread_mutex_unlock(&a->mutex)==0);
+    
+    // blocks waiting for the compression threads and blocks ready to be written: the headers
+    // are not counted since they are never compressed and would make the writer look slow
+    todo=queue_count_blocks_status(&g_queue, QITEM_STATUS_TODO);
+    done=queue_count_blocks_status(&g_queue, QITEM_STATUS_DONE);
+    jobs=g_options.compressjobs;
+    
+    assert(pthread_mutex_lock(&a->mutex)==0);
+    if ((todo>jobs) && (todo>2*done) && (a->curlevel>a->minlevel)) // the compression threads are the bottleneck
+    {   a->curlevel--;
+        a->lowers++;
+        msgprintf(MSG_DEBUG1, "adaptlevel: todo=%lld done=%lld: level lowered to %d\n", (long long)todo, (long long)done, a->curlevel);
+    }
+    else if ((done>jobs) && (done>2*todo) && (a->curlevel<a->maxlevel)) // the writer is the bottleneck
+    {   a->curlevel++;
+        a->raises++;
+        msgprintf(MSG_DEBUG1, "adaptlevel: todo=%lld done=%lld: level raised to %d\n", (long long)todo, (long long)done, a->curlevel);
+    }
+    level=a->curlevel;
+    assert(pthread_mutex_unlock(&a->mutex)==0);
+    
+    return level;
+}
+
+int adaptlevel_account(cadaptlevel *a, int level, u64 realsize, u64 compsize)
+{
+    if (level<0 || level>ADAPTLEVEL_MAXLEVEL)
+        return -1;
+    
+    assert(pthread_mutex_lock(&a->mutex)==0);
+    a->blkcount[level]++;
+    a->realbytes[level]+=realsize;
+    a->compbytes[level]+=compsize;
+    assert(pthread_mutex_unlock(&a->mutex)==0);
+    return 0;
+}
+
+int adaptlevel_show_stats(cadaptlevel *a)
+{
+    char buffer[256];
+    int i;
+    
+    if (adaptlevel_enabled(a)==false)
+        return 0;
+    
+    assert(pthread_mutex_lock(&a->mutex)==0);
+    msgprintf(MSG_FORCE, "Adaptive zstd level between %d and %d: raised %lld times and lowered %lld times\n",
+        a->minlevel, a->maxlevel, (long long)a->raises, (long long)a->lowers);
+    for (i=0; i<=ADAPTLEVEL_MAXLEVEL; i++)
+    {
+        if (a->blkcount[i]>0)
+            msgprintf(MSG_FORCE, "Adaptive zstd level: level %d used for %lld blocks (%s), compressed to %.1f%%\n", i,
+                (long long)a->blkcount[i], format_size(a->realbytes[i], buffer, sizeof(buffer), 'h'),
+                (double)a->compbytes[i]*100.0/(double)max(a->realbytes[i], 1));
+    }
+    assert(pthread_mutex_unlock(&a->mutex)==0);
+    return 0;
+}
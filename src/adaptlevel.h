@@ -0,0 +1,52 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __ADAPTLEVEL_H__
+#define __ADAPTLEVEL_H__
+
+#include <pthread.h>
+#include <time.h>
+
+struct s_adaptlevel;
+typedef struct s_adaptlevel cadaptlevel;
+
+#define ADAPTLEVEL_MAXLEVEL     22     // highest zstd compression level
+#define ADAPTLEVEL_INTERVAL     250    // minimum time between two changes of the level (in milliseconds)
+
+struct s_adaptlevel // chooses the zstd level of the blocks using the state of the queue
+{   pthread_mutex_t      mutex; // pthread mutex for data protection
+    int                  minlevel; // lowest level allowed by the user (0 when the controller is disabled)
+    int                  maxlevel; // highest level allowed by the user
+    int                  curlevel; // level given to the next blocks
+    struct timespec      lastcheck; // when the state of the queue has been checked for the last time
+    u64                  raises; // how many times the level has been raised
+    u64                  lowers; // how many times the level has been lowered
+    u64                  blkcount[ADAPTLEVEL_MAXLEVEL+1]; // how many blocks have been compressed with each level
+    u64                  realbytes[ADAPTLEVEL_MAXLEVEL+1]; // size of these blocks before compression
+    u64                  compbytes[ADAPTLEVEL_MAXLEVEL+1]; // size of these blocks after compression
+};
+
+int  adaptlevel_init(cadaptlevel *a);
+int  adaptlevel_destroy(cadaptlevel *a);
+int  adaptlevel_set_bounds(cadaptlevel *a, int minlevel, int maxlevel, int startlevel);
+bool adaptlevel_enabled(cadaptlevel *a);
+int  adaptlevel_get_level(cadaptlevel *a);
+int  adaptlevel_account(cadaptlevel *a, int level, u64 realsize, u64 compsize);
+int  adaptlevel_show_stats(cadaptlevel *a);
+
+#endif // __ADAPTLEVEL_H__
@@ -49,6 +49,7 @@ char *cryptalgostr(int algo)
     {
         case ENCRYPT_NONE:     return "none";
         case ENCRYPT_BLOWFISH: return "blowfish";
+        case ENCRYPT_AES256GCM: return "aes256gcm";
         default:               return "unknown";
     }
 }
@@ -76,6 +77,10 @@ int archinfo_show_mainhead(carchreader *ai, cdico *dicomainhead)
             (int)FSA_VERSION_GET_B(ai->minfsaver), (int)FSA_VERSION_GET_C(ai->minfsaver), (int)FSA_VERSION_GET_D(ai->minfsaver));
     msgprintf(MSG_FORCE, "Compression level: \t\t%d (%s level %d)\n", ai->fsacomp, compalgostr(ai->compalgo), ai->complevel);
     msgprintf(MSG_FORCE, "Encryption algorithm: \t\t%s\n", cryptalgostr(ai->cryptalgo));
+    if (ai->maxblksize>FSA_MAX_BLKSIZE)
+        msgprintf(MSG_FORCE, "Size of the blocks: \t\t%s (long mode)\n", format_size(ai->maxblksize, buffer, sizeof(buffer), 'h'));
+    if (ai->basearchid!=0)
+        msgprintf(MSG_FORCE, "Base archive id: \t\t%.8x (incremental archive)\n", (unsigned int)ai->basearchid);
     msgprintf(MSG_FORCE, "\n");
 
     return 0;
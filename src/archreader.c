@@ -33,9 +33,13 @@
 #include "options.h"
 #include "archreader.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "syncthread.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
 #include "error.h"
+#include "dedup.h"
+#include "checksum.h"
 
 int archreader_init(carchreader *ai)
 {
@@ -50,6 +54,7 @@ int archreader_init(carchreader *ai)
     ai->curvol=0;
     ai->filefmtver=0;
     ai->hasdirsinfohead=false;
+    ai->maxblksize=FSA_MAX_BLKSIZE;
     return 0;
 }
 
@@ -440,8 +445,10 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     u64 blockoffset; // offset of the block in the file
     u16 compalgo; // compression algo used
     u16 cryptalgo; // encryption algo used
+    u16 sumalgo; // checksum algo used
     u32 finalsize; // compressed  block size
     u32 compsize;
+    u16 noncesize;
     u8 *buffer;
     
     assert(ai);
@@ -458,7 +465,7 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return -1;
     }
     
-    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_REALSIZE, &curblocksize)!=0 || curblocksize>FSA_MAX_BLKSIZE)
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_REALSIZE, &curblocksize)!=0 || curblocksize>ai->maxblksize)
     {   msgprintf(3, "cannot get blocksize from block-header\n");
         return -1;
     }
@@ -488,6 +495,20 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return -1;
     }
     
+    // the archives created before the checksum algorithm was recorded use fletcher32
+    if (dico_get_u16(in_blkdico, 0, BLOCKHEADITEMKEY_SUMALGO, &sumalgo)!=0)
+        sumalgo=SUMALGO_FLETCHER32;
+    else if ((sumalgo!=SUMALGO_FLETCHER32) && (sumalgo!=SUMALGO_CRC32C))
+    {   msgprintf(3, "unknown checksum algorithm in block-header: %d\n", (int)sumalgo);
+        return -1;
+    }
+    
+    if ((cryptalgo==ENCRYPT_AES256GCM) && ((dico_get_data(in_blkdico, 0, BLOCKHEADITEMKEY_CRYPTNONCE, out_blkinfo->blkcryptnonce,
+        FSA_AEAD_NONCELEN, &noncesize)!=0) || (noncesize!=FSA_AEAD_NONCELEN)))
+    {   msgprintf(3, "cannot get BLOCKHEADITEMKEY_CRYPTNONCE from block-header\n");
+        return -1;
+    }
+    
     if (in_skipblock==true) // the main thread does not need that block (block belongs to a filesys we want to skip)
     {
         if (lseek64(ai->archfd, (long)finalsize, SEEK_CUR)<0)
@@ -498,14 +519,14 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     }
     
     // ---- allocate memory
-    if ((buffer=malloc(finalsize))==NULL)
-    {   errprintf("cannot allocate block: malloc(%d) failed\n", finalsize);
+    if ((buffer=bufpool_alloc(&g_bufpool, finalsize))==NULL)
+    {   errprintf("cannot allocate block: bufpool_alloc(%d) failed\n", finalsize);
         return FSAERR_ENOMEM;
     }
     
     if (read(ai->archfd, buffer, (long)finalsize)!=(long)finalsize)
     {   sysprintf("cannot read block (finalsize=%ld) failed\n", (long)finalsize);
-        free(buffer);
+        bufpool_free(&g_bufpool, buffer);
         return -1;
     }
     
@@ -514,19 +535,27 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     out_blkinfo->blkrealsize=curblocksize;
     out_blkinfo->blkoffset=blockoffset;
     out_blkinfo->blkarcsum=arblockcsumorig;
+    out_blkinfo->blksumalgo=sumalgo;
     out_blkinfo->blkcompalgo=compalgo;
     out_blkinfo->blkcryptalgo=cryptalgo;
     out_blkinfo->blkarsize=finalsize;
     out_blkinfo->blkcompsize=compsize;
     
-    // ---- checksum
-    arblockcsumcalc=fletcher32(buffer, finalsize);
+    // blocks of small files may be compressed with the zstd dictionary of their filesystem
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_ZSTDDICTID, &out_blkinfo->blkdictid)!=0)
+        out_blkinfo->blkdictid=0;
+    
+    // ---- checksum (the authentication tag of blocks encrypted with an aead cipher is checked when they are decrypted)
+    // this is the only verification of the block: the decompression threads only receive the blocks which are valid
+    arblockcsumcalc=arblockcsumorig;
+    if (cryptalgo!=ENCRYPT_AES256GCM)
+        checksum_block(sumalgo, buffer, finalsize, &arblockcsumcalc);
     if (arblockcsumcalc!=arblockcsumorig) // bad checksum
     {
         errprintf("block is corrupt at offset=%ld, blksize=%ld\n", (long)blockoffset, (long)curblocksize);
-        free(out_blkinfo->blkdata);
-        if ((out_blkinfo->blkdata=malloc(curblocksize))==NULL)
-        {   errprintf("cannot allocate block: malloc(%d) failed\n", curblocksize);
+        bufpool_free(&g_bufpool, out_blkinfo->blkdata);
+        if ((out_blkinfo->blkdata=bufpool_alloc(&g_bufpool, curblocksize))==NULL)
+        {   errprintf("cannot allocate block: bufpool_alloc(%d) failed\n", curblocksize);
             return FSAERR_ENOMEM;
         }
         memset(out_blkinfo->blkdata, 0, curblocksize);
@@ -543,3 +572,102 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     
     return 0;
 }
+
+// read the first copy of a block from the location given by a reference to a duplicate block. The
+// first copy is read using refai, another reader on the same archive, so that the position of ai is kept
+int archreader_read_blockref(carchreader *ai, carchreader *refai, cdico *in_refdico, int *out_sumok, struct s_blockinfo *out_blkinfo)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    cdico *blkdico=NULL;
+    u64 blockoffset;
+    u64 position;
+    u32 realsize;
+    u32 volume;
+    u16 fsid;
+    int res;
+    
+    assert(ai);
+    assert(refai);
+    assert(in_refdico);
+    assert(out_blkinfo);
+    
+    if ((dico_get_u64(in_refdico, 0, BLOCKREFKEY_BLOCKOFFSET, &blockoffset)!=0) ||
+        (dico_get_u32(in_refdico, 0, BLOCKREFKEY_REALSIZE, &realsize)!=0) ||
+        (dico_get_u32(in_refdico, 0, BLOCKREFKEY_VOLUME, &volume)!=0) ||
+        (dico_get_u64(in_refdico, 0, BLOCKREFKEY_POSITION, &position)!=0))
+    {   msgprintf(3, "cannot get the location of the block from block-reference\n");
+        return -1;
+    }
+    
+    // open the volume which contains the first copy if this is not the one already open
+    if ((refai->archfd<0) || (refai->curvol!=volume))
+    {
+        archreader_close(refai);
+        *refai=*ai;
+        refai->archfd=-1;
+        refai->curvol=volume;
+        if ((archreader_volpath(refai)!=0) || (archreader_open(refai)!=0))
+        {   errprintf("cannot open volume %ld which contains the first copy of a block\n", (long)volume);
+            return -1;
+        }
+    }
+    
+    if (lseek64(refai->archfd, (off64_t)position, SEEK_SET)!=(off64_t)position)
+    {   sysprintf("lseek64(pos=%lld, SEEK_SET) failed in volume %s\n", (long long)position, refai->volpath);
+        return -1;
+    }
+    
+    if (((res=archreader_read_header(refai, magic, &blkdico, false, &fsid))!=FSAERR_SUCCESS) ||
+        (memcmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)!=0))
+    {   errprintf("there is no block header at the location given by the reference: volume=%ld, position=%lld\n",
+            (long)volume, (long long)position);
+        dico_destroy(blkdico);
+        return -1;
+    }
+    
+    res=archreader_read_block(refai, blkdico, false, out_sumok, out_blkinfo);
+    dico_destroy(blkdico);
+    if (res!=0)
+    {   msgprintf(MSG_STACK, "archreader_read_block() failed\n");
+        return res;
+    }
+    
+    if (out_blkinfo->blkrealsize!=realsize)
+    {   errprintf("the size of the first copy of the block does not match: realsize=%ld, expected=%ld\n",
+            (long)out_blkinfo->blkrealsize, (long)realsize);
+        bufpool_free(&g_bufpool, out_blkinfo->blkdata);
+        return -1;
+    }
+    
+    // the block is restored at its own offset, the offset of the first copy is required to decrypt it
+    out_blkinfo->blkrefoffset=out_blkinfo->blkoffset;
+    out_blkinfo->blkoffset=blockoffset;
+    out_blkinfo->blkdedup=BLKDEDUP_REF;
+    
+    return 0;
+}
+
+// a zero extent replaces the data blocks of a hole of a sparse file: it has no data in the archive
+int archreader_read_blockzero(carchreader *ai, cdico *in_zerodico, struct s_blockinfo *out_blkinfo)
+{
+    u64 blockoffset;
+    u32 realsize;
+    
+    assert(ai);
+    assert(in_zerodico);
+    assert(out_blkinfo);
+    
+    if ((dico_get_u64(in_zerodico, 0, BLOCKZEROKEY_BLOCKOFFSET, &blockoffset)!=0) ||
+        (dico_get_u32(in_zerodico, 0, BLOCKZEROKEY_REALSIZE, &realsize)!=0) || (realsize==0))
+    {   msgprintf(3, "cannot get the offset and the size of the zero extent\n");
+        return -1;
+    }
+    
+    memset(out_blkinfo, 0, sizeof(struct s_blockinfo));
+    out_blkinfo->blkdata=NULL;
+    out_blkinfo->blkoffset=blockoffset;
+    out_blkinfo->blkrealsize=realsize;
+    out_blkinfo->blkzero=true;
+    
+    return 0;
+}
@@ -39,6 +39,8 @@ struct s_archreader
     u32    fsacomp; // fsa compression level given on the command line by the user
     u64    creattime; // archive create time (number of seconds since epoch)
     u64    minfsaver; // minimum fsarchiver version required to restore that archive
+    u32    maxblksize; // size of the largest data blocks (bigger than FSA_MAX_BLKSIZE in long mode)
+    u32    basearchid; // archive-id of the base archive if this is an incremental archive (0 otherwise)
     u32    hasdirsinfohead; // true if the archive has a "DiRs" header (introduced in 0.6.7)
     int    filefmtver; // set to 1 for "FsArCh_001" or 2 for "FsArCh_002"
     char   filefmt[FSA_MAX_FILEFMTLEN]; // file format of that archive
@@ -59,5 +61,7 @@ int archreader_read_dico(carchreader *ai, struct s_dico *d);
 int archreader_read_volheader(carchreader *ai);
 int archreader_read_header(carchreader *ai, char *magic, struct s_dico **d, bool allowseek, u16 *fsid);
 int archreader_read_block(carchreader *ai, struct s_dico *in_blkdico, int in_skipblock, int *out_sumok, struct s_blockinfo *out_blkinfo);
+int archreader_read_blockref(carchreader *ai, carchreader *refai, struct s_dico *in_refdico, int *out_sumok, struct s_blockinfo *out_blkinfo);
+int archreader_read_blockzero(carchreader *ai, struct s_dico *in_zerodico, struct s_blockinfo *out_blkinfo);
 
 #endif // __ARCHREADER_H__
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <sys/statvfs.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <assert.h>
 
 #include "fsarchiver.h"
@@ -50,6 +51,11 @@ int archwriter_init(carchwriter *ai)
     ai->archfd=-1;
     ai->archid=0;
     ai->curvol=0;
+    ai->curpos=0;
+    ai->stagebuf=NULL;
+    ai->stagesize=0;
+    ai->writeitems=0;
+    ai->writecalls=0;
     return 0;
 }
 
@@ -57,6 +63,8 @@ int archwriter_destroy(carchwriter *ai)
 {
     assert(ai);
     strlist_destroy(&ai->vollist);
+    free(ai->stagebuf);
+    ai->stagebuf=NULL;
     return 0;
 }
 
@@ -117,6 +125,8 @@ int archwriter_create(carchwriter *ai)
         return -1;
     }
     ai->newarch=true;
+    ai->curpos=0;
+    ai->stagesize=0;
     
     strlist_add(&ai->vollist, ai->volpath);
     
@@ -130,19 +140,30 @@ int archwriter_create(carchwriter *ai)
     return 0;
 }
 
+// the volume is incomplete when the staged data cannot be written: the caller must remove the archive
 int archwriter_close(carchwriter *ai)
 {
+    int ret=0;
+    
     assert(ai);
     
     if (ai->archfd<0)
         return -1;
     
+    if (archwriter_flush(ai, true)!=0)
+    {   msgprintf(MSG_STACK, "archwriter_flush() failed\n");
+        ret=-1;
+    }
+    
     //res=lockf(ai->archfd, F_ULOCK, 0);
     fsync(ai->archfd); // just in case the user reboots after it exits
-    close(ai->archfd);
+    if (close(ai->archfd)!=0)
+    {   sysprintf("cannot close archive %s\n", ai->volpath);
+        ret=-1;
+    }
     ai->archfd=-1;
     
-    return 0;
+    return ret;
 }
 
 int archwriter_remove(carchwriter *ai)
@@ -155,7 +176,9 @@ int archwriter_remove(carchwriter *ai)
     
     if (ai->archfd >= 0)
     {
-        archwriter_close(ai);
+        ai->stagesize=0; // the staged data would be removed with the volume
+        if (archwriter_close(ai)!=0)
+            msgprintf(MSG_STACK, "archwriter_close() failed\n");
     }
     
     if (ai->newarch==true)
@@ -178,27 +201,20 @@ int archwriter_remove(carchwriter *ai)
 s64 archwriter_get_currentpos(carchwriter *ai)
 {
     assert(ai);
-    return (s64)lseek64(ai->archfd, 0, SEEK_CUR);
+    return ai->curpos;
 }
 
-int archwriter_write_buffer(carchwriter *ai, struct s_writebuf *wb)
+int archwriter_write_iovec(carchwriter *ai, struct iovec *iov, int iovcnt, long totsize)
 {
     struct statvfs64 statvfsbuf;
     char textbuf[128];
     long lres;
     
-    assert(ai);
-    assert(wb);
-
-    if (wb->size == 0)
-    {   errprintf("wb->size=%ld\n", (long)wb->size);
-        return -1;
-    }
-
-    if ((lres=write(ai->archfd, (char*)wb->data, (long)wb->size))!=(long)wb->size)
+    ai->writecalls++;
+    if ((lres=writev(ai->archfd, iov, iovcnt))!=totsize)
     {
-        errprintf("write(size=%ld) returned %ld\n", (long)wb->size, (long)lres);
-        if ((lres>0) && (lres < (long)wb->size)) // probably "no space left"
+        errprintf("write(size=%ld) returned %ld\n", (long)totsize, (long)lres);
+        if ((lres>0) && (lres < totsize)) // probably "no space left"
         {
             if (fstatvfs64(ai->archfd, &statvfsbuf)!=0)
             {   sysprintf("fstatvfs(fd=%d) failed\n", ai->archfd);
@@ -214,14 +230,108 @@ int archwriter_write_buffer(carchwriter *ai, struct s_writebuf *wb)
         }
         else // another error
         {
-            sysprintf("write(size=%ld) failed\n", (long)wb->size);
+            sysprintf("write(size=%ld) failed\n", (long)totsize);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// write the staged data: only up to the last ARCHWRITER_ALIGN boundary of the volume unless all is true
+int archwriter_flush(carchwriter *ai, bool all)
+{
+    struct iovec iov;
+    u64 keepsize;
+    u64 len;
+    
+    assert(ai);
+    
+    if (ai->stagesize==0)
+        return 0;
+    
+    keepsize=all ? 0 : (u64)ai->curpos % ARCHWRITER_ALIGN;
+    if (keepsize >= ai->stagesize)
+        return 0;
+    len=ai->stagesize-keepsize;
+    
+    iov.iov_base=ai->stagebuf;
+    iov.iov_len=len;
+    if (archwriter_write_iovec(ai, &iov, 1, (long)len)!=0)
+    {   ai->stagesize=0;
+        return -1;
+    }
+    
+    if (keepsize>0)
+        memmove(ai->stagebuf, ai->stagebuf+len, keepsize);
+    ai->stagesize=keepsize;
+    return 0;
+}
+
+int archwriter_write_buffer(carchwriter *ai, struct s_writebuf *wb)
+{
+    struct iovec iov[3];
+    long totsize;
+    int iovcnt;
+    
+    assert(ai);
+    assert(wb);
+
+    if ((totsize=(long)writebuf_get_size(wb)) == 0)
+    {   errprintf("wb->size=%ld\n", (long)totsize);
+        return -1;
+    }
+    
+    if (ai->stagebuf==NULL && (ai->stagebuf=malloc(ARCHWRITER_STAGESIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: cannot allocate memory for the staging buffer\n", (long)ARCHWRITER_STAGESIZE);
+        return -1;
+    }
+    ai->writeitems++;
+
+    if (totsize <= ARCHWRITER_STAGEMAXITEM) // small items such as object headers are accumulated in the staging buffer
+    {
+        if ((ai->stagesize+totsize > ARCHWRITER_STAGESIZE) && (archwriter_flush(ai, false)!=0))
+        {   msgprintf(MSG_STACK, "archwriter_flush() failed\n");
             return -1;
         }
+        memcpy(ai->stagebuf+ai->stagesize, wb->data, wb->size);
+        if (wb->extsize>0)
+            memcpy(ai->stagebuf+ai->stagesize+wb->size, wb->extdata, wb->extsize);
+        ai->stagesize+=totsize;
     }
+    else // the staged data, the header and the payload of a block are written together without being copied
+    {
+        iovcnt=0;
+        if (ai->stagesize>0)
+        {   iov[iovcnt].iov_base=ai->stagebuf;
+            iov[iovcnt++].iov_len=ai->stagesize;
+        }
+        iov[iovcnt].iov_base=wb->data;
+        iov[iovcnt++].iov_len=wb->size;
+        if (wb->extsize>0)
+        {   iov[iovcnt].iov_base=wb->extdata;
+            iov[iovcnt++].iov_len=wb->extsize;
+        }
+        if (archwriter_write_iovec(ai, iov, iovcnt, (long)(ai->stagesize+totsize))!=0)
+        {   ai->stagesize=0;
+            return -1;
+        }
+        ai->stagesize=0;
+    }
+    ai->curpos+=totsize;
     
     return 0;
 }
 
+int archwriter_show_stats(carchwriter *ai)
+{
+    assert(ai);
+    msgprintf(MSG_VERB1, "Archive writer: %lld items written using %lld system calls (%lld system calls saved)\n",
+        (long long)ai->writeitems, (long long)ai->writecalls,
+        (long long)((ai->writeitems>ai->writecalls)?(ai->writeitems-ai->writecalls):0));
+    return 0;
+}
+
 int archwriter_volpath(carchwriter *ai)
 {
     int res;
@@ -245,15 +355,11 @@ int archwriter_incvolume(carchwriter *ai, bool waitkeypress)
 
 int archwriter_write_volheader(carchwriter *ai)
 {
-    struct s_writebuf *wb=NULL;
+    struct s_writebuf wb;
     cdico *voldico;
     
     assert(ai);
-    
-    if ((wb=writebuf_alloc())==NULL)
-    {   msgprintf(MSG_STACK, "writebuf_alloc() failed\n");
-        return -1;
-    }
+    writebuf_init(&wb);
     
     if ((voldico=dico_alloc())==NULL)
     {   msgprintf(MSG_STACK, "voldico=dico_alloc() failed\n");
@@ -267,34 +373,30 @@ int archwriter_write_volheader(carchwriter *ai)
     dico_add_string(voldico, 0, VOLUMEHEADKEY_PROGVERCREAT, FSA_VERSION);
     
     // write header to buffer
-    if (writebuf_add_header(wb, voldico, FSA_MAGIC_VOLH, ai->archid, FSA_FILESYSID_NULL)!=0)
+    if (writebuf_add_header(&wb, voldico, FSA_MAGIC_VOLH, ai->archid, FSA_FILESYSID_NULL)!=0)
     {   errprintf("archio_write_header() failed\n");
         return -1;
     }
     
     // write header to file
-    if (archwriter_write_buffer(ai, wb)!=0)
+    if (archwriter_write_buffer(ai, &wb)!=0)
     {   errprintf("archwriter_write_buffer() failed\n");
         return -1;
     }
     
     dico_destroy(voldico);
-    writebuf_destroy(wb);
+    writebuf_release(&wb);
     
     return 0;
 }
 
 int archwriter_write_volfooter(carchwriter *ai, bool lastvol)
 {
-    struct s_writebuf *wb=NULL;
+    struct s_writebuf wb;
     cdico *voldico;
     
     assert(ai);
-    
-    if ((wb=writebuf_alloc())==NULL)
-    {   errprintf("writebuf_alloc() failed\n");
-        return -1;
-    }
+    writebuf_init(&wb);
     
     if ((voldico=dico_alloc())==NULL)
     {   errprintf("voldico=dico_alloc() failed\n");
@@ -307,19 +409,19 @@ int archwriter_write_volfooter(carchwriter *ai, bool lastvol)
     dico_add_u32(voldico, 0, VOLUMEFOOTKEY_LASTVOL, lastvol);
     
     // write header to buffer
-    if (writebuf_add_header(wb, voldico, FSA_MAGIC_VOLF, ai->archid, FSA_FILESYSID_NULL)!=0)
+    if (writebuf_add_header(&wb, voldico, FSA_MAGIC_VOLF, ai->archid, FSA_FILESYSID_NULL)!=0)
     {   msgprintf(MSG_STACK, "archio_write_header() failed\n");
         return -1;
     }
     
     // write header to file
-    if (archwriter_write_buffer(ai, wb)!=0)
-    {   msgprintf(MSG_STACK, "archwriter_write_data(size=%ld) failed\n", (long)wb->size);
+    if (archwriter_write_buffer(ai, &wb)!=0)
+    {   msgprintf(MSG_STACK, "archwriter_write_data(size=%ld) failed\n", (long)wb.size);
         return -1;
     }
     
     dico_destroy(voldico);
-    writebuf_destroy(wb);
+    writebuf_release(&wb);
     
     return 0;
 }
@@ -327,19 +429,21 @@ int archwriter_write_volfooter(carchwriter *ai, bool lastvol)
 int archwriter_split_check(carchwriter *ai, struct s_writebuf *wb)
 {
     s64 cursize;
+    s64 wbsize;
     
     assert(ai);
 
-    if (((cursize=archwriter_get_currentpos(ai))>=0) && (g_options.splitsize>0 && cursize+wb->size > g_options.splitsize))
+    wbsize=(s64)writebuf_get_size(wb);
+    if (((cursize=archwriter_get_currentpos(ai))>=0) && (g_options.splitsize>0 && cursize+wbsize > g_options.splitsize))
     {
         msgprintf(MSG_DEBUG4, "splitchk: YES --> cursize=%lld, g_options.splitsize=%lld, cursize+wb->size=%lld, wb->size=%lld\n",
-            (long long)cursize, (long long)g_options.splitsize, (long long)cursize+wb->size, (long long)wb->size);
+            (long long)cursize, (long long)g_options.splitsize, (long long)cursize+wbsize, (long long)wbsize);
         return true;
     }
     else
     {
         msgprintf(MSG_DEBUG4, "splitchk: NO --> cursize=%lld, g_options.splitsize=%lld, cursize+wb->size=%lld, wb->size=%lld\n",
-            (long long)cursize, (long long)g_options.splitsize, (long long)cursize+wb->size, (long long)wb->size);
+            (long long)cursize, (long long)g_options.splitsize, (long long)cursize+wbsize, (long long)wbsize);
         return false;
     }
 }
@@ -354,7 +458,10 @@ int archwriter_split_if_necessary(carchwriter *ai, struct s_writebuf *wb)
         {   msgprintf(MSG_STACK, "cannot write volume footer: archio_write_volfooter() failed\n");
             return -1;
         }
-        archwriter_close(ai);
+        if (archwriter_close(ai)!=0)
+        {   msgprintf(MSG_STACK, "cannot close volume %s: archwriter_close() failed\n", ai->volpath);
+            return -1;
+        }
         archwriter_incvolume(ai, false);
         msgprintf(MSG_VERB2, "Creating new volume: [%s]\n", ai->volpath);
         if (archwriter_create(ai)!=0)
@@ -371,60 +478,56 @@ int archwriter_split_if_necessary(carchwriter *ai, struct s_writebuf *wb)
 
 int archwriter_dowrite_block(carchwriter *ai, struct s_blockinfo *blkinfo)
 {
-    struct s_writebuf *wb=NULL;
+    struct s_writebuf wb;
     
     assert(ai);
+    writebuf_init(&wb);
 
-    if ((wb=writebuf_alloc())==NULL)
-    {   errprintf("writebuf_alloc() failed\n");
-        return -1;
-    }
-    
-    if (writebuf_add_block(wb, blkinfo, ai->archid, blkinfo->blkfsid)!=0)
+    if (writebuf_add_block(&wb, blkinfo, ai->archid, blkinfo->blkfsid)!=0)
     {   msgprintf(MSG_STACK, "archio_write_block() failed\n");
         return -1;
     }
     
-    if (archwriter_split_if_necessary(ai, wb)!=0)
+    if (archwriter_split_if_necessary(ai, &wb)!=0)
     {   msgprintf(MSG_STACK, "archwriter_split_if_necessary() failed\n");
         return -1;
     }
     
-    if (archwriter_write_buffer(ai, wb)!=0)
+    // location of the block in the archive (used by the references to the duplicate blocks)
+    ai->lastblkvol=ai->curvol;
+    ai->lastblkpos=ai->curpos;
+    
+    if (archwriter_write_buffer(ai, &wb)!=0)
     {   msgprintf(MSG_STACK, "archwriter_write_buffer() failed\n");
         return -1;
     }
 
-    writebuf_destroy(wb);
+    writebuf_release(&wb);
     return 0;
 }
 
 int archwriter_dowrite_header(carchwriter *ai, struct s_headinfo *headinfo)
 {
-    struct s_writebuf *wb=NULL;
+    struct s_writebuf wb;
     
     assert(ai);
+    writebuf_init(&wb);
 
-    if ((wb=writebuf_alloc())==NULL)
-    {   errprintf("writebuf_alloc() failed\n");
-        return -1;
-    }
-    
-    if (writebuf_add_header(wb, headinfo->dico, headinfo->magic, ai->archid, headinfo->fsid)!=0)
+    if (writebuf_add_header(&wb, headinfo->dico, headinfo->magic, ai->archid, headinfo->fsid)!=0)
     {   msgprintf(MSG_STACK, "archio_write_block() failed\n");
         return -1;
     }
     
-    if (archwriter_split_if_necessary(ai, wb)!=0)
+    if (archwriter_split_if_necessary(ai, &wb)!=0)
     {   msgprintf(MSG_STACK, "archwriter_split_if_necessary() failed\n");
         return -1;
     }
     
-    if (archwriter_write_buffer(ai, wb)!=0)
+    if (archwriter_write_buffer(ai, &wb)!=0)
     {   msgprintf(MSG_STACK, "archwriter_write_buffer() failed\n");
         return -1;
     }
     
-    writebuf_destroy(wb);
+    writebuf_release(&wb);
     return 0;
 }
@@ -21,6 +21,11 @@
 #include <limits.h>
 #include "strlist.h"
 
+#define ARCHWRITER_STAGESIZE    (8LL*1024LL*1024LL) // small items are accumulated in a buffer that large before being written
+#define ARCHWRITER_STAGEMAXITEM (64LL*1024LL) // larger items are written directly together with the staged data
+#define ARCHWRITER_ALIGN        4096 // staged data is flushed in chunks which end on such a boundary
+
+struct iovec;
 struct s_writebuf;
 struct s_blockinfo;
 struct s_headinfo;
@@ -33,6 +38,13 @@ struct s_archwriter
 {   int    archfd; // file descriptor of the current volume (set to -1 when closed)
     u32    archid; // 32bit archive id for checking (random number generated at creation)
     u32    curvol; // current volume number, starts at 0, incremented when we change the volume
+    s64    curpos; // offset in the current volume including staged data, tracked here to avoid calling lseek64()
+    u32    lastblkvol; // volume where the header of the last data block has been written
+    s64    lastblkpos; // offset of the header of the last data block in that volume
+    char   *stagebuf; // staging buffer where small items are accumulated before they are written
+    u64    stagesize; // number of bytes waiting in stagebuf
+    u64    writeitems; // number of buffers passed to archwriter_write_buffer()
+    u64    writecalls; // number of system calls used to write them
     bool   newarch; // true when the archive has been created by then current process
     char   filefmt[FSA_MAX_FILEFMTLEN]; // file format of that archive
     char   creatver[FSA_MAX_PROGVERLEN]; // fsa version used to create archive
@@ -50,7 +62,10 @@ int archwriter_remove(carchwriter *ai);
 int archwriter_generate_id(carchwriter *ai);
 s64 archwriter_get_currentpos(carchwriter *ai);
 int archwriter_is_path_to_curvol(carchwriter *ai, char *path);
+int archwriter_write_iovec(carchwriter *ai, struct iovec *iov, int iovcnt, long totsize);
 int archwriter_write_buffer(carchwriter *ai, struct s_writebuf *wb);
+int archwriter_flush(carchwriter *ai, bool all);
+int archwriter_show_stats(carchwriter *ai);
 int archwriter_incvolume(carchwriter *ai, bool waitkeypress);
 int archwriter_volpath(carchwriter *ai);
 int archwriter_write_volheader(carchwriter *ai);
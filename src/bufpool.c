@@ -0,0 +1,165 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "bufpool.h"
+#include "common.h"
+#include "options.h"
+#include "error.h"
+
+int bufpool_init(cbufpool *p)
+{
+    if (!p)
+    {   errprintf("p is NULL\n");
+        return -1;
+    }
+    
+    memset(p, 0, sizeof(cbufpool));
+    if (pthread_mutex_init(&p->mutex, NULL)!=0)
+    {   errprintf("pthread_mutex_init failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+// release the buffers which are in the free list (the mutex must be locked)
+void bufpoollocked_release(cbufpool *p)
+{
+    cbufhead *cur;
+    cbufhead *next;
+    
+    for (cur=p->freelist; cur!=NULL; cur=next)
+    {
+        next=cur->next;
+        free(cur);
+    }
+    p->freelist=NULL;
+    p->freecount=0;
+}
+
+int bufpool_destroy(cbufpool *p)
+{
+    if (!p)
+    {   errprintf("p is NULL\n");
+        return -1;
+    }
+    
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    bufpoollocked_release(p);
+    p->bufsize=0;
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    assert(pthread_mutex_destroy(&p->mutex)==0);
+    return 0;
+}
+
+// the pool only recycles buffers of bufsize bytes: this has to be called before the blocks are allocated
+int bufpool_set_bufsize(cbufpool *p, u64 bufsize)
+{
+    u64 maxblocks;
+    
+    if (!p || bufsize==0)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    // keep enough free buffers for a full queue plus the blocks being processed by the threads
+    maxblocks=(g_options.queuemem>0)?(g_options.queuemem/bufsize):(FSA_MAX_QUEUESIZE);
+    
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    if (bufsize!=p->bufsize)
+        bufpoollocked_release(p);
+    p->bufsize=bufsize;
+    p->maxfree=maxblocks+2*g_options.compressjobs+2;
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    return 0;
+}
+
+// allocate a buffer which can store at least size bytes: it must be released with bufpool_free()
+void *bufpool_alloc(cbufpool *p, u64 size)
+{
+    cbufhead *head=NULL;
+    u64 capacity;
+    
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    // small buffers are not worth taking a full size buffer (eg: small files packed together)
+    if ((p->bufsize>0) && (size <= p->bufsize) && (size >= p->bufsize/2))
+    {
+        if ((head=p->freelist)!=NULL)
+        {   p->freelist=head->next;
+            p->freecount--;
+            p->hits++;
+        }
+        else
+        {   p->misses++;
+        }
+        capacity=p->bufsize;
+    }
+    else
+    {   p->unpooled++;
+        capacity=size;
+    }
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    
+    if ((head==NULL) && ((head=malloc(sizeof(cbufhead)+capacity))==NULL))
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)(sizeof(cbufhead)+capacity));
+        return NULL;
+    }
+    
+    head->capacity=capacity;
+    head->next=NULL;
+    return (char*)head+sizeof(cbufhead);
+}
+
+// give a buffer back to the pool so that it can be reused by the next allocation
+void bufpool_free(cbufpool *p, void *buf)
+{
+    cbufhead *head;
+    
+    if (buf==NULL)
+        return;
+    
+    head=(cbufhead*)((char*)buf-sizeof(cbufhead));
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    if ((head->capacity==p->bufsize) && (p->freecount < p->maxfree))
+    {   head->next=p->freelist;
+        p->freelist=head;
+        p->freecount++;
+        head=NULL;
+    }
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    
+    free(head); // buffer not kept in the pool
+}
+
+int bufpool_show_stats(cbufpool *p)
+{
+    char buffer[256];
+    
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    msgprintf(MSG_VERB1, "Buffer pool: %lld hits, %lld misses, %lld allocations not pooled (buffers of %s)\n",
+        (long long)p->hits, (long long)p->misses, (long long)p->unpooled, format_size(p->bufsize, buffer, sizeof(buffer), 'h'));
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    return 0;
+}
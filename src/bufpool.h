@@ -0,0 +1,55 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#include <pthread.h>
+
+struct s_bufhead;
+typedef struct s_bufhead cbufhead;
+
+struct s_bufpool;
+typedef struct s_bufpool cbufpool;
+
+struct s_bufhead // stored just before the data of each buffer
+{   u64                  capacity; // how many bytes can be stored in the buffer
+    cbufhead             *next; // next buffer in the list of free buffers
+};
+
+struct s_bufpool // recycles the data block buffers between the threads
+{   pthread_mutex_t      mutex; // pthread mutex for data protection
+    cbufhead             *freelist; // buffers which are ready to be reused
+    u64                  freecount; // how many buffers there are in the free list
+    u64                  maxfree; // how many buffers can be kept in the free list
+    u64                  bufsize; // capacity of the buffers managed by the pool (0 when disabled)
+    u64                  hits; // allocations served from the free list
+    u64                  misses; // allocations which required a call to malloc
+    u64                  unpooled; // allocations which are too small or too big for the pool
+};
+
+// capacity required for a block of blksize bytes after compression and encryption
+#define BUFPOOL_BOUND(blksize)  ((blksize)+((blksize)/16)+64+3+8)
+
+int  bufpool_init(cbufpool *p);
+int  bufpool_destroy(cbufpool *p);
+int  bufpool_set_bufsize(cbufpool *p, u64 bufsize);
+void *bufpool_alloc(cbufpool *p, u64 size);
+void bufpool_free(cbufpool *p, void *buf);
+int  bufpool_show_stats(cbufpool *p);
+
+#endif // __BUFPOOL_H__
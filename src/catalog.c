@@ -0,0 +1,271 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "catalog.h"
+#include "archreader.h"
+#include "common.h"
+#include "queue.h"
+#include "dico.h"
+#include "error.h"
+
+ccatalog *catalog_alloc()
+{
+    ccatalog *c;
+    
+    if ((c=calloc(1, sizeof(ccatalog)))==NULL)
+        return NULL;
+    if ((c->buckets=calloc(CATALOG_MINBUCKETS, sizeof(ccatalogentry*)))==NULL)
+    {   free(c);
+        return NULL;
+    }
+    c->bucketcount=CATALOG_MINBUCKETS;
+    return c;
+}
+
+int catalog_destroy(ccatalog *c)
+{
+    ccatalogentry *entry, *next;
+    u32 i;
+    
+    if (c==NULL)
+        return -1;
+    
+    for (i=0; i<c->bucketcount; i++)
+    {
+        for (entry=c->buckets[i]; entry!=NULL; entry=next)
+        {
+            next=entry->next;
+            free(entry->relpath);
+            free(entry);
+        }
+    }
+    
+    free(c->buckets);
+    free(c);
+    
+    return 0;
+}
+
+// fnv-1a hash of the path, the filesystem is part of the key
+u32 catalog_hash(u16 fsid, char *relpath)
+{
+    u32 hash=2166136261U^fsid;
+    
+    for (; *relpath!=0; relpath++)
+        hash=(hash^(u8)*relpath)*16777619U;
+    return hash;
+}
+
+// double the number of buckets so that the lists remain short with millions of files
+int catalog_grow(ccatalog *c)
+{
+    ccatalogentry **buckets;
+    ccatalogentry *entry, *next;
+    u32 count=c->bucketcount*2;
+    u32 i;
+    
+    if ((buckets=calloc(count, sizeof(ccatalogentry*)))==NULL)
+        return -1; // the catalog still works with longer lists
+    
+    for (i=0; i<c->bucketcount; i++)
+    {
+        for (entry=c->buckets[i]; entry!=NULL; entry=next)
+        {
+            next=entry->next;
+            entry->next=buckets[entry->hash&(count-1)];
+            buckets[entry->hash&(count-1)]=entry;
+        }
+    }
+    
+    free(c->buckets);
+    c->buckets=buckets;
+    c->bucketcount=count;
+    return 0;
+}
+
+int catalog_add(ccatalog *c, ccatalogentry *entry)
+{
+    u32 index;
+    
+    if ((c->count>=((u64)c->bucketcount)*2) && (c->bucketcount<0x80000000U))
+        catalog_grow(c);
+    
+    entry->hash=catalog_hash(entry->fsid, entry->relpath);
+    index=entry->hash&(c->bucketcount-1);
+    entry->next=c->buckets[index];
+    c->buckets[index]=entry;
+    c->count++;
+    return 0;
+}
+
+ccatalogentry *catalog_find(ccatalog *c, u16 fsid, char *relpath)
+{
+    ccatalogentry *entry;
+    u32 hash;
+    
+    assert(c);
+    
+    hash=catalog_hash(fsid, relpath);
+    for (entry=c->buckets[hash&(c->bucketcount-1)]; entry!=NULL; entry=entry->next)
+    {
+        if ((entry->hash==hash) && (entry->fsid==fsid) && (strcmp(entry->relpath, relpath)==0))
+            return entry;
+    }
+    return NULL;
+}
+
+// read the headers of all the objects of the base archive: the data blocks are skipped and only the regular
+// files which have their data in the base archive are kept, with the location of their object header
+int catalog_load(ccatalog *c, char *archive)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    char relpath[PATH_MAX];
+    ccatalogentry *pending=NULL;
+    struct s_blockinfo blkinfo;
+    u32 endofarchive=false;
+    carchreader ai;
+    cdico *d=NULL;
+    u32 objtype;
+    s64 curpos;
+    int sumok;
+    int ret=-1;
+    u16 fsid;
+    
+    assert(c);
+    
+    archreader_init(&ai);
+    path_force_extension(ai.basepath, PATH_MAX, archive, ".fsa");
+    snprintf(c->basepath, sizeof(c->basepath), "%s", ai.basepath);
+    
+    if ((archreader_volpath(&ai)!=0) || (archreader_open(&ai)!=0))
+    {   errprintf("cannot open the base archive %s\n", ai.basepath);
+        goto catalog_load_end;
+    }
+    
+    if (archreader_read_volheader(&ai)!=0)
+    {   errprintf("archreader_read_volheader() failed on the base archive\n");
+        goto catalog_load_end;
+    }
+    
+    if ((archreader_read_header(&ai, magic, &d, false, &fsid)!=FSAERR_SUCCESS) ||
+        (memcmp(magic, FSA_MAGIC_MAIN, FSA_SIZEOF_MAGIC)!=0) ||
+        (dico_get_u32(d, 0, MAINHEADKEY_ARCHIVEID, &c->archid)!=0) ||
+        (dico_get_u32(d, 0, MAINHEADKEY_ARCHTYPE, &c->archtype)!=0))
+    {   errprintf("cannot read the main header of the base archive\n");
+        goto catalog_load_end;
+    }
+    if (dico_get_u32(d, 0, MAINHEADKEY_MAXBLKSIZE, &ai.maxblksize)!=0)
+        ai.maxblksize=FSA_MAX_BLKSIZE;
+    ai.archid=c->archid;
+    dico_destroy(d);
+    d=NULL;
+    
+    while (endofarchive==false)
+    {
+        if ((curpos=lseek64(ai.archfd, 0, SEEK_CUR))<0)
+        {   sysprintf("lseek64() failed to get the current position in the base archive\n");
+            goto catalog_load_end;
+        }
+        
+        if (archreader_read_header(&ai, magic, &d, false, &fsid)!=FSAERR_SUCCESS)
+        {   errprintf("cannot read the base archive %s at position %lld\n", ai.volpath, (long long)curpos);
+            goto catalog_load_end;
+        }
+        
+        if (memcmp(magic, FSA_MAGIC_VOLF, FSA_SIZEOF_MAGIC)==0) // end of volume
+        {
+            archreader_close(&ai);
+            if (dico_get_u32(d, 0, VOLUMEFOOTKEY_LASTVOL, &endofarchive)!=0)
+            {   errprintf("cannot get VOLUMEFOOTKEY_LASTVOL from the base archive\n");
+                goto catalog_load_end;
+            }
+            if ((endofarchive!=true) && ((archreader_incvolume(&ai, false)!=0) || (archreader_open(&ai)!=0) ||
+                (archreader_read_volheader(&ai)!=0)))
+            {   errprintf("cannot open volume %ld of the base archive: %s\n", (long)ai.curvol, ai.volpath);
+                goto catalog_load_end;
+            }
+        }
+        else if (memcmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)==0) // data are not needed
+        {
+            if (archreader_read_block(&ai, d, true, &sumok, &blkinfo)!=0)
+            {   errprintf("cannot skip a data block of the base archive\n");
+                goto catalog_load_end;
+            }
+        }
+        else if (memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0)
+        {
+            // only the files which are followed by their own data blocks can be referenced
+            free(pending);
+            pending=NULL;
+            if ((dico_get_u32(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_OBJTYPE, &objtype)==0) && (objtype==OBJTYPE_REGFILEUNIQUE))
+            {
+                if ((pending=calloc(1, sizeof(ccatalogentry)))==NULL)
+                {   errprintf("calloc(%ld) failed: out of memory\n", (long)sizeof(ccatalogentry));
+                    goto catalog_load_end;
+                }
+                pending->fsid=fsid;
+                pending->volume=ai.curvol;
+                pending->position=curpos;
+                if ((dico_get_string(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_PATH, relpath, sizeof(relpath))<0) ||
+                    (dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &pending->size)!=0) ||
+                    (dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MTIME, &pending->mtime)!=0) ||
+                    (pending->size==0))
+                {   free(pending);
+                    pending=NULL;
+                }
+                else if (dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_INODE, &pending->inode)!=0)
+                {   pending->inode=0; // archive created by a version which does not store the inode numbers
+                }
+            }
+        }
+        else if ((memcmp(magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0) && (pending!=NULL)) // the file is complete
+        {
+            if ((dico_get_data(d, 0, BLOCKFOOTITEMKEY_MD5SUM, pending->md5sum, 16, NULL)!=0) ||
+                ((pending->relpath=strdup(relpath))==NULL))
+            {   free(pending);
+            }
+            else
+            {   catalog_add(c, pending);
+            }
+            pending=NULL;
+        }
+        
+        dico_destroy(d);
+        d=NULL;
+    }
+    
+    msgprintf(MSG_VERB1, "%lld files found in the base archive %s\n", (long long)c->count, c->basepath);
+    ret=0;
+    
+catalog_load_end:
+    free(pending);
+    if (d!=NULL)
+        dico_destroy(d);
+    archreader_close(&ai);
+    return ret;
+}
@@ -0,0 +1,60 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include <limits.h>
+#include "types.h"
+
+struct s_catalog;
+typedef struct s_catalog ccatalog;
+
+struct s_catalogentry;
+typedef struct s_catalogentry ccatalogentry;
+
+#define CATALOG_MINBUCKETS  65536  // initial number of lists of files indexed by path (must be a power of two)
+
+struct s_catalog // regular files stored in a base archive, used to find the files which have not changed
+{   ccatalogentry **buckets; // files indexed by filesystem and path
+    u32          bucketcount; // number of buckets (power of two)
+    u64          count; // number of files in the catalog
+    u32          archid; // archive-id of the base archive
+    u32          archtype; // what has been saved in the base archive: filesystems or directories
+    char         basepath[PATH_MAX]; // path of the first volume of the base archive
+};
+
+struct s_catalogentry
+{   u16          fsid; // filesystem where the file is in the base archive
+    u64          size; // size of the file
+    u64          mtime; // last modification time of the file
+    u64          inode; // inode number of the file (0 if the base archive does not have it)
+    u32          volume; // volume of the base archive where the header of the file is
+    u64          position; // position of the header of the file in that volume
+    u8           md5sum[16]; // checksum of the contents of the file
+    u32          hash; // hash of the path
+    char         *relpath; // path of the file in the filesystem
+    ccatalogentry *next; // next file in the same bucket
+};
+
+ccatalog      *catalog_alloc();
+int           catalog_destroy(ccatalog *c);
+int           catalog_load(ccatalog *c, char *archive);
+ccatalogentry *catalog_find(ccatalog *c, u16 fsid, char *relpath);
+
+#endif // __CATALOG_H__
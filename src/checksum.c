@@ -0,0 +1,295 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define CHECKSUM_X86
+#  include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  define CHECKSUM_ARMCRC
+#  include <arm_acle.h>
+#endif
+
+#include "fsarchiver.h"
+#include "checksum.h"
+#include "common.h"
+#include "error.h"
+
+static u32 (*checksum_fletcher32_fct)(u8 *data, u32 len)=NULL;
+static u32 (*checksum_crc32c_fct)(u8 *data, u32 len)=NULL;
+static pthread_once_t checksum_once=PTHREAD_ONCE_INIT;
+static u32 crc32c_table[8][256];
+
+// reference version which reads one byte at a time
+u32 fletcher32_generic(u8 *data, u32 len)
+{
+    u32 sum1 = 0xffff, sum2 = 0xffff;
+    
+    while (len)
+    {
+        unsigned tlen = len > 360 ? 360 : len;
+        len -= tlen;
+        do {
+            sum1 += *data++;
+            sum2 += sum1;
+        } while (--tlen);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    // Second reduction step to reduce sums to 16 bits
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return sum2 << 16 | sum1;
+}
+
+#ifdef CHECKSUM_X86
+// sum1 is the sum of the bytes and sum2 the sum of the bytes weighted by their distance to the end of
+// the data: the results of fletcher32_generic() are the same sums modulo 65535 in the range [1, 65535]
+u32 fletcher32_finish(u8 *data, u32 len, u64 sum1, u64 sum2)
+{
+    u32 pos;
+    
+    for (pos=0; pos<len; pos++)
+    {   sum1+=data[pos];
+        sum2+=sum1;
+    }
+    sum1%=65535;
+    sum2%=65535;
+    return (u32)(((sum2==0)?(65535):(sum2))<<16 | ((sum1==0)?(65535):(sum1)));
+}
+
+__attribute__((target("sse2"))) u32 fletcher32_sse2(u8 *data, u32 len)
+{
+    const __m128i weightlo=_mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weighthi=_mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero=_mm_setzero_si128();
+    __m128i vs1, vs2, vps, v;
+    u32 tmp[4];
+    u32 blklen;
+    u32 pos;
+    u64 sum1=0;
+    u64 sum2=0;
+    
+    for (; len>=16; data+=blklen, len-=blklen)
+    {
+        blklen=min(len, CHECKSUM_FLETCHER_NMAX)&~15;
+        vs1=vs2=vps=zero;
+        for (pos=0; pos<blklen; pos+=16)
+        {
+            v=_mm_loadu_si128((const __m128i*)(data+pos));
+            vps=_mm_add_epi32(vps, vs1);
+            vs1=_mm_add_epi32(vs1, _mm_sad_epu8(v, zero));
+            vs2=_mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weightlo));
+            vs2=_mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weighthi));
+        }
+        sum2+=(u64)blklen*sum1;
+        _mm_storeu_si128((__m128i*)tmp, vs1);
+        sum1+=(u64)tmp[0]+tmp[1]+tmp[2]+tmp[3];
+        _mm_storeu_si128((__m128i*)tmp, vps);
+        sum2+=16*((u64)tmp[0]+tmp[1]+tmp[2]+tmp[3]);
+        _mm_storeu_si128((__m128i*)tmp, vs2);
+        sum2+=(u64)tmp[0]+tmp[1]+tmp[2]+tmp[3];
+        sum1%=65535;
+        sum2%=65535;
+    }
+    
+    return fletcher32_finish(data, len, sum1, sum2);
+}
+
+__attribute__((target("avx2"))) u32 fletcher32_avx2(u8 *data, u32 len)
+{
+    const __m256i weight=_mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones=_mm256_set1_epi16(1);
+    const __m256i zero=_mm256_setzero_si256();
+    __m256i vs1, vs2, vps, v;
+    u32 tmp[8];
+    u32 blklen;
+    u32 pos;
+    u64 sum1=0;
+    u64 sum2=0;
+    int i;
+    
+    for (; len>=32; data+=blklen, len-=blklen)
+    {
+        blklen=min(len, CHECKSUM_FLETCHER_NMAX)&~31;
+        vs1=vs2=vps=zero;
+        for (pos=0; pos<blklen; pos+=32)
+        {
+            v=_mm256_loadu_si256((const __m256i*)(data+pos));
+            vps=_mm256_add_epi32(vps, vs1);
+            vs1=_mm256_add_epi32(vs1, _mm256_sad_epu8(v, zero));
+            vs2=_mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weight), ones));
+        }
+        sum2+=(u64)blklen*sum1;
+        _mm256_storeu_si256((__m256i*)tmp, vs1);
+        for (i=0; i<8; i++)
+            sum1+=tmp[i];
+        _mm256_storeu_si256((__m256i*)tmp, vps);
+        for (i=0; i<8; i++)
+            sum2+=32*(u64)tmp[i];
+        _mm256_storeu_si256((__m256i*)tmp, vs2);
+        for (i=0; i<8; i++)
+            sum2+=tmp[i];
+        sum1%=65535;
+        sum2%=65535;
+    }
+    
+    return fletcher32_finish(data, len, sum1, sum2);
+}
+#endif // CHECKSUM_X86
+
+// crc32c (castagnoli polynomial) computed eight bytes at a time with tables
+u32 crc32c_generic(u8 *data, u32 len)
+{
+    u32 crc=0xFFFFFFFF;
+    u32 lo, hi;
+    
+    for (; len>=8; data+=8, len-=8)
+    {
+        lo=crc^((u32)data[0] | ((u32)data[1]<<8) | ((u32)data[2]<<16) | ((u32)data[3]<<24));
+        hi=((u32)data[4] | ((u32)data[5]<<8) | ((u32)data[6]<<16) | ((u32)data[7]<<24));
+        crc=crc32c_table[7][lo&0xFF] ^ crc32c_table[6][(lo>>8)&0xFF] ^ crc32c_table[5][(lo>>16)&0xFF] ^ crc32c_table[4][lo>>24] ^
+            crc32c_table[3][hi&0xFF] ^ crc32c_table[2][(hi>>8)&0xFF] ^ crc32c_table[1][(hi>>16)&0xFF] ^ crc32c_table[0][hi>>24];
+    }
+    for (; len>0; data++, len--)
+        crc=crc32c_table[0][(crc^*data)&0xFF] ^ (crc>>8);
+    
+    return crc^0xFFFFFFFF;
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse4.2"))) u32 crc32c_sse42(u8 *data, u32 len)
+{
+#ifdef __x86_64__
+    u64 crc=0xFFFFFFFF;
+    u64 word;
+    
+    for (; len>=8; data+=8, len-=8)
+    {   memcpy(&word, data, 8);
+        crc=_mm_crc32_u64(crc, word);
+    }
+#else
+    u32 crc=0xFFFFFFFF;
+    u32 word;
+    
+    for (; len>=4; data+=4, len-=4)
+    {   memcpy(&word, data, 4);
+        crc=_mm_crc32_u32(crc, word);
+    }
+#endif // __x86_64__
+    for (; len>0; data++, len--)
+        crc=_mm_crc32_u8((u32)crc, *data);
+    
+    return ((u32)crc)^0xFFFFFFFF;
+}
+#endif // CHECKSUM_X86
+
+#ifdef CHECKSUM_ARMCRC
+u32 crc32c_armv8(u8 *data, u32 len)
+{
+    u32 crc=0xFFFFFFFF;
+    u64 word;
+    
+    for (; len>=8; data+=8, len-=8)
+    {   memcpy(&word, data, 8);
+        crc=__crc32cd(crc, word);
+    }
+    for (; len>0; data++, len--)
+        crc=__crc32cb(crc, *data);
+    
+    return crc^0xFFFFFFFF;
+}
+#endif // CHECKSUM_ARMCRC
+
+// build the crc tables and choose the fastest versions supported by the cpu (it's only done once)
+void checksum_select()
+{
+    char *fletchername="generic";
+    char *crcname="generic";
+    u32 crc;
+    int i, j;
+    
+    for (i=0; i<256; i++)
+    {   for (crc=i, j=0; j<8; j++)
+            crc=(crc&1)?((crc>>1)^0x82F63B78):(crc>>1);
+        crc32c_table[0][i]=crc;
+    }
+    for (i=0; i<256; i++)
+        for (j=1; j<8; j++)
+            crc32c_table[j][i]=(crc32c_table[j-1][i]>>8) ^ crc32c_table[0][crc32c_table[j-1][i]&0xFF];
+    
+    checksum_fletcher32_fct=fletcher32_generic;
+    checksum_crc32c_fct=crc32c_generic;
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {   checksum_fletcher32_fct=fletcher32_avx2;
+        fletchername="avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {   checksum_fletcher32_fct=fletcher32_sse2;
+        fletchername="sse2";
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {   checksum_crc32c_fct=crc32c_sse42;
+        crcname="sse4.2";
+    }
+#endif // CHECKSUM_X86
+#ifdef CHECKSUM_ARMCRC
+    checksum_crc32c_fct=crc32c_armv8;
+    crcname="armv8";
+#endif // CHECKSUM_ARMCRC
+    msgprintf(MSG_DEBUG1, "checksums use the %s version of fletcher32 and the %s version of crc32c\n", fletchername, crcname);
+}
+
+u32 fletcher32(u8 *data, u32 len)
+{
+    pthread_once(&checksum_once, checksum_select);
+    return checksum_fletcher32_fct(data, len);
+}
+
+u32 crc32c(u8 *data, u32 len)
+{
+    pthread_once(&checksum_once, checksum_select);
+    return checksum_crc32c_fct(data, len);
+}
+
+// checksum of a data block as it is in the archive with the algorithm given in its header
+int checksum_block(u16 sumalgo, u8 *data, u32 len, u32 *sum)
+{
+    switch (sumalgo)
+    {
+        case SUMALGO_FLETCHER32:
+            *sum=fletcher32(data, len);
+            return 0;
+        case SUMALGO_CRC32C:
+            *sum=crc32c(data, len);
+            return 0;
+        default:
+            errprintf("unknown checksum algorithm: %d\n", (int)sumalgo);
+            return -1;
+    }
+}
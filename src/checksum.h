@@ -0,0 +1,33 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include "types.h"
+
+#define CHECKSUM_FLETCHER_NMAX  5536   // bytes summed before the reduction modulo 65535 (the sums must fit in 32bit)
+
+void checksum_select();
+u32  fletcher32_generic(u8 *data, u32 len);
+u32  fletcher32(u8 *data, u32 len);
+u32  crc32c_generic(u8 *data, u32 len);
+u32  crc32c(u8 *data, u32 len);
+int  checksum_block(u16 sumalgo, u8 *data, u32 len, u32 *sum);
+
+#endif // __CHECKSUM_H__
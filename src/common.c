@@ -21,6 +21,7 @@
 
 #include <stdarg.h>
 #include <errno.h>
+#include <ctype.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -102,6 +103,45 @@ char *format_size(u64 size, char *text, int max, char units)
     return text;
 }
 
+// convert a size such as "524288", "512K", "512M" or "2G" to bytes (returns 0 if it is invalid)
+u64 parse_size(char *text)
+{
+    char *end;
+    u64 size;
+    
+    // strtoull() accepts a minus sign and negates the value: negative sizes are rejected
+    while (isspace((unsigned char)*text))
+        text++;
+    if (*text=='-')
+        return 0;
+    
+    errno=0;
+    size=(u64)strtoull(text, &end, 10);
+    if (errno!=0 || end==text) // ERANGE when the number does not fit in 64 bits
+        return 0;
+    
+    // the size is invalid if a multiplication overflows
+    switch (*end)
+    {
+        case 'g': case 'G':
+            if (size>UINT64_MAX/1024LL)
+                return 0;
+            size*=1024LL; // fall through
+        case 'm': case 'M':
+            if (size>UINT64_MAX/1024LL)
+                return 0;
+            size*=1024LL; // fall through
+        case 'k': case 'K':
+            if (size>UINT64_MAX/1024LL)
+                return 0;
+            size*=1024LL;
+            end++;
+            break;
+    }
+    
+    return (*end==0) ? size : 0;
+}
+
 int mkdir_recursive(char *path)
 {
     char buffer[PATH_MAX];
@@ -164,6 +204,10 @@ char *get_objtype_name(int objtype)
             return ("REGFILEM");
         case OBJTYPE_HARDLINK:
             return ("HARDLINK");
+        case OBJTYPE_DUPFILE:
+            return ("DUPFILE ");
+        case OBJTYPE_UNCHANGED:
+            return ("UNCHANGD");
         case OBJTYPE_CHARDEV:
             return ("CHARDEV ");
         case OBJTYPE_BLOCKDEV:
@@ -223,27 +267,6 @@ u32 generate_random_u32_id(void)
     return archid;
 }
 
-u32 fletcher32(u8 *data, u32 len)
-{
-    u32 sum1 = 0xffff, sum2 = 0xffff;
-    
-    while (len)
-    {
-        unsigned tlen = len > 360 ? 360 : len;
-        len -= tlen;
-        do {
-            sum1 += *data++;
-            sum2 += sum1;
-        } while (--tlen);
-        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    }
-    // Second reduction step to reduce sums to 16 bits
-    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    return sum2 << 16 | sum1;
-}
-
 int regfile_exists(char *filepath)
 {
     struct stat64 st;
@@ -537,6 +560,8 @@ int get_parent_dir_time_attrib(char *filepath, char *parentdirbuf, int bufsize,
 
 int stats_show(cstats stats, int fsid)
 {
+    char buffer[256];
+    
     msgprintf(MSG_FORCE, "Statistics for filesystem %d\n", fsid);
     msgprintf(MSG_FORCE, "* files successfully processed:....regfiles=%lld, directories=%lld, "
         "symlinks=%lld, hardlinks=%lld, specials=%lld\n", 
@@ -546,6 +571,12 @@ int stats_show(cstats stats, int fsid)
         "symlinks=%lld, hardlinks=%lld, specials=%lld\n", 
         (long long)stats.err_regfile, (long long)stats.err_dir, (long long)stats.err_symlink, 
         (long long)stats.err_hardlink, (long long)stats.err_special);
+    if (stats.cnt_dupfile>0)
+        msgprintf(MSG_FORCE, "* identical files stored once:.....dupfiles=%lld, size=%s\n",
+            (long long)stats.cnt_dupfile, format_size(stats.dupfilebytes, buffer, sizeof(buffer), 'h'));
+    if (stats.cnt_unchanged>0)
+        msgprintf(MSG_FORCE, "* files unchanged since the base:..unchanged=%lld, size=%s\n",
+            (long long)stats.cnt_unchanged, format_size(stats.unchangedbytes, buffer, sizeof(buffer), 'h'));
     return 0;
 }
 
@@ -29,6 +29,7 @@ int get_parent_dir_time_attrib(char *filepath, char *parentdirbuf, int bufsize,
 void concatenate_paths(char *buffer, int maxbufsize, char *p1, char *p2);
 int path_force_extension(char *buf, int bufsize, char *origpath, char *ext);
 char *format_size(u64 size, char *text, int max, char units);
+u64 parse_size(char *text);
 int image_write_data(int fdarch, char *buffer, int buflen);
 int extract_dirpath(char *filepath, char *dirbuf, int dirbufsize);
 int extract_basename(char *filepath, char *basenamebuf, int basenamebufsize);
@@ -41,7 +42,6 @@ int mkdir_recursive(char *path);
 char *get_objtype_name(int objtype);
 int is_dir_empty(char *path);
 u32 generate_random_u32_id(void);
-u32 fletcher32(u8 *data, u32 len);
 int regfile_exists(char *filepath);
 int is_magic_valid(char *magic);
 char *strlcatf(char *dest, int destbufsize, char *format, ...) __attribute__ ((format (printf, 3, 4)));
@@ -20,23 +20,31 @@
 #endif
 
 #include <bzlib.h>
+#include <string.h>
 
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_bzip2.h"
+#include "compctx.h"
 #include "error.h"
 
-int compress_block_bzip2(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int compress_block_bzip2(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
-    unsigned int destsize=compbufsize;
+    bz_stream bz;
+    int res;
+    
+    // libbz2 cannot reset a stream: the memory of the previous stream is given back by compctx_bzalloc()
+    memset(&bz, 0, sizeof(bz));
+    bz.bzalloc=compctx_bzalloc;
+    bz.bzfree=compctx_bzfree;
+    bz.opaque=ctx;
     
-    switch (BZ2_bzBuffToBuffCompress((char*)compbuf, &destsize, (char*)origbuf, origsize, 9, 0, 30))
+    switch ((res=BZ2_bzCompressInit(&bz, 9, 0, 30)))
     {
         case BZ_OK:
-            *compsize=(u64)destsize;
-            return FSAERR_SUCCESS;
+            break;
         case BZ_MEM_ERROR:
-            errprintf("BZ2_bzBuffToBuffCompress(): BZIP2 compression failed "
+            errprintf("BZ2_bzCompressInit(): BZIP2 compression failed "
                 "with an out of memory error.\nYou should use a lower "
                 "compression level to reduce the memory requirement.\n");
             return FSAERR_ENOMEM;
@@ -44,21 +52,56 @@ int compress_block_bzip2(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf,
             return FSAERR_UNKNOWN;
     }
     
+    bz.next_in=(char*)origbuf;
+    bz.avail_in=(unsigned int)origsize;
+    bz.next_out=(char*)compbuf;
+    bz.avail_out=(unsigned int)compbufsize;
+    
+    res=BZ2_bzCompress(&bz, BZ_FINISH);
+    BZ2_bzCompressEnd(&bz);
+    
+    switch (res)
+    {
+        case BZ_STREAM_END:
+            *compsize=(u64)bz.total_out_lo32;
+            return FSAERR_SUCCESS;
+        default: // BZ_FINISH_OK if compbuf is too small
+            return FSAERR_UNKNOWN;
+    }
+    
     return FSAERR_UNKNOWN;
 }
 
-int uncompress_block_bzip2(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_bzip2(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
 {
-    unsigned int destsize=origbufsize;
+    bz_stream bz;
     int res;
     
-    switch ((res=BZ2_bzBuffToBuffDecompress((char*)origbuf, &destsize, (char*)compbuf, compsize, 0, 0)))
+    memset(&bz, 0, sizeof(bz));
+    bz.bzalloc=compctx_bzalloc;
+    bz.bzfree=compctx_bzfree;
+    bz.opaque=ctx;
+    
+    if ((res=BZ2_bzDecompressInit(&bz, 0, 0))!=BZ_OK)
+    {   errprintf("BZ2_bzDecompressInit() failed, res=%d\n", res);
+        return (res==BZ_MEM_ERROR) ? FSAERR_ENOMEM : FSAERR_UNKNOWN;
+    }
+    
+    bz.next_in=(char*)compbuf;
+    bz.avail_in=(unsigned int)compsize;
+    bz.next_out=(char*)origbuf;
+    bz.avail_out=(unsigned int)origbufsize;
+    
+    res=BZ2_bzDecompress(&bz);
+    BZ2_bzDecompressEnd(&bz);
+    
+    switch (res)
     {
-        case BZ_OK:
-            *origsize=(u64)destsize;
+        case BZ_STREAM_END:
+            *origsize=(u64)bz.total_out_lo32;
             return FSAERR_SUCCESS;
         default:
-            errprintf("BZ2_bzBuffToBuffDecompress() failed, res=%d\n", res);
+            errprintf("BZ2_bzDecompress() failed, res=%d\n", res);
             return FSAERR_UNKNOWN;
     }
     
@@ -20,49 +20,95 @@
 #endif
 
 #include <zlib.h>
+#include <string.h>
 
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_gzip.h"
+#include "compctx.h"
 #include "error.h"
 
-int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int compress_block_gzip(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
-    uLong gzsize;
-    Bytef *gzbuffer;
+    z_stream *gz=&ctx->gzenc;
+    int res;
+    
+    // the stream is initialized once and reset for the next blocks which use the same level
+    if (ctx->gzenclevel!=level)
+    {
+        if (ctx->gzenclevel>=0)
+            deflateEnd(gz);
+        ctx->gzenclevel=-1;
+        memset(gz, 0, sizeof(z_stream));
+        switch ((res=deflateInit(gz, level)))
+        {
+            case Z_OK:
+                ctx->gzenclevel=level;
+                break;
+            case Z_MEM_ERROR:
+                return FSAERR_ENOMEM;
+            default:
+                errprintf("deflateInit(%d) failed, res=%d\n", level, res);
+                return FSAERR_UNKNOWN;
+        }
+    }
+    else if ((res=deflateReset(gz))!=Z_OK)
+    {   errprintf("deflateReset() failed, res=%d\n", res);
+        return FSAERR_UNKNOWN;
+    }
     
-    gzsize=(uLong)compbufsize;
-    gzbuffer=(Bytef *)compbuf;
+    gz->next_in=(Bytef *)origbuf;
+    gz->avail_in=(uInt)origsize;
+    gz->next_out=(Bytef *)compbuf;
+    gz->avail_out=(uInt)compbufsize;
     
-    switch (compress2(gzbuffer, &gzsize, (const Bytef*)origbuf, (uLong)origsize, level))
+    switch ((res=deflate(gz, Z_FINISH)))
     {
-        case Z_OK:
-            *compsize=(u64)gzsize;
+        case Z_STREAM_END:
+            *compsize=(u64)gz->total_out;
             return FSAERR_SUCCESS;
         case Z_MEM_ERROR:
             return FSAERR_ENOMEM;
-        default:
+        default: // Z_OK or Z_BUF_ERROR if compbuf is too small
             return FSAERR_UNKNOWN;
     }
     
     return FSAERR_UNKNOWN;
 }
 
-int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_gzip(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
 {
-    uLong gzsize=(uLong)origbufsize;
-    Bytef *gzbuffer=(Bytef *)origbuf;
+    z_stream *gz=&ctx->gzdec;
     int res;
     
-    switch ((res=uncompress(gzbuffer, &gzsize, (const Bytef*)compbuf, (uLong)compsize)))
+    if (ctx->gzdecinit==false)
+    {
+        memset(gz, 0, sizeof(z_stream));
+        if ((res=inflateInit(gz))!=Z_OK)
+        {   errprintf("inflateInit() failed, res=%d\n", res);
+            return (res==Z_MEM_ERROR) ? FSAERR_ENOMEM : FSAERR_UNKNOWN;
+        }
+        ctx->gzdecinit=true;
+    }
+    else if ((res=inflateReset(gz))!=Z_OK)
+    {   errprintf("inflateReset() failed, res=%d\n", res);
+        return FSAERR_UNKNOWN;
+    }
+    
+    gz->next_in=(Bytef *)compbuf;
+    gz->avail_in=(uInt)compsize;
+    gz->next_out=(Bytef *)origbuf;
+    gz->avail_out=(uInt)origbufsize;
+    
+    switch ((res=inflate(gz, Z_FINISH)))
     {
-        case Z_OK:
-            *origsize=(u64)gzsize;
+        case Z_STREAM_END:
+            *origsize=(u64)gz->total_out;
             return FSAERR_SUCCESS;
         case Z_MEM_ERROR:
             return FSAERR_ENOMEM;
         default:
-            errprintf("uncompress() failed, res=%d\n", res);
+            errprintf("inflate() failed, res=%d\n", res);
             return FSAERR_UNKNOWN;
     }
 }
@@ -18,7 +18,9 @@
 #ifndef __COMPRESS_GZIP_H__
 #define __COMPRESS_GZIP_H__
 
-int compress_block_gzip(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_gzip(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+struct s_compctx;
+
+int compress_block_gzip(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_gzip(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
 
 #endif // __COMPRESS_GZIP_H__
@@ -20,23 +20,31 @@
 #  include "config.h"
 #endif
 
+#include <stdlib.h>
+
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_lz4.h"
+#include "compctx.h"
 #include "error.h"
 
 
 #ifdef OPTION_LZ4_SUPPORT
-int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int compress_block_lz4(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
     int destsize=compbufsize;
     int res;
 
 #define LZ4_VERSION (LZ4_VERSION_MAJOR*10 + LZ4_VERSION_MINOR)
 #if LZ4_VERSION >= 17
-    res=LZ4_compress_default((const char*)origbuf, (char*)compbuf, (int)origsize, destsize);
+    // the state is allocated once per thread instead of being prepared on the stack for each block
+    if ((ctx->lz4state==NULL) && ((ctx->lz4state=malloc(LZ4_sizeofState()))==NULL))
+    {   errprintf("malloc(%d) failed: cannot allocate memory for the lz4 state\n", (int)LZ4_sizeofState());
+        return FSAERR_ENOMEM;
+    }
+    res=LZ4_compress_fast_extState(ctx->lz4state, (const char*)origbuf, (char*)compbuf, (int)origsize, destsize, 1);
     if (res==0){
-        errprintf("LZ4_compress_default(): failed.\n");
+        errprintf("LZ4_compress_fast_extState(): failed.\n");
         return FSAERR_UNKNOWN;
     }
 #else
@@ -54,7 +62,7 @@ int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u6
     return FSAERR_UNKNOWN;
 }
 
-int uncompress_block_lz4(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_lz4(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
 {
     int destsize=origbufsize;
     int res;
@@ -19,12 +19,14 @@
 #ifndef __COMPRESS_LZ4_H__
 #define __COMPRESS_LZ4_H__
 
+struct s_compctx;
+
 #ifdef OPTION_LZ4_SUPPORT
 
 #include <lz4.h>
 
-int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_lz4(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+int compress_block_lz4(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_lz4(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
 
 #endif // OPTION_LZ4_SUPPORT
 
@@ -18,10 +18,12 @@
 #ifndef __COMPRESS_LZMA_H__
 #define __COMPRESS_LZMA_H__
 
+struct s_compctx;
+
 #ifdef OPTION_LZMA_SUPPORT
 
-int compress_block_lzma(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_lzma(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+int compress_block_lzma(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_lzma(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
 
 #endif // OPTION_LZMA_SUPPORT
 
@@ -19,18 +19,26 @@
 #  include "config.h"
 #endif
 
+#include <stdlib.h>
+
 #include "fsarchiver.h"
 #include "comp_lzo.h"
+#include "compctx.h"
 #include "error.h"
 
 #ifdef OPTION_LZO_SUPPORT
 
-int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int compress_block_lzo(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
     lzo_uint destsize=(lzo_uint)compbufsize;
-    char workmem[LZO1X_1_MEM_COMPRESS];
     
-    switch (lzo1x_1_compress((lzo_bytep)origbuf, (lzo_uint)origsize, (lzo_bytep)compbuf, (lzo_uintp)&destsize, (lzo_voidp)workmem))
+    // the work memory is allocated once per thread
+    if ((ctx->lzowrkmem==NULL) && ((ctx->lzowrkmem=malloc(LZO1X_1_MEM_COMPRESS))==NULL))
+    {   errprintf("malloc(%d) failed: cannot allocate memory for lzo\n", (int)LZO1X_1_MEM_COMPRESS);
+        return FSAERR_ENOMEM;
+    }
+    
+    switch (lzo1x_1_compress((lzo_bytep)origbuf, (lzo_uint)origsize, (lzo_bytep)compbuf, (lzo_uintp)&destsize, (lzo_voidp)ctx->lzowrkmem))
     {
         case LZO_E_OK:
             *compsize=(u64)destsize;
@@ -44,7 +52,7 @@ int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u6
     return FSAERR_UNKNOWN; 
 }
 
-int uncompress_block_lzo(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+int uncompress_block_lzo(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
 {
     lzo_uint new_len=origbufsize;
     int res;
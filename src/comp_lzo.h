@@ -22,8 +22,10 @@
 
 #include <lzo/lzo1x.h>
 
-int compress_block_lzo(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_lzo(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+struct s_compctx;
+
+int compress_block_lzo(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_lzo(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
 
 #endif // OPTION_LZO_SUPPORT
 
@@ -23,16 +23,24 @@
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_zstd.h"
+#include "compctx.h"
+#include "zstddict.h"
 #include "error.h"
 
 
 #ifdef OPTION_ZSTD_SUPPORT
-int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+int compress_block_zstd(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
     int res=0;
 
-    if (ZSTD_isError((res=ZSTD_compress((char*)compbuf, compbufsize, (const char*)origbuf, (int)origsize, level))))
-    {   errprintf("ZSTD_compress(): failed: res=%d\n", res);
+    // the context is created once per thread and its tables are reused for each block
+    if ((ctx->zstdcctx==NULL) && ((ctx->zstdcctx=ZSTD_createCCtx())==NULL))
+    {   errprintf("ZSTD_createCCtx(): failed\n");
+        return FSAERR_ENOMEM;
+    }
+
+    if (ZSTD_isError((res=ZSTD_compressCCtx(ctx->zstdcctx, (char*)compbuf, compbufsize, (const char*)origbuf, (int)origsize, level))))
+    {   errprintf("ZSTD_compressCCtx(): failed: res=%d\n", res);
         return FSAERR_UNKNOWN;
     }
     else
@@ -41,12 +49,54 @@ int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u
     }
 }
 
-int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+// compress a block of the long mode: the window covers the whole block and long distance matching is enabled
+// the block is split into jobs compressed by several threads of libzstd when workers>1
+int compress_block_zstd_long(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, int workers)
+{
+    ZSTD_bounds bounds;
+    size_t res=0;
+    int windowlog;
+
+    if ((ctx->zstdcctx==NULL) && ((ctx->zstdcctx=ZSTD_createCCtx())==NULL))
+    {   errprintf("ZSTD_createCCtx(): failed\n");
+        return FSAERR_ENOMEM;
+    }
+
+    // ZSTD_WINDOWLOG_MAX is only defined with ZSTD_STATIC_LINKING_ONLY: ask libzstd for the limit
+    bounds=ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+    for (windowlog=20; (windowlog<bounds.upperBound) && ((1ULL<<windowlog)<origsize); windowlog++);
+
+    ZSTD_CCtx_reset(ctx->zstdcctx, ZSTD_reset_session_and_parameters);
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(ctx->zstdcctx, ZSTD_c_compressionLevel, level)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(ctx->zstdcctx, ZSTD_c_enableLongDistanceMatching, 1)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(ctx->zstdcctx, ZSTD_c_windowLog, windowlog)))
+    {   errprintf("ZSTD_CCtx_setParameter(): failed\n");
+        return FSAERR_UNKNOWN;
+    }
+
+    // it fails when libzstd has been built without multithreading support: the block is compressed by this thread
+    if ((workers>1) && !ZSTD_isError(ZSTD_CCtx_setParameter(ctx->zstdcctx, ZSTD_c_nbWorkers, workers)))
+        ZSTD_CCtx_setParameter(ctx->zstdcctx, ZSTD_c_jobSize, (int)(origsize/workers));
+
+    if (ZSTD_isError((res=ZSTD_compress2(ctx->zstdcctx, (char*)compbuf, compbufsize, (const char*)origbuf, origsize))))
+    {   errprintf("ZSTD_compress2(): failed: res=%s\n", ZSTD_getErrorName(res));
+        return FSAERR_UNKNOWN;
+    }
+    *compsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_zstd(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
 {
     int res=0;
 
-    if (ZSTD_isError((res=ZSTD_decompress((char*)origbuf, origbufsize, (char*)compbuf, compsize))))
-    {   errprintf("ZSTD_decompress(): failed: res=%d\n", res);
+    if ((ctx->zstddctx==NULL) && ((ctx->zstddctx=ZSTD_createDCtx())==NULL))
+    {   errprintf("ZSTD_createDCtx(): failed\n");
+        return FSAERR_ENOMEM;
+    }
+
+    if (ZSTD_isError((res=ZSTD_decompressDCtx(ctx->zstddctx, (char*)origbuf, origbufsize, (char*)compbuf, compsize))))
+    {   errprintf("ZSTD_decompressDCtx(): failed: res=%d\n", res);
         return FSAERR_UNKNOWN;
     }
     else
@@ -54,4 +104,51 @@ int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufs
         return FSAERR_SUCCESS;
     }
 }
+
+// compress a block of small files with the dictionary of its filesystem
+int compress_block_zstd_dict(ccompctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, czstddict *dict)
+{
+    ZSTD_CDict *cdict;
+    size_t res=0;
+
+    if ((ctx->zstdcctx==NULL) && ((ctx->zstdcctx=ZSTD_createCCtx())==NULL))
+    {   errprintf("ZSTD_createCCtx(): failed\n");
+        return FSAERR_ENOMEM;
+    }
+
+    // the digested dictionary is created once for each level, the raw dictionary is only used when it cannot be
+    if ((cdict=zstddict_get_cdict(dict, level))!=NULL)
+    {
+        if (ZSTD_isError((res=ZSTD_compress_usingCDict(ctx->zstdcctx, (char*)compbuf, compbufsize, (const char*)origbuf, origsize, cdict))))
+        {   errprintf("ZSTD_compress_usingCDict(): failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    }
+    else
+    {
+        if (ZSTD_isError((res=ZSTD_compress_usingDict(ctx->zstdcctx, (char*)compbuf, compbufsize, (const char*)origbuf, origsize, dict->data, dict->size, level))))
+        {   errprintf("ZSTD_compress_usingDict(): failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    }
+    *compsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_zstd_dict(ccompctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, czstddict *dict)
+{
+    size_t res=0;
+
+    if ((ctx->zstddctx==NULL) && ((ctx->zstddctx=ZSTD_createDCtx())==NULL))
+    {   errprintf("ZSTD_createDCtx(): failed\n");
+        return FSAERR_ENOMEM;
+    }
+
+    if (ZSTD_isError((res=ZSTD_decompress_usingDDict(ctx->zstddctx, (char*)origbuf, origbufsize, (char*)compbuf, compsize, dict->ddict))))
+    {   errprintf("ZSTD_decompress_usingDDict(): failed: res=%s\n", ZSTD_getErrorName(res));
+        return FSAERR_UNKNOWN;
+    }
+    *origsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
 #endif // OPTION_ZSTD_SUPPORT
@@ -19,12 +19,18 @@
 #ifndef __COMPRESS_ZSTD_H__
 #define __COMPRESS_ZSTD_H__
 
+struct s_compctx;
+struct s_zstddict;
+
 #ifdef OPTION_ZSTD_SUPPORT
 
 #include <zstd.h>
 
-int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
-int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+int compress_block_zstd(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_zstd(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+int compress_block_zstd_long(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, int workers);
+int compress_block_zstd_dict(struct s_compctx *ctx, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level, struct s_zstddict *dict);
+int uncompress_block_zstd_dict(struct s_compctx *ctx, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf, struct s_zstddict *dict);
 
 #endif // OPTION_ZSTD_SUPPORT
 
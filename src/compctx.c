@@ -0,0 +1,132 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "compctx.h"
+#include "error.h"
+
+int compctx_init(ccompctx *ctx)
+{
+    assert(ctx);
+    memset(ctx, 0, sizeof(struct s_compctx));
+    ctx->gzenclevel=-1;
+    ctx->gzdecinit=false;
+#ifdef OPTION_LZMA_SUPPORT
+    lzma_stream lzmainit=LZMA_STREAM_INIT;
+    ctx->lzmaenc=lzmainit;
+    ctx->lzmadec=lzmainit;
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    ctx->lzowrkmem=NULL;
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    ctx->lz4state=NULL;
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    ctx->zstdcctx=NULL;
+    ctx->zstddctx=NULL;
+#endif // OPTION_ZSTD_SUPPORT
+    return 0;
+}
+
+int compctx_destroy(ccompctx *ctx)
+{
+    int i;
+    
+    assert(ctx);
+    
+    if (ctx->gzenclevel>=0)
+        deflateEnd(&ctx->gzenc);
+    ctx->gzenclevel=-1;
+    if (ctx->gzdecinit==true)
+        inflateEnd(&ctx->gzdec);
+    ctx->gzdecinit=false;
+    for (i=0; i < COMPCTX_MAX_BZBUFS; i++)
+    {   free(ctx->bzbufs[i].data);
+        memset(&ctx->bzbufs[i], 0, sizeof(struct s_bzbuf));
+    }
+#ifdef OPTION_LZMA_SUPPORT
+    lzma_end(&ctx->lzmaenc);
+    lzma_end(&ctx->lzmadec);
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    free(ctx->lzowrkmem);
+    ctx->lzowrkmem=NULL;
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    free(ctx->lz4state);
+    ctx->lz4state=NULL;
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    ZSTD_freeCCtx(ctx->zstdcctx);
+    ZSTD_freeDCtx(ctx->zstddctx);
+    ctx->zstdcctx=NULL;
+    ctx->zstddctx=NULL;
+#endif // OPTION_ZSTD_SUPPORT
+    return 0;
+}
+
+// allocator for libbz2: the memory of a stream is kept when it ends and given to the next stream
+void *compctx_bzalloc(void *opaque, int items, int size)
+{
+    ccompctx *ctx=(ccompctx *)opaque;
+    int bytes=items*size;
+    int i;
+    
+    for (i=0; i < COMPCTX_MAX_BZBUFS; i++)
+    {   if ((ctx->bzbufs[i].data!=NULL) && (ctx->bzbufs[i].inuse==false) && (ctx->bzbufs[i].size==bytes))
+        {   ctx->bzbufs[i].inuse=true;
+            return ctx->bzbufs[i].data;
+        }
+    }
+    
+    for (i=0; i < COMPCTX_MAX_BZBUFS; i++)
+    {   if (ctx->bzbufs[i].inuse==false)
+        {   free(ctx->bzbufs[i].data);
+            if ((ctx->bzbufs[i].data=malloc(bytes))==NULL)
+                return NULL;
+            ctx->bzbufs[i].size=bytes;
+            ctx->bzbufs[i].inuse=true;
+            return ctx->bzbufs[i].data;
+        }
+    }
+    
+    return malloc(bytes); // all slots used: this memory is not recycled
+}
+
+void compctx_bzfree(void *opaque, void *addr)
+{
+    ccompctx *ctx=(ccompctx *)opaque;
+    int i;
+    
+    for (i=0; i < COMPCTX_MAX_BZBUFS; i++)
+    {   if (ctx->bzbufs[i].data==addr)
+        {   ctx->bzbufs[i].inuse=false;
+            return;
+        }
+    }
+    
+    free(addr);
+}
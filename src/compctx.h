@@ -0,0 +1,71 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPCTX_H__
+#define __COMPCTX_H__
+
+#include <zlib.h>
+
+#ifdef OPTION_LZMA_SUPPORT
+#include <lzma.h>
+#endif // OPTION_LZMA_SUPPORT
+
+#ifdef OPTION_ZSTD_SUPPORT
+#include <zstd.h>
+#endif // OPTION_ZSTD_SUPPORT
+
+#define COMPCTX_MAX_BZBUFS 8
+
+struct s_compctx;
+typedef struct s_compctx ccompctx;
+
+struct s_bzbuf
+{   void  *data; // memory allocated by libbz2 and kept for the next stream
+    int   size; // size requested by libbz2 for that memory
+    bool  inuse; // true when owned by a bzip2 stream which is still open
+};
+
+// each compression thread owns a context so that the libraries do not have to allocate
+// and initialize their internal state again for each block: it is reset between blocks
+struct s_compctx
+{   z_stream gzenc; // zlib compression stream
+    int      gzenclevel; // level used to initialize gzenc, or -1 when it is not initialized
+    z_stream gzdec; // zlib decompression stream
+    bool     gzdecinit; // true when gzdec is initialized
+    struct s_bzbuf bzbufs[COMPCTX_MAX_BZBUFS]; // libbz2 has no reset function: recycle its memory instead
+#ifdef OPTION_LZMA_SUPPORT
+    lzma_stream lzmaenc; // liblzma reuses the memory of a stream which is initialized again
+    lzma_stream lzmadec;
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    void     *lzowrkmem; // work memory of lzo1x_1_compress()
+#endif // OPTION_LZO_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    void     *lz4state; // state passed to LZ4_compress_fast_extState()
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    ZSTD_CCtx *zstdcctx;
+    ZSTD_DCtx *zstddctx;
+#endif // OPTION_ZSTD_SUPPORT
+};
+
+int compctx_init(ccompctx *ctx);
+int compctx_destroy(ccompctx *ctx);
+void *compctx_bzalloc(void *opaque, int items, int size);
+void compctx_bzfree(void *opaque, void *addr);
+
+#endif // __COMPCTX_H__
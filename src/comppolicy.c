@@ -0,0 +1,294 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <ctype.h>
+
+#include "fsarchiver.h"
+#include "comppolicy.h"
+#include "common.h"
+#include "error.h"
+
+// The policy file contains one rule per line and the first rule which matches a
+// file selects the algorithm used to compress its data blocks. Files which don't
+// match any rule are compressed with the algorithm chosen on the command line.
+//
+// [patterns] [magic=<hex>] [size>N] [size<N] -> <none|lzo|gzip|bzip2|lzma|lz4|zstd> [level]
+//
+// # already compressed contents are stored as they are
+// *.zst,*.gz,*.xz,*.jpg,*.mp4 -> none
+// magic=1f8b -> none
+// *.log,*.txt -> zstd 19
+// *.qcow2,*.vmdk,*.vdi size>64M -> lz4
+
+struct s_compalgoname
+{   char   *name; // name of the algorithm in the policy file
+    u16    algo; // compression algorithm
+    int    minlevel; // minimum compression level
+    int    maxlevel; // maximum compression level
+    int    deflevel; // level used when the rule does not specify one
+};
+
+struct s_compalgoname comppolicy_algos[]=
+{
+    {"none",   COMPRESS_NONE,  0, 0, 0},
+#ifdef OPTION_LZO_SUPPORT
+    {"lzo",    COMPRESS_LZO,   1, 9, 3},
+#endif // OPTION_LZO_SUPPORT
+    {"gzip",   COMPRESS_GZIP,  1, 9, 6},
+    {"bzip2",  COMPRESS_BZIP2, 1, 9, 5},
+#ifdef OPTION_LZMA_SUPPORT
+    {"lzma",   COMPRESS_LZMA,  0, 9, 6},
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    {"lz4",    COMPRESS_LZ4,   0, 0, 0},
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    {"zstd",   COMPRESS_ZSTD,  1, 22, FSA_DEF_COMPRESS_LEVEL},
+#endif // OPTION_ZSTD_SUPPORT
+    {NULL,     COMPRESS_NULL,  0, 0, 0},
+};
+
+int comppolicy_init(ccomppolicy *p)
+{
+    if (!p)
+    {   errprintf("p is NULL\n");
+        return -1;
+    }
+    
+    memset(p, 0, sizeof(ccomppolicy));
+    return 0;
+}
+
+int comppolicy_destroy(ccomppolicy *p)
+{
+    if (!p)
+    {   errprintf("p is NULL\n");
+        return -1;
+    }
+    
+    free(p->rules);
+    memset(p, 0, sizeof(ccomppolicy));
+    return 0;
+}
+
+int comppolicy_parse_magic(ccomprule *rule, char *hex)
+{
+    unsigned int byte;
+    int len;
+    
+    len=strlen(hex);
+    if ((len==0) || (len%2!=0) || (len/2>COMPPOLICY_MAXMAGIC))
+        return -1;
+    for (rule->magiclen=0; rule->magiclen<len/2; rule->magiclen++)
+    {
+        if ((!isxdigit(hex[rule->magiclen*2])) || (!isxdigit(hex[rule->magiclen*2+1])) ||
+            (sscanf(hex+rule->magiclen*2, "%2x", &byte)!=1))
+            return -1;
+        rule->magic[rule->magiclen]=(u8)byte;
+    }
+    return 0;
+}
+
+int comppolicy_parse_rule(ccomprule *rule, char *conditions, char *action)
+{
+    struct s_compalgoname *algo;
+    char *saveptr=NULL;
+    char *level;
+    char *token;
+    char *name;
+    
+    // conditions which must match the file
+    for (token=strtok_r(conditions, " \t", &saveptr); token!=NULL; token=strtok_r(NULL, " \t", &saveptr))
+    {
+        if (strncmp(token, "magic=", 6)==0)
+        {
+            if (comppolicy_parse_magic(rule, token+6)!=0)
+            {   errprintf("invalid magic [%s]: it must be up to %d bytes in hexadecimal\n", token+6, COMPPOLICY_MAXMAGIC);
+                return -1;
+            }
+        }
+        else if ((strncmp(token, "size>", 5)==0) || (strncmp(token, "size<", 5)==0))
+        {
+            u64 size=parse_size(token+5);
+            if (size==0)
+            {   errprintf("invalid size [%s]: it must be a size such as 512K or 100M\n", token+5);
+                return -1;
+            }
+            if (token[4]=='>')
+                rule->minsize=size;
+            else
+                rule->maxsize=size;
+        }
+        else if (rule->patterns[0]==0)
+        {
+            snprintf(rule->patterns, sizeof(rule->patterns), "%s", token);
+        }
+        else
+        {   errprintf("unexpected condition [%s]: patterns must be separated with commas\n", token);
+            return -1;
+        }
+    }
+    
+    // algorithm and level to use for the files which match
+    saveptr=NULL;
+    name=strtok_r(action, " \t", &saveptr);
+    level=strtok_r(NULL, " \t", &saveptr);
+    if ((name==NULL) || (strtok_r(NULL, " \t", &saveptr)!=NULL))
+    {   errprintf("the action must be an algorithm followed by an optional level\n");
+        return -1;
+    }
+    for (algo=comppolicy_algos; (algo->name!=NULL) && (strcmp(algo->name, name)!=0); algo++);
+    if (algo->name==NULL)
+    {   errprintf("compression algorithm [%s] is not supported by this version of fsarchiver\n", name);
+        return -1;
+    }
+    rule->compalgo=algo->algo;
+    rule->complevel=algo->deflevel;
+    if (level!=NULL)
+    {
+        rule->complevel=atoi(level);
+        if ((rule->complevel<algo->minlevel) || (rule->complevel>algo->maxlevel))
+        {   errprintf("[%s] is not a valid level for %s, it must be between %d and %d\n", level, name, algo->minlevel, algo->maxlevel);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+int comppolicy_load(ccomppolicy *p, char *path)
+{
+    char line[COMPPOLICY_MAXPATTERN+256];
+    ccomprule *rules;
+    ccomprule rule;
+    char *action;
+    char *text;
+    int linenum;
+    int ret=0;
+    FILE *f;
+    
+    if (!p || !path)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if ((f=fopen(path, "r"))==NULL)
+    {   sysprintf("cannot open the compression policy file [%s]\n", path);
+        return -1;
+    }
+    
+    for (linenum=1; fgets(line, sizeof(line), f)!=NULL; linenum++)
+    {
+        // a line which does not fit in the buffer would be parsed as two rules
+        if ((strchr(line, '\n')==NULL) && (fgetc(f)!=EOF))
+        {   errprintf("%s:%d: the line is too long, it must be shorter than %d characters\n", path, linenum, (int)sizeof(line)-1);
+            ret=-1;
+            break;
+        }
+        
+        // ignore comments, spaces and empty lines
+        line[strcspn(line, "#\r\n")]=0;
+        for (text=line; isspace(*text); text++);
+        if (*text==0)
+            continue;
+        
+        memset(&rule, 0, sizeof(rule));
+        rule.line=linenum;
+        if ((action=strstr(text, "->"))==NULL)
+        {   errprintf("%s:%d: a rule must be written as \"<conditions> -> <algorithm> [level]\"\n", path, linenum);
+            ret=-1;
+            break;
+        }
+        *action=0;
+        action+=2;
+        if (comppolicy_parse_rule(&rule, text, action)!=0)
+        {   errprintf("%s:%d: invalid rule\n", path, linenum);
+            ret=-1;
+            break;
+        }
+        
+        if ((rules=realloc(p->rules, (p->count+1)*sizeof(ccomprule)))==NULL)
+        {   errprintf("realloc() failed: out of memory\n");
+            ret=-1;
+            break;
+        }
+        p->rules=rules;
+        p->rules[p->count++]=rule;
+    }
+    
+    fclose(f);
+    msgprintf(MSG_VERB2, "%d rules loaded from the compression policy file [%s]\n", p->count, path);
+    return ret;
+}
+
+bool comppolicy_match_patterns(char *patterns, char *relpath)
+{
+    char pattern[COMPPOLICY_MAXPATTERN];
+    char *saveptr=NULL;
+    char *basename;
+    char *token;
+    
+    if (patterns[0]==0)
+        return true;
+    
+    basename=strrchr(relpath, '/');
+    basename=(basename!=NULL)?(basename+1):(relpath);
+    snprintf(pattern, sizeof(pattern), "%s", patterns);
+    for (token=strtok_r(pattern, ",", &saveptr); token!=NULL; token=strtok_r(NULL, ",", &saveptr))
+    {
+        // patterns which contain a slash are matched against the path, others against the name
+        if (fnmatch(token, (strchr(token, '/')!=NULL)?(relpath):(basename), 0)==0)
+            return true;
+    }
+    return false;
+}
+
+// returns the index of the rule which matches the file and sets compalgo and complevel,
+// or returns -1 when no rule matches and the global options must be used. data points
+// to the first datasize bytes of the file and it is used to check the magic numbers
+int comppolicy_select(ccomppolicy *p, char *relpath, u8 *data, u64 datasize, u64 filesize, u16 *compalgo, int *complevel)
+{
+    ccomprule *rule;
+    int i;
+    
+    for (i=0; (p!=NULL) && (i<p->count); i++)
+    {
+        rule=&p->rules[i];
+        if ((rule->minsize>0) && (filesize<=rule->minsize))
+            continue;
+        if ((rule->maxsize>0) && (filesize>=rule->maxsize))
+            continue;
+        if ((rule->magiclen>0) && ((datasize<rule->magiclen) || (memcmp(data, rule->magic, rule->magiclen)!=0)))
+            continue;
+        if (comppolicy_match_patterns(rule->patterns, relpath)==false)
+            continue;
+        
+        *compalgo=rule->compalgo;
+        *complevel=rule->complevel;
+        return i;
+    }
+    return -1;
+}
@@ -0,0 +1,52 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __COMPPOLICY_H__
+#define __COMPPOLICY_H__
+
+#define COMPPOLICY_MAXPATTERN   1024   // maximum length of the list of patterns of a rule
+#define COMPPOLICY_MAXMAGIC     16     // maximum length of the magic number of a rule
+
+struct s_comprule;
+typedef struct s_comprule ccomprule;
+
+struct s_comppolicy;
+typedef struct s_comppolicy ccomppolicy;
+
+struct s_comprule // a rule of the compression policy: all the conditions which are set must match
+{   char     patterns[COMPPOLICY_MAXPATTERN]; // comma separated list of shell patterns (empty to match all names)
+    u8       magic[COMPPOLICY_MAXMAGIC]; // bytes expected at the beginning of the file
+    int      magiclen; // length of magic (0 to ignore the contents)
+    u64      minsize; // the file must be bigger than minsize (0 for no limit)
+    u64      maxsize; // the file must be smaller than maxsize (0 for no limit)
+    u16      compalgo; // compression algorithm to use (COMPRESS_NONE to store the data as they are)
+    int      complevel; // compression level to use with compalgo
+    int      line; // line of the policy file where the rule is defined
+};
+
+struct s_comppolicy // compression algorithm and level to use for each file
+{   ccomprule *rules; // the first rule which matches a file is used
+    int      count; // how many rules there are in the policy
+};
+
+int  comppolicy_init(ccomppolicy *p);
+int  comppolicy_destroy(ccomppolicy *p);
+int  comppolicy_load(ccomppolicy *p, char *path);
+int  comppolicy_select(ccomppolicy *p, char *relpath, u8 *data, u64 datasize, u64 filesize, u16 *compalgo, int *complevel);
+
+#endif // __COMPPOLICY_H__
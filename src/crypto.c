@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "fsarchiver.h"
 #include "common.h"
@@ -59,57 +60,212 @@ int crypto_cleanup()
     return 0;
 }
 
-int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc)
+int cryptctx_init(ccryptctx *ctx)
+{
+    memset(ctx, 0, sizeof(struct s_cryptctx));
+    ctx->opened=false;
+    ctx->keylen=0;
+    return 0;
+}
+
+int cryptctx_destroy(ccryptctx *ctx)
+{
+    if (ctx->opened==true)
+        gcry_cipher_close(ctx->hd);
+    if (ctx->aeadopened==true)
+        gcry_cipher_close(ctx->aeadhd);
+    memset(ctx, 0, sizeof(struct s_cryptctx));
+    ctx->opened=false;
+    ctx->aeadopened=false;
+    return 0;
+}
+
+int crypto_blowfish_ctx(ccryptctx *ctx, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc)
 {
-    gcry_cipher_hd_t hd;
     u8 iv[] = "fsarchiv";
     int res;
     
     // init
-    if ((password==NULL) || (passlen==0))
+    if ((password==NULL) || (passlen==0) || (passlen > (int)sizeof(ctx->key)))
         return -1;
     
-    if ((res=gcry_cipher_open(&hd, GCRY_CIPHER_BLOWFISH, GCRY_CIPHER_MODE_CFB, GCRY_CIPHER_SECURE))!=0)
+    if (ctx->opened==false)
     {
-        errprintf("gcry_cipher_open() failed\n");
-        gcry_cipher_close(hd);
-        return -1;
+        if ((res=gcry_cipher_open(&ctx->hd, GCRY_CIPHER_BLOWFISH, GCRY_CIPHER_MODE_CFB, GCRY_CIPHER_SECURE))!=0)
+        {
+            errprintf("gcry_cipher_open() failed\n");
+            return -1;
+        }
+        ctx->opened=true;
+        ctx->keylen=0;
     }
     
-    if ((res=gcry_cipher_setkey(hd, password, passlen))!=0)
+    // the key schedule of blowfish is expensive: only compute it when the password changes
+    if ((ctx->keylen!=passlen) || (memcmp(ctx->key, password, passlen)!=0))
     {
-        errprintf("gcry_cipher_setkey() failed\n");
-        gcry_cipher_close(hd);
-        return -1;
+        ctx->keylen=0;
+        if ((res=gcry_cipher_setkey(ctx->hd, password, passlen))!=0)
+        {
+            errprintf("gcry_cipher_setkey() failed\n");
+            return -1;
+        }
+        memcpy(ctx->key, password, passlen);
+        ctx->keylen=passlen;
     }
     
-    if (gcry_cipher_setiv(hd, iv, strlen((char*)iv)))
+    // each block is encrypted independently from the same IV
+    gcry_cipher_reset(ctx->hd);
+    if (gcry_cipher_setiv(ctx->hd, iv, strlen((char*)iv)))
     {
         errprintf("gcry_cipher_setiv() failed\n");
-        gcry_cipher_close(hd);
         return -1;
     }
     
     switch(enc)
     {
         case 1: // encrypt
-            res=gcry_cipher_encrypt(hd, outbuf, insize, inbuf, insize);
+            res=gcry_cipher_encrypt(ctx->hd, outbuf, insize, inbuf, insize);
             break;
         case 0: // decrypt
-            res=gcry_cipher_decrypt(hd, outbuf, insize, inbuf, insize);
+            res=gcry_cipher_decrypt(ctx->hd, outbuf, insize, inbuf, insize);
             break;
         default: // invalid
             errprintf("invalid parameter: enc=%d\n", (int)enc);
-            gcry_cipher_close(hd);
             return -1;
     }
-      
-    gcry_cipher_close(hd);
     
     *outsize=insize;
     return (res==0)?(0):(-1);
 }
 
+int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc)
+{
+    ccryptctx ctx;
+    int res;
+    
+    cryptctx_init(&ctx);
+    res=crypto_blowfish_ctx(&ctx, insize, outsize, inbuf, outbuf, password, passlen, enc);
+    cryptctx_destroy(&ctx);
+    return res;
+}
+
+// encrypt (enc=1) or decrypt (enc=0) a block with aes-256-gcm: the 16 bytes authentication
+// tag which covers both the data and the additional authenticated data (aad) is appended
+// to the ciphertext, so outsize=insize+FSA_AEAD_TAGLEN when encrypting. When decrypting
+// the function fails if the tag does not match, which means the block or its header is corrupt
+int crypto_aes256gcm_ctx(ccryptctx *ctx, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *key, u8 *nonce, u8 *aad, int aadlen, int enc)
+{
+#ifdef OPTION_CRYPTO_AEAD
+    int res;
+    
+    // init
+    if ((key==NULL) || (nonce==NULL))
+        return -1;
+    
+    if (ctx->aeadopened==false)
+    {
+        if ((res=gcry_cipher_open(&ctx->aeadhd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, GCRY_CIPHER_SECURE))!=0)
+        {
+            errprintf("gcry_cipher_open() failed\n");
+            return -1;
+        }
+        ctx->aeadopened=true;
+        ctx->aeadkeyset=false;
+    }
+    
+    if ((ctx->aeadkeyset==false) || (memcmp(ctx->aeadkey, key, FSA_AEAD_KEYLEN)!=0))
+    {
+        ctx->aeadkeyset=false;
+        if ((res=gcry_cipher_setkey(ctx->aeadhd, key, FSA_AEAD_KEYLEN))!=0)
+        {
+            errprintf("gcry_cipher_setkey() failed\n");
+            return -1;
+        }
+        memcpy(ctx->aeadkey, key, FSA_AEAD_KEYLEN);
+        ctx->aeadkeyset=true;
+    }
+    
+    // each block has its own nonce which is stored in the block header
+    gcry_cipher_reset(ctx->aeadhd);
+    if (gcry_cipher_setiv(ctx->aeadhd, nonce, FSA_AEAD_NONCELEN))
+    {
+        errprintf("gcry_cipher_setiv() failed\n");
+        return -1;
+    }
+    if ((aad!=NULL) && (aadlen>0) && gcry_cipher_authenticate(ctx->aeadhd, aad, aadlen))
+    {
+        errprintf("gcry_cipher_authenticate() failed\n");
+        return -1;
+    }
+    
+    switch(enc)
+    {
+        case 1: // encrypt
+            if ((res=gcry_cipher_encrypt(ctx->aeadhd, outbuf, insize, inbuf, insize))!=0)
+                return -1;
+            if ((res=gcry_cipher_gettag(ctx->aeadhd, outbuf+insize, FSA_AEAD_TAGLEN))!=0)
+                return -1;
+            *outsize=insize+FSA_AEAD_TAGLEN;
+            return 0;
+        case 0: // decrypt
+            if (insize<FSA_AEAD_TAGLEN)
+                return -1;
+            if ((res=gcry_cipher_decrypt(ctx->aeadhd, outbuf, insize-FSA_AEAD_TAGLEN, inbuf, insize-FSA_AEAD_TAGLEN))!=0)
+                return -1;
+            if ((res=gcry_cipher_checktag(ctx->aeadhd, inbuf+insize-FSA_AEAD_TAGLEN, FSA_AEAD_TAGLEN))!=0)
+            {
+                msgprintf(MSG_DEBUG1, "gcry_cipher_checktag() failed: authentication tag does not match\n");
+                return -1;
+            }
+            *outsize=insize-FSA_AEAD_TAGLEN;
+            return 0;
+        default: // invalid
+            errprintf("invalid parameter: enc=%d\n", (int)enc);
+            return -1;
+    }
+#else
+    errprintf("this version of libgcrypt does not support aes-256-gcm, libgcrypt>=1.6.0 is required\n");
+    return -1;
+#endif // OPTION_CRYPTO_AEAD
+}
+
+int crypto_aes256gcm(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *key, u8 *nonce, u8 *aad, int aadlen, int enc)
+{
+    ccryptctx ctx;
+    int res;
+    
+    cryptctx_init(&ctx);
+    res=crypto_aes256gcm_ctx(&ctx, insize, outsize, inbuf, outbuf, key, nonce, aad, aadlen, enc);
+    cryptctx_destroy(&ctx);
+    return res;
+}
+
+// derive an encryption key from the password with pbkdf2-sha256 and a random salt
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u8 *key, int keylen)
+{
+#ifdef OPTION_CRYPTO_AEAD
+    if ((password==NULL) || (passlen==0))
+        return -1;
+    
+    if (gcry_kdf_derive(password, passlen, GCRY_KDF_PBKDF2, GCRY_MD_SHA256, salt, saltlen, FSA_AEAD_KDFITER, keylen, key)!=0)
+    {
+        errprintf("gcry_kdf_derive() failed\n");
+        return -1;
+    }
+    
+    return 0;
+#else
+    errprintf("this version of libgcrypt does not support key derivation, libgcrypt>=1.6.0 is required\n");
+    return -1;
+#endif // OPTION_CRYPTO_AEAD
+}
+
+int crypto_nonce(u8 *buf, int bufsize)
+{
+    gcry_create_nonce(buf, bufsize);
+    return 0;
+}
+
 int crypto_random(u8 *buf, int bufsize)
 {
     memset(buf, 0, bufsize);
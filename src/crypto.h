@@ -18,11 +18,40 @@
 #ifndef __CRYPTO_H__
 #define __CRYPTO_H__
 
+#include <gcrypt.h>
+
 #include "types.h"
 
+// authenticated encryption (galois/counter mode) requires libgcrypt >= 1.6.0
+#if GCRYPT_VERSION_NUMBER >= 0x010600
+#  define OPTION_CRYPTO_AEAD 1
+#endif
+
+struct s_cryptctx;
+typedef struct s_cryptctx ccryptctx;
+
+// cipher handle kept by a thread: the key is set once and only the IV is reset for each block
+struct s_cryptctx
+{   gcry_cipher_hd_t hd; // blowfish handle, valid when opened is true
+    bool   opened; // true when hd has been opened
+    int    keylen; // length of the key which has been set in hd (0 if none)
+    u8     key[FSA_MAX_PASSLEN]; // key which has been set in hd
+    gcry_cipher_hd_t aeadhd; // aes-256-gcm handle, valid when aeadopened is true
+    bool   aeadopened; // true when aeadhd has been opened
+    bool   aeadkeyset; // true when aeadkey has been set in aeadhd
+    u8     aeadkey[FSA_AEAD_KEYLEN]; // key which has been set in aeadhd
+};
+
 int crypto_init();
+int cryptctx_init(ccryptctx *ctx);
+int cryptctx_destroy(ccryptctx *ctx);
+int crypto_blowfish_ctx(ccryptctx *ctx, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc);
 int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc);
+int crypto_aes256gcm_ctx(ccryptctx *ctx, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *key, u8 *nonce, u8 *aad, int aadlen, int enc);
+int crypto_aes256gcm(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *key, u8 *nonce, u8 *aad, int aadlen, int enc);
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u8 *key, int keylen);
 int crypto_random(u8 *buf, int bufsize);
+int crypto_nonce(u8 *buf, int bufsize);
 int crypto_cleanup();
 
 #endif // __CRYPTO_H__
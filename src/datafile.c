@@ -32,6 +32,7 @@
 #include "datafile.h"
 #include "common.h"
 #include "error.h"
+#include "zeroscan.h"
 
 struct s_datafile 
 {   int  fd; // file descriptor
@@ -104,19 +105,37 @@ int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
 
 int datafile_is_block_zero(cdatafile *f, char *data, u64 len)
 {
-    bool zero=true;
-    u64 pos;
+    return zeroscan_is_zero(data, len);
+}
+
+int datafile_write_data(cdatafile *f, char *data, u64 len)
+{
+    s64 lres;
     
-    for (pos=0; (pos<len) && (zero==true); pos++)
-        if (data[pos]!=0)
-            zero=false;
+    errno=0;
+    if ((lres=write(f->fd, data, len))!=len) // error
+    {
+        if ((errno==ENOSPC) || ((lres>0) && (lres < len)))
+        {   sysprintf("Can't write file [%s]: no space left on device\n", f->path);
+            return FSAERR_ENOSPC;
+        }
+        else // another error
+        {   sysprintf("cannot write %s: size=%ld\n", f->path, (long)len);
+            return FSAERR_WRITE;
+        }
+    }
     
-    return zero;
+    return FSAERR_SUCCESS;
 }
 
 int datafile_write(cdatafile *f, char *data, u64 len)
 {
-    s64 lres;
+    u64 pagelen;
+    u64 runlen;
+    u64 pos;
+    bool pagezero;
+    bool zero;
+    int res;
     
     assert(f);
     
@@ -125,29 +144,35 @@ int datafile_write(cdatafile *f, char *data, u64 len)
         return FSAERR_NOTOPEN;
     }
     
-    if (f->simul==false)
+    if ((f->simul==false) && (f->sparse==false))
     {
-        if ((f->sparse==true) && (datafile_is_block_zero(f, data, len)))
+        if ((res=datafile_write_data(f, data, len))!=FSAERR_SUCCESS)
+            return res;
+    }
+    else if (f->simul==false)
+    {
+        // the pages of zeros are skipped so that they become holes, the consecutive pages of data are written at once
+        pagelen=min(len, ZEROSCAN_PAGESIZE);
+        pagezero=datafile_is_block_zero(f, data, pagelen);
+        for (pos=0; pos<len; pos+=runlen)
         {
-            if (lseek64(f->fd, len, SEEK_CUR)<0)
+            // the first page of the run is the one which has ended the previous run: it has already been scanned
+            zero=pagezero;
+            runlen=pagelen;
+            while (pos+runlen<len)
+            {
+                pagelen=min(len-pos-runlen, ZEROSCAN_PAGESIZE);
+                if ((pagezero=datafile_is_block_zero(f, data+pos+runlen, pagelen))!=zero)
+                    break;
+                runlen+=pagelen;
+            }
+            
+            if ((zero==true) && (lseek64(f->fd, runlen, SEEK_CUR)<0))
             {   sysprintf("Can't lseek64() in file [%s]\n", f->path);
                 return FSAERR_SEEK;
             }
-        }
-        else
-        {
-            errno=0;
-            if ((lres=write(f->fd, data, len))!=len) // error
-            {
-                if ((errno==ENOSPC) || ((lres>0) && (lres < len)))
-                {   sysprintf("Can't write file [%s]: no space left on device\n", f->path);
-                    return FSAERR_ENOSPC;
-                }
-                else // another error
-                {   sysprintf("cannot write %s: size=%ld\n", f->path, (long)len);
-                    return FSAERR_WRITE;
-                }
-            }
+            if ((zero==false) && ((res=datafile_write_data(f, data+pos, runlen))!=FSAERR_SUCCESS))
+                return res;
         }
     }
     
@@ -156,6 +181,36 @@ int datafile_write(cdatafile *f, char *data, u64 len)
     return FSAERR_SUCCESS;
 }
 
+int datafile_write_zeros(cdatafile *f, u64 len)
+{
+    static char zeros[65536];
+    u64 curlen;
+    u64 pos;
+    int res;
+    
+    assert(f);
+    
+    if (!f->open)
+    {   errprintf("File is not open\n");
+        return FSAERR_NOTOPEN;
+    }
+    
+    if ((f->simul==false) && (f->sparse==true) && (lseek64(f->fd, len, SEEK_CUR)<0))
+    {   sysprintf("Can't lseek64() in file [%s]\n", f->path);
+        return FSAERR_SEEK;
+    }
+    
+    for (pos=0; pos<len; pos+=curlen)
+    {
+        curlen=min(len-pos, sizeof(zeros));
+        if ((f->simul==false) && (f->sparse==false) && ((res=datafile_write_data(f, zeros, curlen))!=FSAERR_SUCCESS))
+            return res;
+        gcry_md_write(f->md5ctx, zeros, curlen);
+    }
+    
+    return FSAERR_SUCCESS;
+}
+
 int datafile_close(cdatafile *f, u8 *md5bufdat, int md5bufsize)
 {
     char md5store[16];
@@ -0,0 +1,201 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <gcrypt.h>
+
+#include "fsarchiver.h"
+#include "dedup.h"
+#include "common.h"
+#include "error.h"
+
+int dedup_init(cdedup *d)
+{
+    if (!d)
+    {   errprintf("d is NULL\n");
+        return -1;
+    }
+    
+    memset(d, 0, sizeof(cdedup));
+    if (pthread_mutex_init(&d->mutex, NULL)!=0)
+    {   errprintf("pthread_mutex_init failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int dedup_destroy(cdedup *d)
+{
+    if (!d)
+    {   errprintf("d is NULL\n");
+        return -1;
+    }
+    
+    free(d->table);
+    d->table=NULL;
+    assert(pthread_mutex_destroy(&d->mutex)==0);
+    return 0;
+}
+
+// enable the deduplication with an index which uses at most maxmem bytes of memory
+int dedup_set_memory(cdedup *d, u64 maxmem)
+{
+    u64 size;
+    
+    if (!d || maxmem<DEDUP_MINMEM)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    for (size=1024; (size*2)*sizeof(cdedupentry)<=maxmem; size*=2);
+    
+    assert(pthread_mutex_lock(&d->mutex)==0);
+    free(d->table);
+    if ((d->table=calloc(size, sizeof(cdedupentry)))==NULL)
+    {   errprintf("calloc(%lld) failed: cannot allocate memory for the deduplication index\n", (long long)(size*sizeof(cdedupentry)));
+        d->size=0;
+        assert(pthread_mutex_unlock(&d->mutex)==0);
+        return -1;
+    }
+    d->size=size;
+    d->maxcount=size-(size/4); // probing becomes slow when the table is almost full
+    d->count=0;
+    assert(pthread_mutex_unlock(&d->mutex)==0);
+    return 0;
+}
+
+bool dedup_enabled(cdedup *d)
+{
+    return (d->table!=NULL);
+}
+
+int dedup_hash_block(u8 *hash, void *data, u32 size)
+{
+    u8 digest[32]; // sha-256 is truncated: 128 bits are enough to avoid collisions
+    
+    gcry_md_hash_buffer(GCRY_MD_SHA256, digest, data, size);
+    memcpy(hash, digest, FSA_DEDUP_HASHLEN);
+    return 0;
+}
+
+// returns the slot which contains the hash, or the free slot where it would have to be added
+cdedupentry *deduplocked_find(cdedup *d, u8 *hash, u32 realsize)
+{
+    cdedupentry *entry;
+    u64 key;
+    u64 i;
+    
+    memcpy(&key, hash, sizeof(key)); // the digest is already uniformly distributed
+    for (i=key&(d->size-1); ; i=(i+1)&(d->size-1))
+    {
+        entry=&d->table[i];
+        if ((entry->realsize==0) || ((entry->realsize==realsize) && (memcmp(entry->hash, hash, FSA_DEDUP_HASHLEN)==0)))
+            return entry;
+    }
+}
+
+// BLKDEDUP_REF if an identical block has already been seen, BLKDEDUP_FIRST if the block has
+// been added to the index, or BLKDEDUP_NONE if it has not been indexed because the table is full
+int dedup_lookup(cdedup *d, u8 *hash, u32 realsize)
+{
+    cdedupentry *entry;
+    int ret;
+    
+    if (!d || !hash || realsize==0 || d->table==NULL)
+    {   errprintf("invalid param\n");
+        return BLKDEDUP_NONE;
+    }
+    
+    assert(pthread_mutex_lock(&d->mutex)==0);
+    d->blocks++;
+    entry=deduplocked_find(d, hash, realsize);
+    if (entry->realsize!=0) // the block is a duplicate
+    {   d->dupblocks++;
+        d->savedbytes+=realsize;
+        ret=BLKDEDUP_REF;
+    }
+    else if (d->count < d->maxcount) // new block: its location is set when the writer stores it
+    {   memcpy(entry->hash, hash, FSA_DEDUP_HASHLEN);
+        entry->realsize=realsize;
+        entry->position=-1;
+        d->count++;
+        ret=BLKDEDUP_FIRST;
+    }
+    else // the memory cap has been reached: the block is archived normally
+    {   d->notindexed++;
+        ret=BLKDEDUP_NONE;
+    }
+    assert(pthread_mutex_unlock(&d->mutex)==0);
+    return ret;
+}
+
+// called by the writer when the first copy of a block has been written to the archive
+int dedup_set_location(cdedup *d, u8 *hash, u32 realsize, u32 volume, s64 position)
+{
+    cdedupentry *entry;
+    int ret=-1;
+    
+    assert(pthread_mutex_lock(&d->mutex)==0);
+    entry=deduplocked_find(d, hash, realsize);
+    if (entry->realsize!=0)
+    {   entry->volume=volume;
+        entry->position=position;
+        ret=0;
+    }
+    assert(pthread_mutex_unlock(&d->mutex)==0);
+    return ret;
+}
+
+// called by the writer to get where the first copy of a duplicate block has been written
+int dedup_get_location(cdedup *d, u8 *hash, u32 realsize, u32 *volume, s64 *position)
+{
+    cdedupentry *entry;
+    int ret=-1;
+    
+    assert(pthread_mutex_lock(&d->mutex)==0);
+    entry=deduplocked_find(d, hash, realsize);
+    if ((entry->realsize!=0) && (entry->position>=0))
+    {   *volume=entry->volume;
+        *position=entry->position;
+        ret=0;
+    }
+    assert(pthread_mutex_unlock(&d->mutex)==0);
+    return ret;
+}
+
+int dedup_show_stats(cdedup *d)
+{
+    char buffer[256];
+    
+    if (dedup_enabled(d)==false)
+        return 0;
+    
+    assert(pthread_mutex_lock(&d->mutex)==0);
+    msgprintf(MSG_FORCE, "Deduplication: %lld blocks out of %lld were duplicates, %s have not been archived again\n",
+        (long long)d->dupblocks, (long long)d->blocks, format_size(d->savedbytes, buffer, sizeof(buffer), 'h'));
+    msgprintf(MSG_FORCE, "Deduplication: %lld blocks in the index using %s of memory, %lld blocks not indexed (index full)\n",
+        (long long)d->count, format_size(d->size*sizeof(cdedupentry), buffer, sizeof(buffer), 'h'), (long long)d->notindexed);
+    assert(pthread_mutex_unlock(&d->mutex)==0);
+    return 0;
+}
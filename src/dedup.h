@@ -0,0 +1,65 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <pthread.h>
+
+struct s_dedupentry;
+typedef struct s_dedupentry cdedupentry;
+
+struct s_dedup;
+typedef struct s_dedup cdedup;
+
+#define DEDUP_MINBLKSIZE        4096   // smaller blocks are not worth a reference record
+#define DEDUP_DEFMEM            (256LL*1024LL*1024LL) // default memory used by the index
+#define DEDUP_MINMEM            (1LL*1024LL*1024LL) // smallest memory cap accepted for the index
+
+enum {BLKDEDUP_NONE=0, BLKDEDUP_FIRST, BLKDEDUP_REF};
+
+struct s_dedupentry
+{   u8                   hash[FSA_DEDUP_HASHLEN]; // digest of the contents of the block
+    u32                  realsize; // size of the block (0 when the slot is free)
+    u32                  volume; // volume where the first copy of the block has been written
+    s64                  position; // offset of the header of the first copy in that volume (-1 until it is written)
+};
+
+struct s_dedup // index of the data blocks already archived used to store each of them only once
+{   pthread_mutex_t      mutex; // pthread mutex for data protection
+    cdedupentry          *table; // open addressing hash table (NULL when deduplication is disabled)
+    u64                  size; // number of slots in the table (always a power of two)
+    u64                  maxcount; // how many entries can be added before the table is considered as full
+    u64                  count; // how many entries there are in the table
+    u64                  blocks; // how many blocks have been looked up
+    u64                  dupblocks; // how many of them have been replaced with a reference
+    u64                  savedbytes; // size of the data which has not been archived again
+    u64                  notindexed; // blocks which have not been indexed because the table was full
+};
+
+int  dedup_init(cdedup *d);
+int  dedup_destroy(cdedup *d);
+int  dedup_set_memory(cdedup *d, u64 maxmem);
+bool dedup_enabled(cdedup *d);
+int  dedup_hash_block(u8 *hash, void *data, u32 size);
+int  dedup_lookup(cdedup *d, u8 *hash, u32 realsize);
+int  dedup_set_location(cdedup *d, u8 *hash, u32 realsize, u32 volume, s64 position);
+int  dedup_get_location(cdedup *d, u8 *hash, u32 realsize, u32 *volume, s64 *position);
+int  dedup_show_stats(cdedup *d);
+
+#endif // __DEDUP_H__
@@ -0,0 +1,180 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <gcrypt.h>
+
+#include "fsarchiver.h"
+#include "dupfile.h"
+#include "common.h"
+#include "error.h"
+
+cdupfile *dupfile_alloc(char *root)
+{
+    cdupfile *d;
+    if ((d=calloc(1, sizeof(cdupfile)))==NULL)
+        return NULL;
+    snprintf(d->root, sizeof(d->root), "%s", root);
+    return d;
+}
+
+int dupfile_destroy(cdupfile *d)
+{
+    cdupfileitem *item, *next;
+    int i;
+    
+    if (d==NULL)
+        return -1;
+    
+    for (i=0; i<DUPFILE_BUCKETS; i++)
+    {
+        for (item=d->buckets[i]; item!=NULL; item=next)
+        {
+            next=item->next;
+            free(item->relpath);
+            free(item);
+        }
+    }
+    
+    free(d);
+    
+    return 0;
+}
+
+// index of the list of the files which have that size
+u64 dupfile_bucket(u64 size)
+{
+    return (size*0x9E3779B97F4A7C15ULL)>>48; // the sizes are not uniformly distributed
+}
+
+// compute the digest and the md5 of the contents of a file (fails if the file does not have the expected size)
+int dupfile_hash(char *fullpath, u64 size, u8 *hash, u8 *md5sum)
+{
+    char buffer[65536];
+    gcry_md_hd_t ctx;
+    u64 total=0;
+    long res;
+    int fd;
+    
+    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
+    {   sysprintf("Cannot open %s for reading\n", fullpath);
+        return -1;
+    }
+    
+    if ((gcry_md_open(&ctx, GCRY_MD_SHA256, 0)!=GPG_ERR_NO_ERROR) || (gcry_md_enable(ctx, GCRY_MD_MD5)!=GPG_ERR_NO_ERROR))
+    {   errprintf("gcry_md_open() failed\n");
+        close(fd);
+        return -1;
+    }
+    
+    while ((res=read(fd, buffer, sizeof(buffer)))>0)
+    {   gcry_md_write(ctx, buffer, res);
+        total+=res;
+    }
+    close(fd);
+    
+    if ((res<0) || (total!=size))
+    {   msgprintf(MSG_DEBUG1, "cannot compute the digest of %s: res=%ld, size=%lld, expected=%lld\n",
+            fullpath, (long)res, (long long)total, (long long)size);
+        gcry_md_close(ctx);
+        return -1;
+    }
+    
+    memcpy(hash, gcry_md_read(ctx, GCRY_MD_SHA256), DUPFILE_HASHLEN);
+    memcpy(md5sum, gcry_md_read(ctx, GCRY_MD_MD5), 16);
+    gcry_md_close(ctx);
+    return 0;
+}
+
+// returns 0 and copies the path of the first copy to buf if a file with the same contents has already
+// been archived, otherwise returns 1. The file is only read when a file archived before has the same
+// size: the digests of the archived files were computed from the data which was written to the archive
+int dupfile_find(cdupfile *d, char *relpath, u64 size, char *buf, int bufsize, u64 *srcgroup, u8 *md5sum)
+{
+    char fullpath[PATH_MAX];
+    u8 hash[DUPFILE_HASHLEN];
+    u8 md5tmp[16];
+    cdupfileitem *item;
+    bool hashed=false;
+    
+    if (!d || !relpath || !buf || !srcgroup || !md5sum)
+    {   errprintf("a parameter is null\n");
+        return -1;
+    }
+    
+    for (item=d->buckets[dupfile_bucket(size)]; item!=NULL; item=item->next)
+    {
+        if (item->size!=size)
+            continue;
+        
+        // another file has the same size: the digest of the new file is required
+        if (hashed==false)
+        {   concatenate_paths(fullpath, sizeof(fullpath), d->root, relpath);
+            if (dupfile_hash(fullpath, size, hash, md5tmp)!=0)
+                return -1;
+            hashed=true;
+        }
+        
+        if ((memcmp(item->hash, hash, DUPFILE_HASHLEN)==0) && (memcmp(item->md5sum, md5tmp, 16)==0))
+        {   snprintf(buf, bufsize, "%s", item->relpath);
+            memcpy(md5sum, item->md5sum, 16);
+            *srcgroup=item->group;
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// a file which has been archived successfully can be referenced by the next identical files
+int dupfile_add(cdupfile *d, char *relpath, u64 size, u64 group, u8 *hash, u8 *md5sum)
+{
+    cdupfileitem *lnew;
+    u64 bucket;
+    
+    if (!d || !relpath || !hash || !md5sum)
+    {   errprintf("a parameter is null\n");
+        return -1;
+    }
+    
+    if ((lnew=calloc(1, sizeof(cdupfileitem)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)sizeof(cdupfileitem));
+        return -1;
+    }
+    if ((lnew->relpath=strdup(relpath))==NULL)
+    {   errprintf("strdup() failed: out of memory\n");
+        free(lnew);
+        return -1;
+    }
+    lnew->size=size;
+    lnew->group=group;
+    memcpy(lnew->hash, hash, DUPFILE_HASHLEN);
+    memcpy(lnew->md5sum, md5sum, 16);
+    bucket=dupfile_bucket(size);
+    lnew->next=d->buckets[bucket];
+    d->buckets[bucket]=lnew;
+    
+    return 0;
+}
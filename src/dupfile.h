@@ -0,0 +1,56 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __DUPFILE_H__
+#define __DUPFILE_H__
+
+#include <limits.h>
+#include "types.h"
+
+struct s_dupfile;
+typedef struct s_dupfile cdupfile;
+
+struct s_dupfileitem;
+typedef struct s_dupfileitem cdupfileitem;
+
+#define DUPFILE_BUCKETS     65536  // number of lists of files indexed by size (must be a power of two)
+#define DUPFILE_MINSIZE     4096   // smaller files are not worth a reference to another file
+#define DUPFILE_HASHLEN     32     // size of the sha-256 digest of the contents
+
+struct s_dupfile // regular files already archived which may be identical to the next files
+{   cdupfileitem *buckets[DUPFILE_BUCKETS]; // files indexed by size
+    char         root[PATH_MAX]; // directory where the files are read from
+};
+
+struct s_dupfileitem
+{   u64          size; // size of the file
+    u64          group; // shared block of small files containing its data (0 if the data has been queued)
+    u8           hash[DUPFILE_HASHLEN]; // digest of the contents computed while the file was archived
+    u8           md5sum[16]; // md5 of the contents stored in the archive
+    char         *relpath; // path of the file in the archive
+    cdupfileitem *next; // next file in the same bucket
+};
+
+cdupfile *dupfile_alloc(char *root);
+u64      dupfile_bucket(u64 size);
+int      dupfile_destroy(cdupfile *d);
+int      dupfile_hash(char *fullpath, u64 size, u8 *hash, u8 *md5sum);
+int      dupfile_find(cdupfile *d, char *relpath, u64 size, char *buf, int bufsize, u64 *srcgroup, u8 *md5sum);
+int      dupfile_add(cdupfile *d, char *relpath, u64 size, u64 group, u8 *hash, u8 *md5sum);
+
+#endif // __DUPFILE_H__
@@ -0,0 +1,200 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "fsarchiver.h"
+#include "entropy.h"
+#include "common.h"
+#include "error.h"
+
+int entropy_init(centropy *e)
+{
+    if (!e)
+    {   errprintf("e is NULL\n");
+        return -1;
+    }
+    
+    memset(e, 0, sizeof(centropy));
+    if (pthread_mutex_init(&e->mutex, NULL)!=0)
+    {   errprintf("pthread_mutex_init failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int entropy_destroy(centropy *e)
+{
+    if (!e)
+    {   errprintf("e is NULL\n");
+        return -1;
+    }
+    
+    assert(pthread_mutex_destroy(&e->mutex)==0);
+    return 0;
+}
+
+// cpu time used by the calling thread in nanoseconds
+u64 entropy_thread_cputime()
+{
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)!=0)
+        return 0;
+    return ((u64)ts.tv_sec*1000000000LL)+(u64)ts.tv_nsec;
+}
+
+// log2(x) in 16.16 fixed point (x must be greater than zero and lower than 65536)
+u32 entropy_log2(u32 x)
+{
+    u32 result;
+    u64 m;
+    int n;
+    int i;
+    
+    for (n=0; (x>>(n+1))!=0; n++);
+    result=((u32)n)<<16;
+    m=((u64)x<<16)>>n; // mantissa in [1,2) in 16.16 fixed point
+    for (i=15; i>=0; i--)
+    {
+        m=(m*m)>>16;
+        if (m>=(2<<16))
+        {   m>>=1;
+            result|=(1<<i);
+        }
+    }
+    return result;
+}
+
+// shannon entropy (in bits per byte, 16.16 fixed point) of samples spread over the block
+u32 entropy_estimate(u8 *data, u32 size)
+{
+    u32 histogram[256];
+    u64 sumclogc=0;
+    u32 total=0;
+    u32 stride;
+    u32 pos;
+    int i, j;
+    
+    memset(histogram, 0, sizeof(histogram));
+    stride=size/ENTROPY_SAMPLECOUNT;
+    for (i=0; i<ENTROPY_SAMPLECOUNT; i++)
+    {
+        pos=i*stride;
+        for (j=0; (j<ENTROPY_SAMPLESIZE) && (pos+j<size); j++)
+            histogram[data[pos+j]]++;
+        total+=j;
+    }
+    
+    // H = log2(N) - sum(c*log2(c))/N
+    for (i=0; i<256; i++)
+        if (histogram[i]>1)
+            sumclogc+=(u64)histogram[i]*entropy_log2(histogram[i]);
+    return entropy_log2(total)-(u32)(sumclogc/total);
+}
+
+// returns true if the block should be stored without compression. failcount is
+// the number of consecutive incompressible blocks in the current file (NULL if the
+// block does not belong to a single file): when it reaches ENTROPY_MAXFAILS the
+// remaining blocks of that file are stored without being analysed
+bool entropy_check_block(centropy *e, u8 *data, u32 size, int *failcount)
+{
+    bool incompressible;
+    u64 t1, t2;
+    
+    if ((failcount!=NULL) && (*failcount>=ENTROPY_MAXFAILS))
+    {
+        incompressible=true;
+        t1=t2=0;
+    }
+    else if (size<ENTROPY_MINBLKSIZE)
+    {
+        return false;
+    }
+    else
+    {
+        t1=entropy_thread_cputime();
+        incompressible=(entropy_estimate(data, size)>=ENTROPY_THRESHOLD);
+        t2=entropy_thread_cputime();
+        if (failcount!=NULL)
+            *failcount=(incompressible==true)?(*failcount+1):(0);
+    }
+    
+    assert(pthread_mutex_lock(&e->mutex)==0);
+    if (t2>t1)
+        e->estimnsec+=t2-t1;
+    if (t1!=0)
+        e->estimcount++;
+    if (incompressible==true)
+    {   e->skipcount++;
+        e->skipbytes+=size;
+    }
+    assert(pthread_mutex_unlock(&e->mutex)==0);
+    
+    return incompressible;
+}
+
+// called by the compression threads after each block has been compressed
+int entropy_account_compression(centropy *e, u32 size, u64 nsec, bool shrunk)
+{
+    assert(pthread_mutex_lock(&e->mutex)==0);
+    e->compbytes+=size;
+    e->compnsec+=nsec;
+    if (shrunk==false)
+    {   e->failbytes+=size;
+        e->failnsec+=nsec;
+    }
+    assert(pthread_mutex_unlock(&e->mutex)==0);
+    return 0;
+}
+
+int entropy_show_stats(centropy *e)
+{
+    char buffer[256];
+    double nsecperbyte;
+    double saved;
+    
+    assert(pthread_mutex_lock(&e->mutex)==0);
+    
+    // the cpu time saved is estimated using the cost of the blocks which did not shrink
+    // when there are enough of them, else using the average cost of the compression
+    if (e->failbytes>=(1024LL*1024LL))
+        nsecperbyte=(double)e->failnsec/(double)e->failbytes;
+    else if (e->compbytes>0)
+        nsecperbyte=(double)e->compnsec/(double)e->compbytes;
+    else
+        nsecperbyte=0;
+    saved=(nsecperbyte*(double)e->skipbytes)/1000000000.0;
+    
+    msgprintf(MSG_VERB1, "Entropy estimator: %lld blocks (%s) stored without compression, about %.2f seconds of cpu time saved "
+        "(%.2f seconds spent analysing %lld blocks)\n", (long long)e->skipcount, format_size(e->skipbytes, buffer, sizeof(buffer), 'h'),
+        saved, (double)e->estimnsec/1000000000.0, (long long)e->estimcount);
+    if (e->failbytes>0)
+        msgprintf(MSG_VERB1, "Entropy estimator: %s of data were compressed without saving any space\n",
+            format_size(e->failbytes, buffer, sizeof(buffer), 'h'));
+    
+    assert(pthread_mutex_unlock(&e->mutex)==0);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __ENTROPY_H__
+#define __ENTROPY_H__
+
+#include <pthread.h>
+
+struct s_entropy;
+typedef struct s_entropy centropy;
+
+struct s_entropy // estimates if data blocks are worth compressing and how much cpu time it saves
+{   pthread_mutex_t      mutex; // pthread mutex for data protection
+    u64                  estimcount; // how many blocks have been analysed by the estimator
+    u64                  estimnsec; // cpu time spent in the estimator
+    u64                  skipcount; // blocks stored without compression because of the estimator
+    u64                  skipbytes; // size of the blocks which have been stored without compression
+    u64                  compbytes; // size of the blocks which have been compressed
+    u64                  compnsec; // cpu time spent compressing these blocks
+    u64                  failbytes; // size of the compressed blocks which did not shrink
+    u64                  failnsec; // cpu time wasted compressing the blocks which did not shrink
+};
+
+#define ENTROPY_MINBLKSIZE      16384  // smaller blocks are always compressed
+#define ENTROPY_SAMPLECOUNT     128    // number of samples read from a block
+#define ENTROPY_SAMPLESIZE      32     // size of each sample
+#define ENTROPY_THRESHOLD       (7800*65536/1000) // 7.8 bits per byte (16.16 fixed point)
+#define ENTROPY_MAXFAILS        4      // consecutive incompressible blocks after which a file is not analysed anymore
+
+int  entropy_init(centropy *e);
+int  entropy_destroy(centropy *e);
+bool entropy_check_block(centropy *e, u8 *data, u32 size, int *failcount);
+int  entropy_account_compression(centropy *e, u32 size, u64 nsec, bool shrunk);
+u64  entropy_thread_cputime();
+int  entropy_show_stats(centropy *e);
+
+#endif // __ENTROPY_H__
@@ -27,6 +27,10 @@ struct s_stats
     u64    cnt_symlink;
     u64    cnt_hardlink;
     u64    cnt_special;
+    u64    cnt_dupfile; // regular files which reference the contents of an identical file
+    u64    dupfilebytes; // size of the contents of these files
+    u64    cnt_unchanged; // regular files which reference their contents in the base archive
+    u64    unchangedbytes; // size of the contents of these files
     u64    err_regfile;
     u64    err_dir;
     u64    err_symlink;
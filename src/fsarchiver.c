@@ -31,6 +31,8 @@
 #include "oper_restore.h"
 #include "oper_save.h"
 #include "oper_probe.h"
+#include "oper_bench.h"
+#include "oper_consolidate.h"
 #include "archinfo.h"
 #include "syncthread.h"
 #include "comp_lzo.h"
@@ -40,10 +42,16 @@
 #include "logfile.h"
 #include "error.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "entropy.h"
+#include "zstddict.h"
+#include "adaptlevel.h"
+#include "dedup.h"
 
 char *valid_magic[]={FSA_MAGIC_MAIN, FSA_MAGIC_VOLH, FSA_MAGIC_VOLF,
     FSA_MAGIC_FSIN, FSA_MAGIC_FSYB, FSA_MAGIC_DATF, FSA_MAGIC_OBJT,
-    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, NULL};
+    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, FSA_MAGIC_ZDIC, FSA_MAGIC_BREF,
+    FSA_MAGIC_BLKZ, NULL};
 
 void usage(char *progname, bool examples)
 {
@@ -79,6 +87,8 @@ void usage(char *progname, bool examples)
     msgprintf(MSG_FORCE, " * restdir: restore data from an archive which is not based on a filesystem\n");
     msgprintf(MSG_FORCE, " * archinfo: show information about an existing archive file and its contents\n");
     msgprintf(MSG_FORCE, " * probe [detailed]: show list of filesystems detected on the disks\n");
+    msgprintf(MSG_FORCE, " * bench <dir1> [<dir2> [...]]: measure the compression options on the data of directories\n");
+    msgprintf(MSG_FORCE, " * consolidate <archive> <incremental>: write the full archive made of an incremental archive and its --base\n");
     msgprintf(MSG_FORCE, "<options>\n");
     msgprintf(MSG_FORCE, " -o: overwrite the archive if it already exists instead of failing\n");
     msgprintf(MSG_FORCE, " -v: verbose mode (can be used several times to increase the level of details)\n");
@@ -92,9 +102,24 @@ void usage(char *progname, bool examples)
 #ifdef OPTION_ZSTD_SUPPORT
     msgprintf(MSG_FORCE, " -Z <level>: zstd compression level from 1 (very fast) to 22 (very good)\n");
 #endif // OPTION_ZSTD_SUPPORT
+    msgprintf(MSG_FORCE, " --comp-policy=<file>: choose the compression algorithm and level of each file using rules\n");
+#ifdef OPTION_ZSTD_SUPPORT
+    msgprintf(MSG_FORCE, " --zstd-dict: compress small files with a zstd dictionary trained on these files\n");
+    msgprintf(MSG_FORCE, " --zstd-adapt=<min>:<max>: adapt the zstd level between <min> and <max> to the speed of the output\n");
+#endif // OPTION_ZSTD_SUPPORT
+    msgprintf(MSG_FORCE, " --bench-target=<rate>: write speed of the destination (such as 100M) for the recommendation of bench\n");
+    msgprintf(MSG_FORCE, " --long[=<mbsize>]: use blocks of <mbsize> megabytes (default 8) to find long distance matches\n");
+    msgprintf(MSG_FORCE, " --dedup[=<mbsize>]: store identical data blocks once using an index of <mbsize> megabytes (default 256)\n");
+    msgprintf(MSG_FORCE, " --dedup-files: store the contents of identical files once (the copies reference the first file)\n");
+    msgprintf(MSG_FORCE, " --base=<archive>: only store the files changed since <archive> (required again to restore)\n");
+    msgprintf(MSG_FORCE, " --sparse: restore the pages of zeros as holes in all the files, not only in the sparse files\n");
+    msgprintf(MSG_FORCE, " --zero-extents: archive the holes of the sparse files without any data block (requires fsarchiver 0.8.10)\n");
     msgprintf(MSG_FORCE, " -s <mbsize>: split the archive into several files of <mbsize> megabytes each\n");
     msgprintf(MSG_FORCE, " -j <count>: create more than one (de)compression thread. useful on multi-core cpu\n");
     msgprintf(MSG_FORCE, " -c <password>: encrypt/decrypt data in archive, \"-c -\" for interactive password\n");
+    msgprintf(MSG_FORCE, " --cipher=<name>: cipher used with -c when saving: blowfish (default) or aes256gcm (authenticated)\n");
+    msgprintf(MSG_FORCE, " --checksum=<name>: checksum of the data blocks when saving: fletcher32 (default) or crc32c (faster)\n");
+    msgprintf(MSG_FORCE, " --queue-mem=<size>: memory used by the queue of data blocks (eg: 512M) instead of a fixed count\n");
     msgprintf(MSG_FORCE, " -h: show help and information about how to use fsarchiver with examples\n");
     msgprintf(MSG_FORCE, " -V: show program version and exit\n");
     msgprintf(MSG_FORCE, "<information>\n");
@@ -141,6 +166,9 @@ void usage(char *progname, bool examples)
     }
 }
 
+// long options which do not have a short equivalent
+enum {OPT_QUEUEMEM=256, OPT_CIPHER, OPT_COMPPOLICY, OPT_ZSTDDICT, OPT_LONG, OPT_ZSTDADAPT, OPT_BENCHTARGET, OPT_DEDUP, OPT_DEDUPFILES, OPT_BASEARCH, OPT_SPARSE, OPT_ZEROEXTENTS, OPT_CHECKSUM};
+
 static struct option const long_options[] =
 {
     {"overwrite", no_argument, NULL, 'o'},
@@ -158,6 +186,19 @@ static struct option const long_options[] =
     {"label", required_argument, NULL, 'L'},
     {"exclude", required_argument, NULL, 'e'},
     {"experimental", no_argument, NULL, 'x'},
+    {"queue-mem", required_argument, NULL, OPT_QUEUEMEM},
+    {"cipher", required_argument, NULL, OPT_CIPHER},
+    {"checksum", required_argument, NULL, OPT_CHECKSUM},
+    {"comp-policy", required_argument, NULL, OPT_COMPPOLICY},
+    {"zstd-dict", no_argument, NULL, OPT_ZSTDDICT},
+    {"long", optional_argument, NULL, OPT_LONG},
+    {"zstd-adapt", required_argument, NULL, OPT_ZSTDADAPT},
+    {"bench-target", required_argument, NULL, OPT_BENCHTARGET},
+    {"dedup", optional_argument, NULL, OPT_DEDUP},
+    {"dedup-files", no_argument, NULL, OPT_DEDUPFILES},
+    {"base", required_argument, NULL, OPT_BASEARCH},
+    {"sparse", no_argument, NULL, OPT_SPARSE},
+    {"zero-extents", no_argument, NULL, OPT_ZEROEXTENTS},
     {NULL, 0, NULL, 0}
 };
 
@@ -172,6 +213,8 @@ int process_cmdline(int argc, char **argv)
     char *archive=NULL;
     char tempbuf[1024];
     char *progname;
+    int adaptmin=0;
+    int adaptmax=0;
     int fscount;
     int argcok;
     int ret=0;
@@ -192,6 +235,8 @@ int process_cmdline(int argc, char **argv)
     g_options.compressjobs=1;
     g_options.datablocksize=FSA_DEF_BLKSIZE;
     g_options.encryptalgo=ENCRYPT_NONE;
+    g_options.cryptcipher=ENCRYPT_BLOWFISH;
+    g_options.sumalgo=SUMALGO_FLETCHER32;
     snprintf(g_options.archlabel, sizeof(g_options.archlabel), "<none>");
     g_options.encryptpass[0]=0;
 
@@ -307,6 +352,111 @@ int process_cmdline(int argc, char **argv)
                 }
                 snprintf((char*)g_options.encryptpass, FSA_MAX_PASSLEN, "%s", optarg);
                 break;
+            case OPT_COMPPOLICY: // per-file compression policy
+                if (comppolicy_load(&g_options.comppolicy, optarg)!=0)
+                {   errprintf("cannot load the compression policy from [%s]\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_ZSTDDICT: // dictionary for the blocks of small files
+#ifdef OPTION_ZSTD_SUPPORT
+                g_options.zstddict=true;
+#else
+                errprintf("zstd dictionaries are not available as zstd support has been disabled at compilation time\n");
+                return -1;
+#endif // OPTION_ZSTD_SUPPORT
+                break;
+            case OPT_CIPHER: // encryption algorithm
+                if (strcmp(optarg, "blowfish")==0)
+                    g_options.cryptcipher=ENCRYPT_BLOWFISH;
+                else if (strcmp(optarg, "aes256gcm")==0)
+                {
+#ifdef OPTION_CRYPTO_AEAD
+                    g_options.cryptcipher=ENCRYPT_AES256GCM;
+#else
+                    errprintf("aes256gcm is not available as libgcrypt>=1.6.0 was not used at compilation time\n");
+                    return -1;
+#endif // OPTION_CRYPTO_AEAD
+                }
+                else
+                {   errprintf("argument of option --cipher is invalid (%s). It must be either blowfish or aes256gcm\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_ZSTDADAPT: // adaptive zstd level
+#ifdef OPTION_ZSTD_SUPPORT
+                if ((sscanf(optarg, "%d:%d", &adaptmin, &adaptmax)!=2) || (adaptmin<1) || (adaptmax>22) || (adaptmin>adaptmax))
+                {   errprintf("argument of option --zstd-adapt is invalid (%s). It must be two levels between 1 and 22 such as 3:19\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+#else
+                errprintf("zstd compression is not available as its support has been disabled at compilation time\n");
+                return -1;
+#endif // OPTION_ZSTD_SUPPORT
+                break;
+            case OPT_LONG: // long mode with blocks larger than FSA_MAX_BLKSIZE
+                g_options.longblksize=FSA_DEF_LONGBLKSIZE;
+                if ((optarg!=NULL) && (atoi(optarg)>=1) && (atoi(optarg)<=FSA_MAX_LONGBLKSIZE/(1024LL*1024LL)))
+                    g_options.longblksize=atoi(optarg)*1024LL*1024LL;
+                else if (optarg!=NULL)
+                {   errprintf("argument of option --long is invalid (%s). It must be a number of megabytes between 1 and %lld\n",
+                        optarg, (long long)FSA_MAX_LONGBLKSIZE/(1024LL*1024LL));
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_DEDUP: // deduplication of the data blocks
+                g_options.dedupmem=DEDUP_DEFMEM;
+                if ((optarg!=NULL) && (atoi(optarg)>=DEDUP_MINMEM/(1024LL*1024LL)) && (atoi(optarg)<=65536))
+                    g_options.dedupmem=atoi(optarg)*1024LL*1024LL;
+                else if (optarg!=NULL)
+                {   errprintf("argument of option --dedup is invalid (%s). It must be a number of megabytes between %lld and 65536\n",
+                        optarg, (long long)DEDUP_MINMEM/(1024LL*1024LL));
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_DEDUPFILES: // deduplication of the files
+                g_options.dedupfiles=true;
+                break;
+            case OPT_BASEARCH: // archive to which an incremental archive refers for the unchanged files
+                snprintf(g_options.basearch, sizeof(g_options.basearch), "%s", optarg);
+                break;
+            case OPT_SPARSE: // holes in the files which were not sparse
+                g_options.sparseall=true;
+                break;
+            case OPT_CHECKSUM: // checksum of the data blocks
+                if (strcmp(optarg, "fletcher32")==0)
+                    g_options.sumalgo=SUMALGO_FLETCHER32;
+                else if (strcmp(optarg, "crc32c")==0)
+                    g_options.sumalgo=SUMALGO_CRC32C;
+                else
+                {   errprintf("argument of option --checksum is invalid (%s). It must be either fletcher32 or crc32c\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_ZEROEXTENTS: // holes of the sparse files without data blocks
+                g_options.zeroextents=true;
+                break;
+            case OPT_BENCHTARGET: // speed of the destination for the benchmark
+                if ((g_options.benchtarget=parse_size(optarg))==0)
+                {   errprintf("argument of option --bench-target is invalid (%s). It must be a speed in bytes per second such as 100M\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_QUEUEMEM: // memory budget for the queue
+                g_options.queuemem=parse_size(optarg);
+                if (g_options.queuemem<FSA_MIN_QUEUEMEM)
+                {   errprintf("argument of option --queue-mem is invalid (%s). It must be a size of at least %lldM such as 512M\n",
+                        optarg, (long long)FSA_MIN_QUEUEMEM/(1024LL*1024LL));
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
             case 'L': // archive label
                 snprintf(g_options.archlabel, sizeof(g_options.archlabel), "%s", optarg);
                 break;
@@ -322,6 +472,10 @@ int process_cmdline(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    // the cipher is only used for new archives, the algorithm of existing archives is read from their headers
+    if (g_options.encryptalgo!=ENCRYPT_NONE)
+        g_options.encryptalgo=g_options.cryptcipher;
+
     // in all cases we need at least 1 parameters
     if (argc < 1)
     {   fprintf(stderr, "No arguments provided, cannot continue\n");
@@ -333,6 +487,33 @@ int process_cmdline(int argc, char **argv)
         command=*argv++, argc--;
     }
 
+    // the level given with -Z is the first level used by the controller
+    if (adaptmin>0)
+    {
+        if (g_options.compressalgo!=COMPRESS_ZSTD)
+        {   errprintf("option --zstd-adapt can only be used with zstd compression (option -Z)\n");
+            return -1;
+        }
+        adaptlevel_set_bounds(&g_adaptlevel, adaptmin, adaptmax, g_options.compresslevel);
+    }
+    
+    // large blocks would use too much memory with the default number of blocks in the queue
+    if (g_options.longblksize>0)
+    {   g_options.datablocksize=g_options.longblksize;
+        if (g_options.queuemem==0)
+            g_options.queuemem=FSA_LONG_QUEUEMEM(g_options.longblksize, g_options.compressjobs);
+    }
+    
+    // the index of the blocks is allocated once so that its memory usage is bounded
+    if ((g_options.dedupmem>0) && (dedup_set_memory(&g_dedup, g_options.dedupmem)!=0))
+    {   errprintf("cannot allocate the index of the deduplication\n");
+        return -1;
+    }
+    
+    // the queue is either limited by a memory budget or by a number of blocks
+    if (g_options.queuemem>0)
+        queue_set_mem_budget(&g_queue, g_options.queuemem);
+    
     // calculate threshold for small files that are compressed together
     g_options.smallfilethresh=min(g_options.datablocksize/4, FSA_MAX_SMALLFILESIZE);
     msgprintf(MSG_DEBUG1, "Files smaller than %ld will be packed with other small files\n", (long)g_options.smallfilethresh);
@@ -368,6 +549,16 @@ int process_cmdline(int argc, char **argv)
         runasroot=true;
         argcok=(argc<=1);
     }
+    else if (strcmp(command, "bench")==0)
+    {   cmd=OPER_BENCH;
+        runasroot=false;
+        argcok=(argc>=1);
+    }
+    else if (strcmp(command, "consolidate")==0)
+    {   cmd=OPER_CONSOLIDATE;
+        runasroot=false;
+        argcok=(argc==2);
+    }
     else // command not found
     {   errprintf("[%s] is not a valid command.\n", command);
         usage(progname, false);
@@ -425,6 +616,7 @@ int process_cmdline(int argc, char **argv)
         case OPER_SAVEDIR:
         case OPER_RESTDIR:
         case OPER_ARCHINFO:
+        case OPER_CONSOLIDATE:
             archive=*argv++, argc--;
             break;
         case OPER_PROBE:
@@ -468,6 +660,12 @@ int process_cmdline(int argc, char **argv)
         case OPER_PROBE:
             ret=oper_probe(probedetailed);
             break;
+        case OPER_BENCH:
+            ret=oper_bench(fscount, partition);
+            break;
+        case OPER_CONSOLIDATE:
+            ret=oper_consolidate(archive, partition[0]);
+            break;
         default:
             errprintf("[%s] is not a valid command.\n", command);
             usage(progname, false);
@@ -483,6 +681,7 @@ int process_cmdline(int argc, char **argv)
 int main(int argc, char **argv)
 {
     int ret;
+    int i;
 
     // init the lzo library
 #ifdef OPTION_LZO_SUPPORT
@@ -501,12 +700,22 @@ int main(int argc, char **argv)
     // init
     options_init();
     queue_init(&g_queue, FSA_MAX_QUEUESIZE);
+    bufpool_init(&g_bufpool);
+    entropy_init(&g_entropy);
+    adaptlevel_init(&g_adaptlevel);
+    dedup_init(&g_dedup);
 
     // bulk of the program
     ret=process_cmdline(argc, argv);
 
     // cleanup
     queue_destroy(&g_queue);
+    bufpool_destroy(&g_bufpool);
+    entropy_destroy(&g_entropy);
+    adaptlevel_destroy(&g_adaptlevel);
+    dedup_destroy(&g_dedup);
+    for (i=0; i<FSA_MAX_FSPERARCH; i++)
+        zstddict_destroy(&g_zstddict[i]);
     options_destroy();
 
     // cleanup libgcrypt
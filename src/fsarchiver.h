@@ -30,7 +30,7 @@
 #endif
 
 // -------------------------------- fsarchiver commands ---------------------------------------------
-enum {OPER_NULL=0, OPER_SAVEFS, OPER_RESTFS, OPER_SAVEDIR, OPER_RESTDIR, OPER_ARCHINFO, OPER_PROBE};
+enum {OPER_NULL=0, OPER_SAVEFS, OPER_RESTFS, OPER_SAVEDIR, OPER_RESTDIR, OPER_ARCHINFO, OPER_PROBE, OPER_BENCH, OPER_CONSOLIDATE};
 
 // ----------------------------------- dico sections ------------------------------------------------
 enum {DICO_OBJ_SECTION_STDATTR=0, DICO_OBJ_SECTION_XATTR=1, DICO_OBJ_SECTION_WINATTR=2};
@@ -44,21 +44,30 @@ enum {VOLUMEFOOTKEY_VOLNUM, VOLUMEFOOTKEY_ARCHID, VOLUMEFOOTKEY_LASTVOL};
 
 // ----------------------------------- algorithms used to process data-------------------------------
 enum {COMPRESS_NULL=0, COMPRESS_NONE, COMPRESS_LZO, COMPRESS_GZIP, COMPRESS_BZIP2, COMPRESS_LZMA, COMPRESS_LZ4, COMPRESS_ZSTD};
-enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH};
+enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH, ENCRYPT_AES256GCM};
+enum {SUMALGO_FLETCHER32=0, SUMALGO_CRC32C};
 
 // ----------------------------------- dico keys ----------------------------------------------------
 enum {OBJTYPE_NULL=0, OBJTYPE_DIR, OBJTYPE_SYMLINK, OBJTYPE_HARDLINK, OBJTYPE_CHARDEV,
-      OBJTYPE_BLOCKDEV, OBJTYPE_FIFO, OBJTYPE_SOCKET, OBJTYPE_REGFILEUNIQUE, OBJTYPE_REGFILEMULTI};
+      OBJTYPE_BLOCKDEV, OBJTYPE_FIFO, OBJTYPE_SOCKET, OBJTYPE_REGFILEUNIQUE, OBJTYPE_REGFILEMULTI,
+      OBJTYPE_DUPFILE, OBJTYPE_UNCHANGED};
 
 enum {DISKITEMKEY_NULL=0, DISKITEMKEY_OBJECTID, DISKITEMKEY_PATH, DISKITEMKEY_OBJTYPE,
       DISKITEMKEY_SYMLINK, DISKITEMKEY_HARDLINK, DISKITEMKEY_RDEV, DISKITEMKEY_MODE,
       DISKITEMKEY_SIZE, DISKITEMKEY_UID, DISKITEMKEY_GID, DISKITEMKEY_ATIME, DISKITEMKEY_MTIME,
       DISKITEMKEY_MD5SUM, DISKITEMKEY_MULTIFILESCOUNT, DISKITEMKEY_MULTIFILESOFFSET,
-      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS};
+      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS, DISKITEMKEY_DUPFILE,
+      DISKITEMKEY_INODE, DISKITEMKEY_BASEVOLUME, DISKITEMKEY_BASEPOSITION};
 
 enum {BLOCKHEADITEMKEY_NULL=0, BLOCKHEADITEMKEY_REALSIZE, BLOCKHEADITEMKEY_BLOCKOFFSET,
       BLOCKHEADITEMKEY_COMPRESSALGO, BLOCKHEADITEMKEY_ENCRYPTALGO, BLOCKHEADITEMKEY_ARSIZE,
-      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM};
+      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM, BLOCKHEADITEMKEY_CRYPTNONCE,
+      BLOCKHEADITEMKEY_ZSTDDICTID, BLOCKHEADITEMKEY_SUMALGO};
+
+enum {BLOCKREFKEY_NULL=0, BLOCKREFKEY_BLOCKOFFSET, BLOCKREFKEY_REALSIZE, BLOCKREFKEY_VOLUME,
+      BLOCKREFKEY_POSITION};
+
+enum {BLOCKZEROKEY_NULL=0, BLOCKZEROKEY_BLOCKOFFSET, BLOCKZEROKEY_REALSIZE};
 
 enum {BLOCKFOOTITEMKEY_NULL=0, BLOCKFOOTITEMKEY_MD5SUM};
 
@@ -66,7 +75,8 @@ enum {MAINHEADKEY_NULL=0, MAINHEADKEY_FILEFORMATVER, MAINHEADKEY_PROGVERCREAT, M
       MAINHEADKEY_CREATTIME, MAINHEADKEY_ARCHLABEL, MAINHEADKEY_ARCHTYPE, MAINHEADKEY_FSCOUNT,
       MAINHEADKEY_COMPRESSALGO, MAINHEADKEY_COMPRESSLEVEL, MAINHEADKEY_ENCRYPTALGO,
       MAINHEADKEY_BUFCHECKPASSCLEARMD5, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, MAINHEADKEY_FSACOMPLEVEL,
-      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD};
+      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD, MAINHEADKEY_CRYPTSALT, MAINHEADKEY_MAXBLKSIZE,
+      MAINHEADKEY_BASEARCHID};
 
 enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADKEY_BYTESTOTAL,
       FSYSHEADKEY_BYTESUSED, FSYSHEADKEY_FSLABEL, FSYSHEADKEY_FSUUID, FSYSHEADKEY_FSINODESIZE,
@@ -86,6 +96,8 @@ enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADK
 
 enum {DIRSINFOKEY_NULL=0, DIRSINFOKEY_TOTALCOST};
 
+enum {ZSTDDICTKEY_NULL=0, ZSTDDICTKEY_SIZE, ZSTDDICTKEY_DICTID, ZSTDDICTKEY_DATA};
+
 // -------------------------------- fsarchiver errors ---------------------------------------------
 enum {FSAERR_SUCCESS=0,           // success
       FSAERR_UNKNOWN=-1,          // uknown error (default code that means error)
@@ -122,8 +134,12 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAX_FSPERARCH        128
 #define FSA_MAX_COMPJOBS         32
 #define FSA_MAX_QUEUESIZE        32
+#define FSA_MIN_QUEUEMEM         (4LL*1024LL*1024LL)
 #define FSA_MAX_BLKSIZE          921600
 #define FSA_DEF_BLKSIZE          524288
+#define FSA_DEF_LONGBLKSIZE      (8LL*1024LL*1024LL)
+#define FSA_MAX_LONGBLKSIZE      (64LL*1024LL*1024LL)
+#define FSA_LONG_QUEUEMEM(blksize, jobs) ((u64)(blksize)*(u64)(2*(jobs)+4))
 #ifdef OPTION_ZSTD_SUPPORT
  #define FSA_DEF_COMPRESS_ALGO   COMPRESS_ZSTD
  #define FSA_DEF_COMPRESS_LEVEL  8
@@ -134,6 +150,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_DEF_FSACOMP_LEVEL    3              // legacy -z mapping for gzip level 6
 #define FSA_MAX_SMALLFILECOUNT   512            // there can be up to FSA_MAX_SMALLFILECOUNT files copied in a single data block
 #define FSA_MAX_SMALLFILESIZE    131072         // files smaller than that will be grouped with other small files in a single data block
+#define FSA_MAX_ZEROEXTENT       (1LL*1024LL*1024LL*1024LL) // holes of sparse files are split in zero extents up to that size
 #define FSA_COST_PER_FILE        16384          // how much it cost to copy an empty file/dir/link: used to eval the progress bar
 
 #define FSA_MAX_LABELLEN         512
@@ -143,6 +160,14 @@ enum {OLDERR_FATAL=1,
 #define FSA_FILESYSID_NULL       0xFFFF
 #define FSA_CHECKPASSBUF_SIZE    4096
 
+#define FSA_AEAD_KEYLEN          32             // aes-256 key derived from the password
+#define FSA_AEAD_SALTLEN         16             // random salt stored in the main header for the key derivation
+#define FSA_AEAD_KDFITER         100000         // number of pbkdf2 iterations used to derive the key
+#define FSA_AEAD_NONCELEN        12             // random nonce stored in the header of each encrypted block
+#define FSA_AEAD_TAGLEN          16             // authentication tag appended to the data of each encrypted block
+#define FSA_AEAD_AADLEN          18             // block header fields authenticated with the data (offset, sizes, compression)
+#define FSA_DEDUP_HASHLEN        16             // bytes of the digest used to find the duplicate data blocks
+
 #define FSA_FILEFLAGS_SPARSE     1<<0           // set when a regfile is a sparse file
 
 // ----------------------------- fsarchiver magics --------------------------------------------------
@@ -157,6 +182,9 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAGIC_BLKH           "BlKh" // datablk header (one per data block, each regfile may have [0-n])
 #define FSA_MAGIC_FILF           "FiLf" // filedat footer (one per regfile, after the list of data blocks)
 #define FSA_MAGIC_DATF           "DaEn" // data footer (one per file system, at the end of its contents, or after the contents of the flatfiles)
+#define FSA_MAGIC_ZDIC           "ZdIc" // zstd dictionary (one per filesystem before its contents, used by the blocks of small files)
+#define FSA_MAGIC_BREF           "BlRf" // datablk reference (replaces a data block identical to one written before in the archive)
+#define FSA_MAGIC_BLKZ           "BlZr" // zero extent (replaces the data blocks of a hole of a sparse file)
 
 // ------------ global variables ---------------------------
 extern char *valid_magic[];
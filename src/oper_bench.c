@@ -0,0 +1,587 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fsarchiver.h"
+#include "oper_bench.h"
+#include "oper_save.h"
+#include "archinfo.h"
+#include "options.h"
+#include "common.h"
+#include "compctx.h"
+#include "comp_gzip.h"
+#include "comp_bzip2.h"
+#include "comp_lzma.h"
+#include "comp_lzo.h"
+#include "comp_lz4.h"
+#include "comp_zstd.h"
+#include "syncthread.h"
+#include "bufpool.h"
+#include "error.h"
+
+struct s_benchalgo;
+typedef struct s_benchalgo cbenchalgo;
+
+struct s_benchjob;
+typedef struct s_benchjob cbenchjob;
+
+struct s_benchalgo // compression algorithm and level measured by the benchmark
+{   int      compalgo; // compression algorithm
+    int      complevel; // compression level of that algorithm
+    u32      blksize; // size of the data blocks when the archive is saved with this algorithm and level
+    char     *option; // option of fsarchiver which selects this algorithm and level
+    u64      compbytes; // size of the sample after compression
+    double   compspeed; // how many bytes of the sample are compressed per second
+    double   decompspeed; // how many bytes of the compressed blocks are decompressed per second
+    int      errors; // how many blocks failed to be compressed or decompressed
+};
+
+struct s_benchjob // blocks processed by one of the threads of the benchmark
+{   u8           **blocks; // blocks of the sample cut with the block size of the algorithm
+    u32          *sizes; // size of these blocks
+    int          count; // how many blocks there are
+    cbenchalgo   *algo; // algorithm and level to use
+    u8           **compbufs; // blocks after compression
+    u32          *compsizes; // size of the blocks after compression (equal to the size of the block when stored)
+    u8           **decompbufs; // blocks after decompression
+    bool         decompress; // false for the compression pass and true for the decompression pass
+    bool         newctx; // create a new context for each block instead of keeping it between the blocks
+    int          worker; // index of this thread
+    int          workers; // how many threads share the blocks
+    int          errors; // how many blocks failed to be processed
+};
+
+// algorithms and levels which can be selected with the options -z and -Z, and the size of their blocks
+cbenchalgo bench_algos[]=
+{
+#ifdef OPTION_LZ4_SUPPORT
+    {COMPRESS_LZ4,   0,   FSA_DEF_BLKSIZE, "-z0"},
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_LZO_SUPPORT
+    {COMPRESS_LZO,   3,   FSA_DEF_BLKSIZE, "-z1"},
+#endif // OPTION_LZO_SUPPORT
+    {COMPRESS_GZIP,  3,   FSA_DEF_BLKSIZE, "-z2"},
+    {COMPRESS_GZIP,  6,   FSA_DEF_BLKSIZE, "-z3"},
+    {COMPRESS_GZIP,  9,   FSA_DEF_BLKSIZE, "-z4"},
+    {COMPRESS_BZIP2, 2,   262144,          "-z5"},
+    {COMPRESS_BZIP2, 5,   524288,          "-z6"},
+#ifdef OPTION_LZMA_SUPPORT
+    {COMPRESS_LZMA,  1,   262144,          "-z7"},
+    {COMPRESS_LZMA,  6,   524288,          "-z8"},
+    {COMPRESS_LZMA,  9,   FSA_MAX_BLKSIZE, "-z9"},
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    {COMPRESS_ZSTD,  1,   FSA_DEF_BLKSIZE, "-Z1"},
+    {COMPRESS_ZSTD,  3,   FSA_DEF_BLKSIZE, "-Z3"},
+    {COMPRESS_ZSTD,  5,   FSA_DEF_BLKSIZE, "-Z5"},
+    {COMPRESS_ZSTD,  8,   FSA_DEF_BLKSIZE, "-Z8"},
+    {COMPRESS_ZSTD,  12,  FSA_DEF_BLKSIZE, "-Z12"},
+    {COMPRESS_ZSTD,  15,  FSA_DEF_BLKSIZE, "-Z15"},
+    {COMPRESS_ZSTD,  19,  FSA_DEF_BLKSIZE, "-Z19"},
+#endif // OPTION_ZSTD_SUPPORT
+    {COMPRESS_NULL,  0,   0,               NULL},
+};
+
+// write speed of typical destinations used when no target is given with --bench-target
+struct s_benchtarget
+{   u64      rate;
+    char     *name;
+} bench_targets[]=
+{
+    {30LL*1024LL*1024LL,   "usb2 disk"},
+    {110LL*1024LL*1024LL,  "1Gb ethernet"},
+    {500LL*1024LL*1024LL,  "sata ssd"},
+    {2000LL*1024LL*1024LL, "nvme ssd"},
+    {0,                    NULL},
+};
+
+// reservoir sampling: every block offered has the same chance to be in the sample
+int bench_select_slot(cbenchset *set)
+{
+    u64 pos;
+    
+    set->seen++;
+    if (set->count < set->maxcount)
+        return set->count;
+    pos=((u64)random()*(u64)RAND_MAX+(u64)random())%set->seen;
+    return (pos < set->maxcount)?(int)pos:-1;
+}
+
+int bench_store_block(cbenchset *set, int slot, u8 *data, u32 size)
+{
+    free(set->blocks[slot]);
+    set->blocks[slot]=data;
+    set->sizes[slot]=size;
+    if (slot==set->count)
+        set->count++;
+    return 0;
+}
+
+// offer the block where the last small files have been packed
+int bench_flush_pack(cbenchset *set)
+{
+    int slot;
+    u8 *data;
+    
+    if (set->packsize==0)
+        return 0;
+    
+    if ((slot=bench_select_slot(set))>=0)
+    {
+        if ((data=malloc(set->packsize))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)set->packsize);
+            return -1;
+        }
+        memcpy(data, set->packbuf, set->packsize);
+        bench_store_block(set, slot, data, set->packsize);
+    }
+    set->packsize=0;
+    return 0;
+}
+
+// called for each regular file found in the directories: its blocks are offered to the sample
+int bench_add_file(cbenchset *set, char *fullpath, u64 filesize)
+{
+    u64 blkcount;
+    u64 offset;
+    s64 bytes;
+    u32 size;
+    int slot;
+    u8 *data;
+    int fd=-1;
+    u64 i;
+    
+    set->realbytes+=filesize;
+    if (filesize==0)
+        return 0;
+    
+    // small files are packed together as in the archives
+    if (filesize < g_options.smallfilethresh)
+    {
+        if ((set->packsize+filesize > set->blksize) && (bench_flush_pack(set)!=0))
+            return -1;
+        if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
+            return 0; // the file is ignored
+        if ((bytes=read(fd, set->packbuf+set->packsize, filesize))>0)
+            set->packsize+=bytes;
+        close(fd);
+        return 0;
+    }
+    
+    // only the blocks which are selected are read from the file
+    blkcount=(filesize+set->blksize-1)/set->blksize;
+    for (i=0; i < blkcount; i++)
+    {
+        if ((slot=bench_select_slot(set))<0)
+            continue;
+        if ((fd<0) && ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0))
+            return 0; // the file is ignored
+        offset=i*set->blksize;
+        size=min(set->blksize, filesize-offset);
+        if ((data=malloc(size))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+            close(fd);
+            return -1;
+        }
+        if (pread64(fd, data, size, offset)!=size)
+        {   free(data);
+            continue;
+        }
+        bench_store_block(set, slot, data, size);
+    }
+    
+    if (fd>=0)
+        close(fd);
+    return 0;
+}
+
+int bench_compress_block(ccompctx *ctx, int compalgo, int complevel, u8 *origbuf, u64 origsize, u8 *compbuf, u64 compbufsize, u64 *compsize)
+{
+    switch (compalgo)
+    {
+#ifdef OPTION_LZO_SUPPORT
+        case COMPRESS_LZO:
+            return compress_block_lzo(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+#endif // OPTION_LZO_SUPPORT
+        case COMPRESS_GZIP:
+            return compress_block_gzip(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+        case COMPRESS_BZIP2:
+            return compress_block_bzip2(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+#ifdef OPTION_LZMA_SUPPORT
+        case COMPRESS_LZMA:
+            return compress_block_lzma(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+        case COMPRESS_LZ4:
+            return compress_block_lz4(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+        case COMPRESS_ZSTD:
+            if (origsize>FSA_MAX_BLKSIZE) // blocks of the long mode
+                return compress_block_zstd_long(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel, 1);
+            return compress_block_zstd(ctx, origsize, compsize, origbuf, compbuf, compbufsize, complevel);
+#endif // OPTION_ZSTD_SUPPORT
+        default:
+            errprintf("unsupported compression algorithm: %d\n", compalgo);
+            return FSAERR_UNKNOWN;
+    }
+}
+
+int bench_uncompress_block(ccompctx *ctx, int compalgo, u8 *compbuf, u64 compsize, u8 *origbuf, u64 origbufsize, u64 *origsize)
+{
+    switch (compalgo)
+    {
+#ifdef OPTION_LZO_SUPPORT
+        case COMPRESS_LZO:
+            return uncompress_block_lzo(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+#endif // OPTION_LZO_SUPPORT
+        case COMPRESS_GZIP:
+            return uncompress_block_gzip(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+        case COMPRESS_BZIP2:
+            return uncompress_block_bzip2(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+#ifdef OPTION_LZMA_SUPPORT
+        case COMPRESS_LZMA:
+            return uncompress_block_lzma(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+        case COMPRESS_LZ4:
+            return uncompress_block_lz4(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+        case COMPRESS_ZSTD:
+            return uncompress_block_zstd(ctx, compsize, origsize, origbuf, origbufsize, compbuf);
+#endif // OPTION_ZSTD_SUPPORT
+        default:
+            errprintf("unsupported compression algorithm: %d\n", compalgo);
+            return FSAERR_UNKNOWN;
+    }
+}
+
+void *bench_thread_fct(void *args)
+{
+    cbenchjob *job=(cbenchjob *)args;
+    ccompctx ctx;
+    u64 compsize;
+    u64 origsize;
+    int i;
+    
+    // each thread has its own context as the compression threads
+    compctx_init(&ctx);
+    
+    for (i=job->worker; i < job->count; i+=job->workers)
+    {
+        if ((job->newctx==true) && (i!=job->worker)) // the contexts are created again as when they were not kept
+        {   compctx_destroy(&ctx);
+            compctx_init(&ctx);
+        }
+        
+        if (job->decompress==false)
+        {
+            if ((bench_compress_block(&ctx, job->algo->compalgo, job->algo->complevel, job->blocks[i], job->sizes[i],
+                job->compbufs[i], BUFPOOL_BOUND(job->sizes[i]), &compsize)!=FSAERR_SUCCESS) || (compsize>=job->sizes[i]))
+                compsize=job->sizes[i]; // the block would be stored without compression
+            job->compsizes[i]=compsize;
+        }
+        else if (job->compsizes[i] < job->sizes[i])
+        {
+            if ((bench_uncompress_block(&ctx, job->algo->compalgo, job->compbufs[i], job->compsizes[i],
+                job->decompbufs[i], job->sizes[i], &origsize)!=FSAERR_SUCCESS) || (origsize!=job->sizes[i]) ||
+                (memcmp(job->decompbufs[i], job->blocks[i], job->sizes[i])!=0))
+                job->errors++;
+        }
+    }
+    
+    compctx_destroy(&ctx);
+    return NULL;
+}
+
+// run one pass of the benchmark with all the threads and return the time it took in seconds
+double bench_run_pass(u8 **blocks, u32 *sizes, int count, cbenchalgo *algo, u8 **compbufs, u32 *compsizes, u8 **decompbufs, bool decompress)
+{
+    pthread_t threads[FSA_MAX_COMPJOBS];
+    cbenchjob jobs[FSA_MAX_COMPJOBS];
+    struct timespec t1, t2;
+    int workers;
+    int i;
+    
+    workers=max(min(g_options.compressjobs, FSA_MAX_COMPJOBS), 1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (i=0; i < workers; i++)
+    {
+        jobs[i].blocks=blocks;
+        jobs[i].sizes=sizes;
+        jobs[i].count=count;
+        jobs[i].algo=algo;
+        jobs[i].compbufs=compbufs;
+        jobs[i].compsizes=compsizes;
+        jobs[i].decompbufs=decompbufs;
+        jobs[i].decompress=decompress;
+        jobs[i].newctx=false;
+        jobs[i].worker=i;
+        jobs[i].workers=workers;
+        jobs[i].errors=0;
+        if (pthread_create(&threads[i], NULL, bench_thread_fct, (void*)&jobs[i])!=0)
+        {   errprintf("pthread_create(bench_thread_fct) failed\n");
+            bench_thread_fct((void*)&jobs[i]); // process these blocks in this thread
+            threads[i]=0;
+        }
+    }
+    for (i=0; i < workers; i++)
+    {
+        if (threads[i] && pthread_join(threads[i], NULL)!=0)
+            errprintf("pthread_join(bench_thread_fct) failed\n");
+        algo->errors+=jobs[i].errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    
+    return max((double)(t2.tv_sec-t1.tv_sec)+(double)(t2.tv_nsec-t1.tv_nsec)/1000000000.0, 0.000001);
+}
+
+// time spent to set up a new context for each block rather than keeping it between the blocks: all the blocks are
+// processed twice by this thread, once in each way, and the difference is returned in seconds per block
+double bench_setup_cost(u8 **blocks, u32 *sizes, int count, cbenchalgo *algo, u8 **compbufs, u32 *compsizes, u8 **decompbufs, bool decompress)
+{
+    struct timespec t1, t2, t3;
+    cbenchjob job;
+    int blocksdone;
+    int i;
+    
+    for (i=0, blocksdone=0; i < count; i++)
+        if ((decompress==false) || (compsizes[i] < sizes[i])) // the blocks which are stored are not decompressed
+            blocksdone++;
+    if (blocksdone==0)
+        return 0;
+    
+    memset(&job, 0, sizeof(job));
+    job.blocks=blocks;
+    job.sizes=sizes;
+    job.count=count;
+    job.algo=algo;
+    job.compbufs=compbufs;
+    job.compsizes=compsizes;
+    job.decompbufs=decompbufs;
+    job.decompress=decompress;
+    job.worker=0;
+    job.workers=1;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    job.newctx=false;
+    bench_thread_fct((void*)&job);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    job.newctx=true;
+    bench_thread_fct((void*)&job);
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    algo->errors+=job.errors;
+    
+    // a cost lower than the variations of the timings can be negative
+    return max((((double)(t3.tv_sec-t2.tv_sec)+(double)(t3.tv_nsec-t2.tv_nsec)/1000000000.0)-
+        ((double)(t2.tv_sec-t1.tv_sec)+(double)(t2.tv_nsec-t1.tv_nsec)/1000000000.0))/(double)blocksdone, 0.0);
+}
+
+// choose the algorithm which saves the data the fastest to a destination which writes rate bytes per second:
+// the compression threads or the destination is the bottleneck, and the best ratio is preferred between
+// the algorithms which are almost as fast as the fastest one
+cbenchalgo *bench_recommend(u64 rate, u64 samplebytes, double *inputrate)
+{
+    cbenchalgo *best=NULL;
+    double bestrate=0;
+    double ratio;
+    double cur;
+    int pass;
+    int i;
+    
+    for (pass=0; pass < 2; pass++)
+    {
+        for (i=0; bench_algos[i].compalgo!=COMPRESS_NULL; i++)
+        {
+            if ((bench_algos[i].errors>0) || (bench_algos[i].compspeed<=0) || (bench_algos[i].compbytes==0))
+                continue; // failed or not measured
+            ratio=(double)bench_algos[i].compbytes/(double)samplebytes;
+            cur=min(bench_algos[i].compspeed, (double)rate/ratio);
+            if ((pass==0) && (cur > bestrate))
+                bestrate=cur;
+            else if ((pass==1) && (cur >= bestrate*0.95) && ((best==NULL) || (bench_algos[i].compbytes < best->compbytes)))
+            {   best=&bench_algos[i];
+                *inputrate=cur;
+            }
+        }
+    }
+    
+    return best;
+}
+
+// cut the blocks of the sample with the block size of an algorithm as a save with this algorithm would do
+int bench_cut_blocks(cbenchset *set, u32 blksize, u8 **blocks, u32 *sizes, u8 **compbufs, u8 **decompbufs)
+{
+    u32 len;
+    u32 pos;
+    int count;
+    int i;
+    
+    for (i=0, count=0; i < set->count; i++)
+    {
+        for (pos=0; (pos < set->sizes[i]) && (count < BENCH_MAXCHUNKS); pos+=len, count++)
+        {
+            len=min(set->sizes[i]-pos, blksize);
+            blocks[count]=set->blocks[i]+pos;
+            sizes[count]=len;
+            if (((compbufs[count]=malloc(BUFPOOL_BOUND(len)))==NULL) || ((decompbufs[count]=malloc(len))==NULL))
+            {   errprintf("malloc(%ld) failed: out of memory\n", (long)BUFPOOL_BOUND(len));
+                return -1;
+            }
+        }
+    }
+    
+    return count;
+}
+
+int oper_bench(int argc, char **argv)
+{
+    u8 *blocks[BENCH_MAXCHUNKS];
+    u32 sizes[BENCH_MAXCHUNKS];
+    u8 *compbufs[BENCH_MAXCHUNKS];
+    u8 *decompbufs[BENCH_MAXCHUNKS];
+    u32 compsizes[BENCH_MAXCHUNKS];
+    char buffer1[256];
+    char buffer2[256];
+    cbenchalgo *algo;
+    double inputrate;
+    double elapsed;
+    u64 samplebytes;
+    u64 decompbytes;
+    double compsetup;
+    double decompsetup;
+    cbenchset set;
+    u64 rate;
+    int count;
+    int ret=0;
+    int i;
+    
+    // init
+    memset(&set, 0, sizeof(set));
+    memset(compbufs, 0, sizeof(compbufs));
+    memset(decompbufs, 0, sizeof(decompbufs));
+    // the blocks of the sample are as large as the largest blocks which can be used, and they are cut for
+    // each algorithm with its own block size, except in long mode where all algorithms use the same size
+    set.blksize=(g_options.longblksize>0)?(g_options.datablocksize):(FSA_MAX_BLKSIZE);
+    set.maxcount=max(min(BENCH_MAXBLOCKS, BENCH_MAXBYTES/set.blksize), 1);
+    if ((set.packbuf=malloc(set.blksize))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)set.blksize);
+        return -1;
+    }
+    
+    // sample the data of the directories as savedir reads them
+    for (i=0; (i < argc) && (argv[i]!=NULL); i++)
+    {
+        msgprintf(MSG_VERB1, "Sampling data blocks in %s...\n", argv[i]);
+        if (oper_save_sample(argv[i], &set)!=0)
+        {   errprintf("cannot read the contents of directory %s\n", argv[i]);
+            ret=-1;
+            goto oper_bench_cleanup;
+        }
+    }
+    if (bench_flush_pack(&set)!=0)
+    {   ret=-1;
+        goto oper_bench_cleanup;
+    }
+    if (set.count==0)
+    {   errprintf("no data found in the directories: there is nothing to measure\n");
+        ret=-1;
+        goto oper_bench_cleanup;
+    }
+    
+    for (i=0, samplebytes=0; i < set.count; i++)
+        samplebytes+=set.sizes[i];
+    
+    msgprintf(MSG_FORCE, "Benchmark of %d blocks (%s) sampled from %s of data using %d threads\n", set.count,
+        format_size(samplebytes, buffer1, sizeof(buffer1), 'h'), format_size(set.realbytes, buffer2, sizeof(buffer2), 'h'),
+        max(min(g_options.compressjobs, FSA_MAX_COMPJOBS), 1));
+    msgprintf(MSG_FORCE, "algo   level option    size   compression  decompression\n");
+    
+    // measure each algorithm and level
+    for (algo=bench_algos; (algo->compalgo!=COMPRESS_NULL) && (get_interrupted()==false); algo++)
+    {
+        algo->errors=0;
+        if ((count=bench_cut_blocks(&set, (g_options.longblksize>0)?(set.blksize):(algo->blksize), blocks, sizes, compbufs, decompbufs))<0)
+        {   ret=-1;
+            goto oper_bench_cleanup;
+        }
+        elapsed=bench_run_pass(blocks, sizes, count, algo, compbufs, compsizes, decompbufs, false);
+        algo->compspeed=(double)samplebytes/elapsed;
+        for (i=0, algo->compbytes=0, decompbytes=0; i < count; i++)
+        {   algo->compbytes+=compsizes[i];
+            if (compsizes[i] < sizes[i]) // the blocks stored without compression are not decompressed
+                decompbytes+=sizes[i];
+        }
+        elapsed=bench_run_pass(blocks, sizes, count, algo, compbufs, compsizes, decompbufs, true);
+        algo->decompspeed=(double)decompbytes/elapsed;
+        
+        msgprintf(MSG_FORCE, "%-6s %5d %-6s %6.1f%% %8.1f MB/s %9.1f MB/s%s\n", compalgostr(algo->compalgo), algo->complevel,
+            algo->option, (double)algo->compbytes*100.0/(double)samplebytes, algo->compspeed/(1024.0*1024.0),
+            algo->decompspeed/(1024.0*1024.0), (algo->errors>0)?" (errors)":"");
+        
+        // in verbose mode show what the contexts kept by the compression threads save for each block
+        if (g_options.verboselevel>0)
+        {
+            compsetup=bench_setup_cost(blocks, sizes, count, algo, compbufs, compsizes, decompbufs, false);
+            decompsetup=bench_setup_cost(blocks, sizes, count, algo, compbufs, compsizes, decompbufs, true);
+            msgprintf(MSG_VERB1, "%-20s setup of a new context for each block: %.0f us to compress, %.0f us to decompress\n", "",
+                compsetup*1000000.0, decompsetup*1000000.0);
+        }
+        
+        for (i=0; i < BENCH_MAXCHUNKS; i++)
+        {   free(compbufs[i]);
+            free(decompbufs[i]);
+            compbufs[i]=NULL;
+            decompbufs[i]=NULL;
+        }
+    }
+    
+    // recommend an option for the speed of the destination
+    msgprintf(MSG_FORCE, "\n");
+    for (i=0; bench_targets[i].name!=NULL; i++)
+    {
+        rate=(g_options.benchtarget>0)?g_options.benchtarget:bench_targets[i].rate;
+        if ((algo=bench_recommend(rate, samplebytes, &inputrate))!=NULL)
+            msgprintf(MSG_FORCE, "Destination writing %s/s (%s): use option %s to save about %.1f MB/s of data\n",
+                format_size(rate, buffer1, sizeof(buffer1), 'h'), (g_options.benchtarget>0)?"requested":bench_targets[i].name,
+                algo->option, inputrate/(1024.0*1024.0));
+        if (g_options.benchtarget>0)
+            break; // only the speed given on the command line
+    }
+    
+oper_bench_cleanup:
+    for (i=0; i < BENCH_MAXBLOCKS; i++)
+        free(set.blocks[i]);
+    for (i=0; i < BENCH_MAXCHUNKS; i++)
+    {   free(compbufs[i]);
+        free(decompbufs[i]);
+    }
+    free(set.packbuf);
+    return ret;
+}
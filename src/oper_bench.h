@@ -0,0 +1,44 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __OPER_BENCH_H__
+#define __OPER_BENCH_H__
+
+struct s_benchset;
+typedef struct s_benchset cbenchset;
+
+#define BENCH_MAXBLOCKS         64     // how many data blocks are used to measure each algorithm
+#define BENCH_MAXBYTES          (64LL*1024LL*1024LL) // limit for the total size of these blocks
+#define BENCH_MAXCHUNKS         (BENCH_MAXBLOCKS*4) // how many blocks there are when they are cut for an algorithm
+
+struct s_benchset // random sample of the data blocks of the directories read by the benchmark
+{   u8       *blocks[BENCH_MAXBLOCKS]; // contents of the blocks which have been selected
+    u32      sizes[BENCH_MAXBLOCKS]; // size of each block
+    int      count; // how many blocks there are in the sample
+    int      maxcount; // how many blocks can be kept with the size of the blocks
+    u64      seen; // how many blocks have been offered to the sample
+    u64      realbytes; // size of all the data which have been found
+    u8       *packbuf; // small files are packed together as in the archives
+    u32      packsize; // how many bytes there are in packbuf
+    u32      blksize; // size of the data blocks
+};
+
+int bench_add_file(cbenchset *set, char *fullpath, u64 filesize);
+int oper_bench(int argc, char **argv);
+
+#endif // __OPER_BENCH_H__
@@ -0,0 +1,598 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsarchiver.h"
+#include "oper_consolidate.h"
+#include "thread_archio.h"
+#include "thread_comp.h"
+#include "archinfo.h"
+#include "options.h"
+#include "common.h"
+#include "queue.h"
+#include "dico.h"
+#include "syncthread.h"
+#include "bufpool.h"
+#include "dedup.h"
+#include "error.h"
+
+// index in the table of the locations: the position is the most selective part of the key
+u32 consolidate_loc_hash(u8 source, u32 volume, u64 position)
+{
+    u64 hash=(position^((u64)volume<<40)^((u64)source<<56))*0x9E3779B97F4A7C15ULL;
+    return (u32)(hash>>32);
+}
+
+cconsolidloc *consolidate_loc_find(cconsolidate *c, u8 source, u32 volume, u64 position)
+{
+    cconsolidloc *loc;
+    u32 i;
+    
+    for (i=consolidate_loc_hash(source, volume, position)&(c->loccount-1); c->locs[i].source!=CONSOLIDATE_SRC_NULL; i=(i+1)&(c->loccount-1))
+    {
+        loc=&c->locs[i];
+        if ((loc->source==source) && (loc->volume==volume) && (loc->position==position))
+            return loc;
+    }
+    return NULL;
+}
+
+int consolidate_loc_add(cconsolidate *c, u8 source, u32 volume, u64 position, u32 newvolume, u64 newposition)
+{
+    cconsolidloc *oldlocs=c->locs;
+    u32 oldcount=c->loccount;
+    u32 i, j;
+    
+    // the table is doubled when it is half full so that the probe sequences remain short
+    if (c->locused+1 > c->loccount/2)
+    {
+        if ((c->locs=calloc(oldcount*2, sizeof(cconsolidloc)))==NULL)
+        {   errprintf("calloc(%ld) failed: out of memory\n", (long)(oldcount*2*sizeof(cconsolidloc)));
+            c->locs=oldlocs;
+            return -1;
+        }
+        c->loccount=oldcount*2;
+        for (i=0; i<oldcount; i++)
+        {
+            if (oldlocs[i].source==CONSOLIDATE_SRC_NULL)
+                continue;
+            for (j=consolidate_loc_hash(oldlocs[i].source, oldlocs[i].volume, oldlocs[i].position)&(c->loccount-1);
+                c->locs[j].source!=CONSOLIDATE_SRC_NULL; j=(j+1)&(c->loccount-1));
+            c->locs[j]=oldlocs[i];
+        }
+        free(oldlocs);
+    }
+    
+    for (i=consolidate_loc_hash(source, volume, position)&(c->loccount-1); c->locs[i].source!=CONSOLIDATE_SRC_NULL; i=(i+1)&(c->loccount-1))
+    {
+        if ((c->locs[i].source==source) && (c->locs[i].volume==volume) && (c->locs[i].position==position))
+            break;
+    }
+    if (c->locs[i].source==CONSOLIDATE_SRC_NULL)
+        c->locused++;
+    c->locs[i].source=source;
+    c->locs[i].volume=volume;
+    c->locs[i].position=position;
+    c->locs[i].newvolume=newvolume;
+    c->locs[i].newposition=newposition;
+    return 0;
+}
+
+// copy a dico without the keys of a section which are in skipkeys (the list ends with 0)
+cdico *consolidate_copy_dico(cdico *src, u8 section, const u16 *skipkeys)
+{
+    cdicoitem *item;
+    cdico *dst;
+    int i;
+    
+    if ((dst=dico_alloc())==NULL)
+    {   errprintf("dico_alloc() failed\n");
+        return NULL;
+    }
+    
+    for (item=src->head; item!=NULL; item=item->next)
+    {
+        for (i=0; (item->section==section) && (skipkeys[i]!=0) && (skipkeys[i]!=item->key); i++);
+        if ((item->section==section) && (skipkeys[i]!=0))
+            continue;
+        if (dico_add_generic(dst, item->section, item->key, item->data, item->size, item->type)!=0)
+        {   errprintf("dico_add_generic() failed\n");
+            dico_destroy(dst);
+            return NULL;
+        }
+    }
+    
+    return dst;
+}
+
+int consolidate_write_header(cconsolidate *c, char *magic, cdico *d, u16 fsid)
+{
+    struct s_headinfo headinfo;
+    int res;
+    
+    memset(&headinfo, 0, sizeof(headinfo));
+    memcpy(headinfo.magic, magic, FSA_SIZEOF_MAGIC);
+    headinfo.fsid=fsid;
+    headinfo.dico=d;
+    res=archwriter_dowrite_header(&c->wr, &headinfo);
+    dico_destroy(d);
+    if (res!=0)
+    {   msgprintf(MSG_STACK, "archwriter_dowrite_header() failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+// read the next header of an archive, the volumes are changed when their footer is found
+// returns 0 when a header has been read, 1 at the end of the archive, and -1 in case of error
+int consolidate_read_header(carchreader *ai, char *magic, cdico **d, u16 *fsid, u32 *volume, u64 *position)
+{
+    u32 endofarchive=false;
+    s64 curpos;
+    
+    while (true)
+    {
+        if ((curpos=lseek64(ai->archfd, 0, SEEK_CUR))<0)
+        {   sysprintf("lseek64() failed to get the current position in %s\n", ai->volpath);
+            return -1;
+        }
+        *volume=ai->curvol;
+        *position=curpos;
+        
+        if (archreader_read_header(ai, magic, d, false, fsid)!=FSAERR_SUCCESS)
+        {   errprintf("cannot read the header at position %lld in %s\n", (long long)curpos, ai->volpath);
+            if (*d!=NULL)
+                dico_destroy(*d);
+            return -1;
+        }
+        
+        if (memcmp(magic, FSA_MAGIC_VOLF, FSA_SIZEOF_MAGIC)!=0)
+            return 0;
+        
+        archreader_close(ai);
+        if (dico_get_u32(*d, 0, VOLUMEFOOTKEY_LASTVOL, &endofarchive)!=0)
+        {   errprintf("cannot get VOLUMEFOOTKEY_LASTVOL from the footer of %s\n", ai->volpath);
+            dico_destroy(*d);
+            return -1;
+        }
+        dico_destroy(*d);
+        *d=NULL;
+        if (endofarchive==true)
+            return 1;
+        
+        if ((archreader_incvolume(ai, false)!=0) || (archreader_open(ai)!=0) || (archreader_read_volheader(ai)!=0))
+        {   errprintf("cannot open volume %ld: %s\n", (long)ai->curvol, ai->volpath);
+            return -1;
+        }
+    }
+}
+
+// decrypt the block and encrypt it again with the key of the new archive and with its own offset
+int consolidate_recrypt_block(cconsolidate *c, struct s_blockinfo *blkinfo, u8 *key)
+{
+    u8 aad[FSA_AEAD_AADLEN];
+    u64 clearsize;
+    u64 cryptsize;
+    
+    crypt_block_aad(blkinfo, aad);
+    if ((crypto_aes256gcm_ctx(&c->cryptctx, blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)blkinfo->blkdata,
+        key, blkinfo->blkcryptnonce, aad, sizeof(aad), 0)!=0) || (clearsize!=blkinfo->blkcompsize))
+    {   errprintf("cannot decrypt the block at blockoffset=%ld: the block is corrupt or the password is wrong\n", (long)blkinfo->blkoffset);
+        return -1;
+    }
+    
+    blkinfo->blkdedup=BLKDEDUP_NONE;
+    crypto_nonce(blkinfo->blkcryptnonce, FSA_AEAD_NONCELEN);
+    crypt_block_aad(blkinfo, aad);
+    if (crypto_aes256gcm_ctx(&c->cryptctx, blkinfo->blkcompsize, &cryptsize, (u8*)blkinfo->blkdata, (u8*)blkinfo->blkdata,
+        g_options.encryptkey, blkinfo->blkcryptnonce, aad, sizeof(aad), 1)!=0)
+    {   errprintf("cannot encrypt the block at blockoffset=%ld\n", (long)blkinfo->blkoffset);
+        return -1;
+    }
+    blkinfo->blkarsize=cryptsize;
+    blkinfo->blkarcsum=0;
+    
+    return 0;
+}
+
+// write a block as it has been read: it is neither decompressed nor compressed again
+int consolidate_write_block(cconsolidate *c, u8 source, u32 volume, u64 position, struct s_blockinfo *blkinfo)
+{
+    int ret=-1;
+    
+    // the blocks of the base archive and the first copies read in place of a reference are authenticated with
+    // another key or another offset: they are the only ones which must be decrypted (but not decompressed)
+    if ((blkinfo->blkcryptalgo==ENCRYPT_AES256GCM) && ((source==CONSOLIDATE_SRC_BASE) || (blkinfo->blkdedup==BLKDEDUP_REF)) &&
+        (consolidate_recrypt_block(c, blkinfo, (source==CONSOLIDATE_SRC_BASE)?(g_options.basekey):(g_options.encryptkey))!=0))
+    {   msgprintf(MSG_STACK, "consolidate_recrypt_block() failed\n");
+        goto consolidate_write_block_end;
+    }
+    
+    if (archwriter_dowrite_block(&c->wr, blkinfo)!=0)
+    {   msgprintf(MSG_STACK, "archwriter_dowrite_block() failed\n");
+        goto consolidate_write_block_end;
+    }
+    
+    if (consolidate_loc_add(c, source, volume, position, c->wr.lastblkvol, c->wr.lastblkpos)!=0)
+    {   msgprintf(MSG_STACK, "consolidate_loc_add() failed\n");
+        goto consolidate_write_block_end;
+    }
+    
+    c->cnt_blocks++;
+    c->arbytes+=blkinfo->blkarsize;
+    ret=0;
+    
+consolidate_write_block_end:
+    bufpool_free(&g_bufpool, blkinfo->blkdata);
+    return ret;
+}
+
+// read a data block and copy it to the new archive
+int consolidate_copy_block(cconsolidate *c, u8 source, carchreader *ai, cdico *blkdico, u16 fsid, u32 volume, u64 position)
+{
+    struct s_blockinfo blkinfo;
+    int sumok;
+    
+    if (archreader_read_block(ai, blkdico, false, &sumok, &blkinfo)!=0)
+    {   msgprintf(MSG_STACK, "archreader_read_block() failed\n");
+        return -1;
+    }
+    if (sumok!=true)
+    {   errprintf("the block at position %lld in %s is corrupt\n", (long long)position, ai->volpath);
+        bufpool_free(&g_bufpool, blkinfo.blkdata);
+        return -1;
+    }
+    blkinfo.blkfsid=fsid;
+    return consolidate_write_block(c, source, volume, position, &blkinfo);
+}
+
+// a reference to a duplicate block is updated with the location of the first copy in the new archive, and the
+// first copy is read to write the block in full if it has not been copied (it belongs to a file which is not kept)
+int consolidate_copy_blockref(cconsolidate *c, u8 source, carchreader *ai, carchreader *refai, cdico *refdico, u16 fsid)
+{
+    const u16 skipkeys[]={BLOCKREFKEY_VOLUME, BLOCKREFKEY_POSITION, 0};
+    struct s_blockinfo blkinfo;
+    cconsolidloc *loc;
+    cdico *newdico;
+    u64 position;
+    u32 volume;
+    int sumok;
+    
+    if ((dico_get_u32(refdico, 0, BLOCKREFKEY_VOLUME, &volume)!=0) || (dico_get_u64(refdico, 0, BLOCKREFKEY_POSITION, &position)!=0))
+    {   errprintf("cannot get the location of the block from block-reference\n");
+        return -1;
+    }
+    
+    if ((loc=consolidate_loc_find(c, source, volume, position))!=NULL)
+    {
+        if (((newdico=consolidate_copy_dico(refdico, 0, skipkeys))==NULL) ||
+            (dico_add_u32(newdico, 0, BLOCKREFKEY_VOLUME, loc->newvolume)!=0) ||
+            (dico_add_u64(newdico, 0, BLOCKREFKEY_POSITION, loc->newposition)!=0))
+        {   errprintf("cannot prepare the block-reference\n");
+            if (newdico!=NULL)
+                dico_destroy(newdico);
+            return -1;
+        }
+        c->cnt_blockrefs++;
+        return consolidate_write_header(c, FSA_MAGIC_BREF, newdico, fsid);
+    }
+    
+    if (archreader_read_blockref(ai, refai, refdico, &sumok, &blkinfo)!=0)
+    {   msgprintf(MSG_STACK, "archreader_read_blockref() failed\n");
+        return -1;
+    }
+    if (sumok!=true)
+    {   errprintf("the block at position %lld in volume %ld is corrupt\n", (long long)position, (long)volume);
+        bufpool_free(&g_bufpool, blkinfo.blkdata);
+        return -1;
+    }
+    blkinfo.blkfsid=fsid;
+    return consolidate_write_block(c, source, volume, position, &blkinfo);
+}
+
+// copy the blocks and the footer of an unchanged file from the base archive
+int consolidate_copy_basefile(cconsolidate *c, u16 fsid, u32 volume, u64 position, u64 filesize)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    cdico *dico=NULL;
+    u64 basesize;
+    u64 hdrpos;
+    u32 hdrvol;
+    u16 basefsid;
+    int res;
+    
+    if ((c->baseai.archfd<0) || (c->baseai.curvol!=volume))
+    {
+        archreader_close(&c->baseai);
+        c->baseai.curvol=volume;
+        if ((archreader_volpath(&c->baseai)!=0) || (archreader_open(&c->baseai)!=0))
+        {   errprintf("cannot open volume %ld of the base archive\n", (long)volume);
+            return -1;
+        }
+    }
+    
+    if (lseek64(c->baseai.archfd, (off64_t)position, SEEK_SET)!=(off64_t)position)
+    {   sysprintf("lseek64(pos=%lld, SEEK_SET) failed in volume %s\n", (long long)position, c->baseai.volpath);
+        return -1;
+    }
+    
+    if ((archreader_read_header(&c->baseai, magic, &dico, false, &basefsid)!=FSAERR_SUCCESS) ||
+        (memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)!=0) ||
+        (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &basesize)!=0) || (basesize!=filesize))
+    {   errprintf("the file is not in the base archive at the location given: volume=%ld, position=%lld\n",
+            (long)volume, (long long)position);
+        if (dico!=NULL)
+            dico_destroy(dico);
+        return -1;
+    }
+    dico_destroy(dico);
+    
+    while ((res=consolidate_read_header(&c->baseai, magic, &dico, &basefsid, &hdrvol, &hdrpos))==0)
+    {
+        if (memcmp(magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0) // the footer has the checksum of the file
+            return consolidate_write_header(c, magic, dico, fsid);
+        
+        if (memcmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)==0)
+            res=consolidate_copy_block(c, CONSOLIDATE_SRC_BASE, &c->baseai, dico, fsid, hdrvol, hdrpos);
+        else if (memcmp(magic, FSA_MAGIC_BREF, FSA_SIZEOF_MAGIC)==0)
+            res=consolidate_copy_blockref(c, CONSOLIDATE_SRC_BASE, &c->baseai, &c->baserefai, dico, fsid);
+        else if (memcmp(magic, FSA_MAGIC_BLKZ, FSA_SIZEOF_MAGIC)==0) // a zero extent does not depend on its position
+        {   if (consolidate_write_header(c, magic, dico, fsid)!=0)
+                return -1;
+            continue;
+        }
+        else
+        {   errprintf("unexpected header in the base archive: found=[%.4s] where the data of a file were expected\n", magic);
+            res=-1;
+        }
+        dico_destroy(dico);
+        if (res!=0)
+            return -1;
+    }
+    
+    errprintf("the base archive ends before the end of a file\n");
+    return -1;
+}
+
+// write the main header of the new archive: it's the one of the incremental archive with a new archive-id
+int consolidate_write_mainhead(cconsolidate *c, cdico *mainhead)
+{
+    const u16 skipkeys[]={MAINHEADKEY_ARCHIVEID, MAINHEADKEY_BASEARCHID, MAINHEADKEY_MAXBLKSIZE, 0};
+    u32 maxblksize=max(c->ai.maxblksize, c->baseai.maxblksize);
+    cdico *d;
+    
+    if ((d=consolidate_copy_dico(mainhead, 0, skipkeys))==NULL)
+    {   msgprintf(MSG_STACK, "consolidate_copy_dico() failed\n");
+        return -1;
+    }
+    dico_add_u32(d, 0, MAINHEADKEY_ARCHIVEID, c->wr.archid);
+    if (maxblksize>FSA_MAX_BLKSIZE) // the blocks of the long mode are copied as they are
+        dico_add_u32(d, 0, MAINHEADKEY_MAXBLKSIZE, maxblksize);
+    
+    return consolidate_write_header(c, FSA_MAGIC_MAIN, d, FSA_FILESYSID_NULL);
+}
+
+int consolidate_copy_archive(cconsolidate *c)
+{
+    const u16 skipkeys[]={DISKITEMKEY_OBJTYPE, DISKITEMKEY_MD5SUM, DISKITEMKEY_BASEVOLUME, DISKITEMKEY_BASEPOSITION, 0};
+    char magic[FSA_SIZEOF_MAGIC];
+    cdico *newdico;
+    cdico *dico=NULL;
+    u32 basevolume;
+    u64 baseposition;
+    u64 filesize;
+    u32 objtype;
+    u64 position;
+    u32 volume;
+    u16 fsid;
+    int res;
+    
+    while ((res=consolidate_read_header(&c->ai, magic, &dico, &fsid, &volume, &position))==0)
+    {
+        if (get_interrupted()==true)
+        {   dico_destroy(dico);
+            return -1;
+        }
+        
+        if (memcmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)==0)
+        {
+            res=consolidate_copy_block(c, CONSOLIDATE_SRC_INCR, &c->ai, dico, fsid, volume, position);
+            dico_destroy(dico);
+        }
+        else if (memcmp(magic, FSA_MAGIC_BREF, FSA_SIZEOF_MAGIC)==0)
+        {
+            res=consolidate_copy_blockref(c, CONSOLIDATE_SRC_INCR, &c->ai, &c->refai, dico, fsid);
+            dico_destroy(dico);
+        }
+        else if ((memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0) &&
+            (dico_get_u32(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_OBJTYPE, &objtype)==0) && (objtype==OBJTYPE_UNCHANGED))
+        {
+            // the unchanged file becomes a normal file followed by the data copied from the base archive
+            c->cnt_objects++;
+            c->cnt_unchanged++;
+            if ((dico_get_u32(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEVOLUME, &basevolume)!=0) ||
+                (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEPOSITION, &baseposition)!=0) ||
+                (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &filesize)!=0) ||
+                ((newdico=consolidate_copy_dico(dico, DICO_OBJ_SECTION_STDATTR, skipkeys))==NULL))
+            {   errprintf("cannot get the location of an unchanged file in the base archive\n");
+                dico_destroy(dico);
+                return -1;
+            }
+            dico_destroy(dico);
+            dico_add_u32(newdico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_OBJTYPE, OBJTYPE_REGFILEUNIQUE);
+            if ((res=consolidate_write_header(c, magic, newdico, fsid))==0)
+                res=consolidate_copy_basefile(c, fsid, basevolume, baseposition, filesize);
+        }
+        else // other headers are written as they are
+        {
+            if (memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0)
+                c->cnt_objects++;
+            res=consolidate_write_header(c, magic, dico, fsid);
+        }
+        
+        if (res!=0)
+            return -1;
+    }
+    
+    return (res==1)?(0):(-1);
+}
+
+int oper_consolidate(char *archive, char *incremental)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    u8 salt[FSA_AEAD_SALTLEN];
+    char buffer[256];
+    cconsolidate c;
+    cdico *mainhead=NULL;
+    u32 basearchid;
+    u32 maxblksize;
+    u16 saltsize;
+    u16 fsid;
+    int ret=-1;
+    
+    // init
+    memset(&c, 0, sizeof(c));
+    archreader_init(&c.ai);
+    archreader_init(&c.refai);
+    archreader_init(&c.baseai);
+    archreader_init(&c.baserefai);
+    archwriter_init(&c.wr);
+    archwriter_generate_id(&c.wr);
+    cryptctx_init(&c.cryptctx);
+    
+    if ((c.locs=calloc(CONSOLIDATE_MINLOCS, sizeof(cconsolidloc)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)(CONSOLIDATE_MINLOCS*sizeof(cconsolidloc)));
+        goto oper_consolidate_end;
+    }
+    c.loccount=CONSOLIDATE_MINLOCS;
+    
+    // ---- open the incremental archive
+    path_force_extension(c.ai.basepath, PATH_MAX, incremental, ".fsa");
+    if ((archreader_volpath(&c.ai)!=0) || (archreader_open(&c.ai)!=0) || (archreader_read_volheader(&c.ai)!=0))
+    {   errprintf("cannot open the archive %s\n", c.ai.basepath);
+        goto oper_consolidate_end;
+    }
+    
+    if ((archreader_read_header(&c.ai, magic, &mainhead, false, &fsid)!=FSAERR_SUCCESS) ||
+        (memcmp(magic, FSA_MAGIC_MAIN, FSA_SIZEOF_MAGIC)!=0) ||
+        (dico_get_u32(mainhead, 0, MAINHEADKEY_ARCHIVEID, &c.ai.archid)!=0) ||
+        (dico_get_u32(mainhead, 0, MAINHEADKEY_ENCRYPTALGO, &c.ai.cryptalgo)!=0))
+    {   errprintf("cannot read the main header of the archive %s\n", c.ai.basepath);
+        goto oper_consolidate_end;
+    }
+    
+    if (dico_get_u32(mainhead, 0, MAINHEADKEY_BASEARCHID, &basearchid)!=0)
+    {   errprintf("%s is not an incremental archive: there is nothing to consolidate\n", c.ai.basepath);
+        goto oper_consolidate_end;
+    }
+    
+    if (dico_get_u32(mainhead, 0, MAINHEADKEY_MAXBLKSIZE, &maxblksize)==0)
+    {   c.ai.maxblksize=maxblksize;
+        bufpool_set_bufsize(&g_bufpool, BUFPOOL_BOUND(maxblksize));
+    }
+    
+    // ---- open its base archive (this also derives the key of the base archive)
+    if (thread_reader_openbase(&c.ai, &c.baseai, basearchid)!=0)
+    {   msgprintf(MSG_STACK, "thread_reader_openbase() failed\n");
+        goto oper_consolidate_end;
+    }
+    
+    // the blocks are copied with their encryption so both archives must have been encrypted in the same way
+    if (c.baseai.cryptalgo!=c.ai.cryptalgo)
+    {   errprintf("the archive and its base archive are not encrypted with the same algorithm: %s and %s\n",
+            cryptalgostr(c.ai.cryptalgo), cryptalgostr(c.baseai.cryptalgo));
+        goto oper_consolidate_end;
+    }
+    
+    // the blocks of the base archive are encrypted again with the key of the incremental archive
+    if (c.ai.cryptalgo==ENCRYPT_AES256GCM)
+    {
+        if (g_options.encryptalgo==ENCRYPT_NONE)
+        {   errprintf("these archives have been encrypted, you have to provide a password on the command line using option '-c'\n");
+            goto oper_consolidate_end;
+        }
+        if ((dico_get_data(mainhead, 0, MAINHEADKEY_CRYPTSALT, salt, FSA_AEAD_SALTLEN, &saltsize)!=0) || (saltsize!=FSA_AEAD_SALTLEN) ||
+            (crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_AEAD_SALTLEN,
+            g_options.encryptkey, FSA_AEAD_KEYLEN)!=0))
+        {   errprintf("cannot derive the key of the archive %s\n", c.ai.basepath);
+            goto oper_consolidate_end;
+        }
+    }
+    
+    // ---- create the new archive
+    path_force_extension(c.wr.basepath, PATH_MAX, archive, ".fsa");
+    if ((strcmp(c.wr.basepath, c.ai.basepath)==0) || (strcmp(c.wr.basepath, c.baseai.basepath)==0))
+    {   errprintf("the new archive cannot replace the archives which are consolidated\n");
+        goto oper_consolidate_end;
+    }
+    
+    if ((archwriter_volpath(&c.wr)!=0) || (archwriter_create(&c.wr)!=0) || (archwriter_write_volheader(&c.wr)!=0))
+    {   msgprintf(MSG_STACK, "cannot create the archive %s\n", c.wr.basepath);
+        goto oper_consolidate_end;
+    }
+    
+    if (consolidate_write_mainhead(&c, mainhead)!=0)
+    {   msgprintf(MSG_STACK, "consolidate_write_mainhead() failed\n");
+        goto oper_consolidate_remove;
+    }
+    
+    msgprintf(MSG_VERB1, "Consolidating %s and its base archive %s into %s...\n", c.ai.basepath, c.baseai.basepath, c.wr.basepath);
+    if (consolidate_copy_archive(&c)!=0)
+    {   msgprintf(MSG_STACK, "consolidate_copy_archive() failed\n");
+        goto oper_consolidate_remove;
+    }
+    
+    if (archwriter_write_volfooter(&c.wr, true)!=0)
+    {   msgprintf(MSG_STACK, "archwriter_write_volfooter() failed\n");
+        goto oper_consolidate_remove;
+    }
+    if (archwriter_close(&c.wr)!=0)
+    {   errprintf("cannot write the end of the archive %s\n", c.wr.volpath);
+        goto oper_consolidate_remove;
+    }
+    
+    msgprintf(MSG_FORCE, "Statistics for the consolidation\n");
+    msgprintf(MSG_FORCE, "* objects copied:..................objects=%lld, unchanged files from the base=%lld\n",
+        (long long)c.cnt_objects, (long long)c.cnt_unchanged);
+    msgprintf(MSG_FORCE, "* data copied without compression:..blocks=%lld, references=%lld, size=%s\n",
+        (long long)c.cnt_blocks, (long long)c.cnt_blockrefs, format_size(c.arbytes, buffer, sizeof(buffer), 'h'));
+    ret=0;
+    goto oper_consolidate_end;
+    
+oper_consolidate_remove:
+    archwriter_remove(&c.wr);
+    
+oper_consolidate_end:
+    if (mainhead!=NULL)
+        dico_destroy(mainhead);
+    archreader_close(&c.ai);
+    archreader_close(&c.refai);
+    archreader_close(&c.baseai);
+    archreader_close(&c.baserefai);
+    archwriter_destroy(&c.wr);
+    cryptctx_destroy(&c.cryptctx);
+    free(c.locs);
+    return ret;
+}
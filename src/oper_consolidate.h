@@ -0,0 +1,63 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __OPER_CONSOLIDATE_H__
+#define __OPER_CONSOLIDATE_H__
+
+#include "archreader.h"
+#include "archwriter.h"
+#include "crypto.h"
+
+struct s_consolidloc;
+typedef struct s_consolidloc cconsolidloc;
+
+struct s_consolidate;
+typedef struct s_consolidate cconsolidate;
+
+#define CONSOLIDATE_MINLOCS     65536  // initial number of slots in the table of the locations (must be a power of two)
+
+enum {CONSOLIDATE_SRC_NULL=0, CONSOLIDATE_SRC_INCR, CONSOLIDATE_SRC_BASE};
+
+struct s_consolidloc // where a block which has been copied was in its archive and where it is in the new one
+{   u8           source; // CONSOLIDATE_SRC_INCR or CONSOLIDATE_SRC_BASE (CONSOLIDATE_SRC_NULL for a free slot)
+    u32          volume; // volume of the block in its archive
+    u64          position; // position of the block header in that volume
+    u32          newvolume; // volume of the block in the new archive
+    u64          newposition; // position of the block header in that volume
+};
+
+struct s_consolidate
+{   carchreader  ai; // incremental archive
+    carchreader  refai; // incremental archive: reader for the blocks of the references
+    carchreader  baseai; // base archive of the incremental archive
+    carchreader  baserefai; // base archive: reader for the blocks of the references
+    carchwriter  wr; // new archive
+    ccryptctx    cryptctx; // used to encrypt the blocks of the base archive again with the key of the new archive
+    cconsolidloc *locs; // locations of the blocks copied, used to update the references to the duplicate blocks
+    u32          loccount; // number of slots in locs (power of two)
+    u32          locused; // number of slots used
+    u64          cnt_objects; // objects copied from the incremental archive
+    u64          cnt_unchanged; // files which have their data copied from the base archive
+    u64          cnt_blocks; // data blocks copied
+    u64          cnt_blockrefs; // references to duplicate blocks copied
+    u64          arbytes; // size of the data blocks copied as they are in the archives
+};
+
+int oper_consolidate(char *archive, char *incremental);
+
+#endif // __OPER_CONSOLIDATE_H__
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <gcrypt.h>
 #include <uuid.h>
 
@@ -55,6 +56,7 @@
 #include "error.h"
 #include "datafile.h"
 #include "queue.h"
+#include "bufpool.h"
 
 typedef struct s_extractar
 {   carchreader ai;
@@ -482,6 +484,164 @@ extractar_restore_obj_hardlink_err:
     return 0; // non fatal error
 }
 
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int) // share the extents of a file (btrfs, xfs): not defined by older headers
+#endif
+
+// copy the contents of a file restored before: the extents are shared when the filesystem supports
+// reflinks, else the data is copied by the kernel, else it is read and written again
+int extractar_copy_file_data(int fdsrc, int fddst, u64 size)
+{
+    char buffer[65536];
+    u64 done=0;
+    long res;
+    
+    if (ioctl(fddst, FICLONE, fdsrc)==0)
+        return 0;
+    
+#ifdef HAVE_COPY_FILE_RANGE
+    while ((done < size) && ((res=copy_file_range(fdsrc, NULL, fddst, NULL, size-done, 0))>0))
+        done+=res;
+    if (done==size)
+        return 0;
+#endif // HAVE_COPY_FILE_RANGE
+    
+    // the data which has been copied is kept: continue from the same offset
+    while ((done < size) && ((res=pread(fdsrc, buffer, min(sizeof(buffer), size-done), done))>0))
+    {   if (pwrite(fddst, buffer, res, done)!=res)
+            return -1;
+        done+=res;
+    }
+    return (done==size)?(0):(-1);
+}
+
+// md5 of the contents of a file restored before, to check that it is the file which has been archived
+int extractar_md5_file_data(int fd, u64 size, u8 *md5sum)
+{
+    char buffer[65536];
+    gcry_md_hd_t ctx;
+    u64 done=0;
+    long res;
+    
+    if (gcry_md_open(&ctx, GCRY_MD_MD5, 0)!=GPG_ERR_NO_ERROR)
+    {   errprintf("gcry_md_open() failed\n");
+        return -1;
+    }
+    while ((done < size) && ((res=pread(fd, buffer, min(sizeof(buffer), size-done), done))>0))
+    {   gcry_md_write(ctx, buffer, res);
+        done+=res;
+    }
+    if (done==size)
+        memcpy(md5sum, gcry_md_read(ctx, GCRY_MD_MD5), 16);
+    gcry_md_close(ctx);
+    return (done==size)?(0):(-1);
+}
+
+int extractar_restore_obj_dupfile(cextractar *exar, char *fullpath, char *relpath, char *destdir, cdico *d, int objtype, int fstype)
+{
+    char parentdir[PATH_MAX];
+    char srcfile[PATH_MAX];
+    char buffer[PATH_MAX];
+    struct timeval tv[2];
+    struct stat64 st;
+    u8 md5sumorig[16];
+    u8 md5sumcalc[16];
+    u64 filesize;
+    int fdsrc=-1;
+    int fddst=-1;
+    
+    // update cost statistics and progress bar
+    exar->cost_current+=FSA_COST_PER_FILE;
+    if (dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &filesize)==0)
+        exar->cost_current+=filesize;
+    
+    // check the list of excluded files/dirs
+    if (is_filedir_excluded(relpath)==true)
+    {   dico_destroy(d);
+        return 0;
+    }
+    
+    // create parent directory first
+    extract_dirpath(fullpath, parentdir, sizeof(parentdir));
+    mkdir_recursive(parentdir);
+    
+    // backup parent dir atime/mtime
+    get_parent_dir_time_attrib(fullpath, parentdir, sizeof(parentdir), tv);
+    
+    // update progress bar
+    extractar_listing_print_file(exar, objtype, relpath);
+    
+    if (dico_get_string(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DUPFILE, buffer, PATH_MAX)<0)
+    {   msgprintf(MSG_STACK, "dico_get_string(DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DUPFILE) failed\n");
+        goto extractar_restore_obj_dupfile_err;
+    }
+    if (dico_get_data(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, md5sumorig, 16, NULL)!=0)
+    {   errprintf("cannot get md5sum of the contents of file=[%s]\n", relpath);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    // the first copy has been restored before as it comes first in the archive, unless it is excluded
+    if (is_filedir_excluded(buffer)==true)
+    {   errprintf("cannot restore file [%s]: its contents are stored in the file [%s] which is excluded\n", relpath, buffer);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    concatenate_paths(srcfile, PATH_MAX, destdir, buffer);
+    if (((fdsrc=open64(srcfile, O_RDONLY|O_LARGEFILE))<0) || (fstat64(fdsrc, &st)!=0) || ((u64)st.st_size!=filesize))
+    {   errprintf("cannot restore file [%s]: the file [%s] which has the same contents has not been restored\n", relpath, buffer);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    // the first copy may have failed to be restored or have been replaced since then
+    if ((extractar_md5_file_data(fdsrc, filesize, md5sumcalc)!=0) || (memcmp(md5sumcalc, md5sumorig, 16)!=0))
+    {   errprintf("cannot restore file [%s]: the file [%s] does not have the contents which have been archived\n", relpath, buffer);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    if ((fddst=open64(fullpath, O_RDWR|O_CREAT|O_TRUNC|O_LARGEFILE, 0600))<0)
+    {   sysprintf("cannot create file %s\n", fullpath);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    if (extractar_copy_file_data(fdsrc, fddst, filesize)!=0)
+    {   sysprintf("cannot copy the contents of [%s] to [%s]\n", srcfile, fullpath);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    close(fdsrc);
+    fdsrc=-1;
+    if (close(fddst)!=0)
+    {   sysprintf("cannot close file %s\n", fullpath);
+        fddst=-1;
+        goto extractar_restore_obj_dupfile_err;
+    }
+    fddst=-1;
+    
+    if (extractar_restore_attr_everything(exar, objtype, fullpath, relpath, d)!=0)
+    {   msgprintf(MSG_STACK, "cannot restore file attributes for file [%s]\n", relpath);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    // restore parent dir mtime/atime
+    if (utimes(parentdir, tv)!=0)
+    {   sysprintf("utimes(%s) failed\n", parentdir);
+        goto extractar_restore_obj_dupfile_err;
+    }
+    
+    dico_destroy(d);
+    exar->stats.cnt_regfile++;
+    exar->stats.cnt_dupfile++;
+    exar->stats.dupfilebytes+=filesize;
+    return 0; // success
+    
+extractar_restore_obj_dupfile_err:
+    if (fdsrc>=0)
+        close(fdsrc);
+    if (fddst>=0)
+        close(fddst);
+    dico_destroy(d);
+    exar->stats.err_regfile++;
+    return 0; // non fatal error
+}
+
 int extractar_restore_obj_devfile(cextractar *exar, char *fullpath, char *relpath, char *destdir, cdico *d, int objtype, int fstype)
 {
     char parentdir[PATH_MAX];
@@ -646,7 +806,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
     {   errprintf("regmulti_rest_setdatablock() failed\n");
         return -1;
     }
-    free(blkinfo.blkdata); // free memory allocated by the thread_io_reader
+    bufpool_free(&g_bufpool, blkinfo.blkdata); // free memory allocated by the thread_io_reader
     
     // ---- create the set of small files using the regmulti structure
     for (i=0; i < filescount; i++)
@@ -769,6 +929,7 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     }
     
     sparse=((dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE));
+    sparse=((sparse==true) || (g_options.sparseall==true));
     
     // update cost statistics and progress bar
     exar->cost_current+=FSA_COST_PER_FILE; 
@@ -808,21 +969,22 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
         if (blkinfo.blkoffset!=filepos)
         {   errprintf("file offset do not match for file(%s) failed: filepos=%lld, blkinfo.blkoffset=%lld, blkinfo.blkrealsize=%lld\n", 
                 relpath, (long long)filepos, (long long)blkinfo.blkoffset, (long long)blkinfo.blkrealsize);
-            free(blkinfo.blkdata);
+            bufpool_free(&g_bufpool, blkinfo.blkdata);
             delfile=true;
             minorerr=true;
             break;
         }
         
-        if (datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize)!=FSAERR_SUCCESS)
-        {   free(blkinfo.blkdata);
+        if (((blkinfo.blkzero==true) && (datafile_write_zeros(datafile, blkinfo.blkrealsize)!=FSAERR_SUCCESS)) ||
+            ((blkinfo.blkzero==false) && (datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize)!=FSAERR_SUCCESS)))
+        {   bufpool_free(&g_bufpool, blkinfo.blkdata);
             delfile=true;
             minorerr=true;
             fatalerr=true;
             break;
         }
         
-        free(blkinfo.blkdata);
+        bufpool_free(&g_bufpool, blkinfo.blkdata);
     }
     
     if ((minorerr==false) && (datafile_close(datafile, md5sumcalc, sizeof(md5sumcalc))!=0))
@@ -931,6 +1093,10 @@ int extractar_restore_object(cextractar *exar, int *errors, char *destdir, cdico
             msgprintf(MSG_DEBUG2, "objtype=OBJTYPE_HARDLINK, path=[%s]\n", relpath);
             res=extractar_restore_obj_hardlink(exar, fullpath, relpath, destdir, dicoattr, objtype, fstype);
             break;
+        case OBJTYPE_DUPFILE:
+            msgprintf(MSG_DEBUG2, "objtype=OBJTYPE_DUPFILE, path=[%s]\n", relpath);
+            res=extractar_restore_obj_dupfile(exar, fullpath, relpath, destdir, dicoattr, objtype, fstype);
+            break;
         case OBJTYPE_CHARDEV:
             msgprintf(MSG_DEBUG2, "objtype=OBJTYPE_CHARDEV, path=[%s]\n", relpath);
             res=extractar_restore_obj_devfile(exar, fullpath, relpath, destdir, dicoattr, objtype, fstype);
@@ -954,6 +1120,13 @@ int extractar_restore_object(cextractar *exar, int *errors, char *destdir, cdico
                 return -1;
             }
             break;
+        case OBJTYPE_UNCHANGED: // the reader thread queues the data of the file from the base archive
+            msgprintf(MSG_DEBUG2, "objtype=OBJTYPE_UNCHANGED, path=[%s]\n", relpath);
+            if ((res=extractar_restore_obj_regfile_unique(exar, fullpath, relpath, destdir, dicoattr, objtype, fstype))<0)
+            {   msgprintf(MSG_STACK, "restore_obj_regfile_unique(%s) failed with res=%d\n", relpath, res);
+                return -1;
+            }
+            break;
         case OBJTYPE_REGFILEMULTI:
             msgprintf(MSG_DEBUG2, "objtype=OBJTYPE_REGFILEMULTI, path=[%s]\n", relpath);
             if ((res=extractar_restore_obj_regfile_multi(exar, destdir, dicoattr, objtype, fstype))<0)
@@ -1042,7 +1215,7 @@ int extractar_extract_read_objects(cextractar *exar, int *errors, char *destdir,
 int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
 {
     u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckcrypt[FSA_AEAD_NONCELEN+FSA_CHECKPASSBUF_SIZE+FSA_AEAD_TAGLEN];
     char magic[FSA_SIZEOF_MAGIC+1];
     u16 cryptbufsize;
     u8 md5sumar[16];
@@ -1135,6 +1308,10 @@ int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
         return -1;
     }
     
+    // incremental archives only have the files which changed since their base archive
+    if (dico_get_u32(*dicomainhead, 0, MAINHEADKEY_BASEARCHID, &exar->ai.basearchid)!=0)
+        exar->ai.basearchid=0;
+    
     // read minimum fsarchiver version requirement
     if (dico_get_u64(*dicomainhead, 0, MAINHEADKEY_MINFSAVERSION, &exar->ai.minfsaver)!=0)
         exar->ai.minfsaver=FSA_VERSION_BUILD(0, 0, 0, 0); // not defined
@@ -1159,8 +1336,21 @@ int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
             return -1;
         }
         
-        if (crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, strlen((char*)g_options.encryptpass), false)==0)
-            gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+        switch (exar->ai.cryptalgo)
+        {
+            case ENCRYPT_BLOWFISH:
+                if (crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, strlen((char*)g_options.encryptpass), false)==0)
+                    gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+                break;
+            case ENCRYPT_AES256GCM: // the key has been derived by the reader thread, the test buffer is nonce+ciphertext+tag
+                if ((cryptbufsize>FSA_AEAD_NONCELEN) && crypto_aes256gcm(cryptbufsize-FSA_AEAD_NONCELEN, &clearsize, bufcheckcrypt+FSA_AEAD_NONCELEN,
+                    bufcheckclear, g_options.encryptkey, bufcheckcrypt, NULL, 0, false)==0)
+                    gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
+                break;
+            default:
+                errprintf("unsupported encryption algorithm: %d\n", (int)exar->ai.cryptalgo);
+                return -1;
+        }
         
         if (memcmp(md5sumar, md5sumnew, 16)!=0)
         {   errprintf("you have to provide the password which was used to create archive, cannot decrypt the test buffer.\n");
@@ -1403,6 +1593,9 @@ int oper_restore(char *archive, int argc, char **argv, int oper)
             break;
     }
 
+    // the size of the blocks is only known when they are read: use the largest size possible
+    bufpool_set_bufsize(&g_bufpool, BUFPOOL_BOUND(FSA_MAX_BLKSIZE));
+    
     // create decompression threads
     for (i=0; (i<g_options.compressjobs) && (i<FSA_MAX_COMPJOBS); i++)
     {
@@ -1521,7 +1714,7 @@ int oper_restore(char *archive, int argc, char **argv, int oper)
     
     if ((oper==OPER_RESTFS) || (oper==OPER_RESTDIR))
     {
-        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
+        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
         {   errprintf("this archive has been encrypted, you have to provide a password on the command line using option '-c'\n");
             goto do_extract_error;
         }
@@ -1598,10 +1791,7 @@ do_extract_success:
     msgprintf(MSG_DEBUG1, "THREAD-MAIN2: exit\n");
     set_stopfillqueue(); // ask thread-archio to terminate
     msgprintf(MSG_DEBUG2, "queue_count_items_todo(&g_queue)=%d\n", (int)queue_count_items_todo(&g_queue));
-    while (queue_count_items_todo(&g_queue)>0) // let thread_compress process all the pending blocks
-    {   msgprintf(MSG_DEBUG2, "queue_count_items_todo(): %ld\n", (long)queue_count_items_todo(&g_queue));
-        usleep(10000);
-    }
+    queue_wait_items_todo(&g_queue); // let thread_compress process all the pending blocks
     msgprintf(MSG_DEBUG2, "queue_count_items_todo(&g_queue)=%d\n", (int)queue_count_items_todo(&g_queue));
     // now we are sure that thread_compress is not working on an item in the queue so we can empty the queue
     while (get_secthreads()>0 && queue_get_end_of_queue(&g_queue)==false)
@@ -1616,6 +1806,9 @@ do_extract_success:
     if (thread_reader && pthread_join(thread_reader, NULL) != 0)
         errprintf("pthread_join(thread_reader) failed\n");
     
+    queue_show_stats(&g_queue);
+    bufpool_show_stats(&g_bufpool);
+    
     for (i=0; i<FSA_MAX_FSPERARCH; i++)
         if (dicoargv[i]!=NULL)
             strdico_destroy(dicoargv[i]);
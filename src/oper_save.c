@@ -39,6 +39,7 @@
 #include "fsarchiver.h"
 #include "dico.h"
 #include "dichl.h"
+#include "dupfile.h"
 #include "archwriter.h"
 #include "options.h"
 #include "common.h"
@@ -59,6 +60,13 @@
 #include "crypto.h"
 #include "error.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "entropy.h"
+#include "zstddict.h"
+#include "adaptlevel.h"
+#include "oper_bench.h"
+#include "dedup.h"
+#include "catalog.h"
 
 #ifndef ENOATTR
 #define ENOATTR ENODATA
@@ -68,12 +76,17 @@ typedef struct s_savear
 {   carchwriter ai;
     cregmulti   regmulti;
     cdichl      *dichardlinks;
+    cdupfile    *dupfiles; // regular files which can be referenced by identical files (NULL when disabled)
+    u64         regmultigen; // number of the current shared block of small files
+    ccatalog    *catalog; // files of the base archive of an incremental archive (NULL when disabled)
     cstats      stats;
     int         fstype;
     int         fsid;
     u64         objectid;
     u64         cost_global;
     u64         cost_current;
+    czstdsampler *sampler; // small files used to train a zstd dictionary (NULL when disabled)
+    cbenchset   *benchset; // data blocks sampled by the benchmark (NULL when not running a benchmark)
 } csavear;
 
 typedef struct s_devinfo
@@ -86,6 +99,10 @@ typedef struct s_devinfo
 int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize)
 {
     char databuf[FSA_MAX_SMALLFILESIZE];
+    u8 hash[DUPFILE_HASHLEN];
+    int policyrule;
+    int complevel;
+    u16 compalgo;
     u8 md5sum[16];
     int ret=0;
     int res;
@@ -118,8 +135,14 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
     gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, databuf, filesize);
     dico_add_data(header, 0, DISKITEMKEY_MD5SUM, md5sum, 16);
     
-    // if shared-block with many small files is full, push it to queue and make a new one
-    if (regmulti_save_enough_space_for_new_file(&save->regmulti, filesize)==false)
+    // select the compression algorithm of the file: it is shared by all the small files of the block
+    compalgo=COMPRESS_NULL;
+    complevel=0;
+    policyrule=comppolicy_select(&g_options.comppolicy, relpath, (u8*)databuf, filesize, filesize, &compalgo, &complevel);
+    
+    // if shared-block with many small files is full or uses another compression policy, push it to queue and make a new one
+    if ((regmulti_save_enough_space_for_new_file(&save->regmulti, filesize)==false) ||
+        (regmulti_save_same_policy(&save->regmulti, policyrule)==false))
     {
         if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
         {   errprintf("Cannot queue last block of small-files\n");
@@ -127,17 +150,88 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
         }
         
         regmulti_empty(&save->regmulti);
+        save->regmultigen++;
     }
     
     // copy current small file to the shared-block
+    regmulti_save_set_policy(&save->regmulti, policyrule, compalgo, complevel);
     if (regmulti_save_addfile(&save->regmulti, header, databuf, filesize)!=0)
     {   errprintf("Cannot add small-file %s to regmulti structure\n", relpath);
         return -1;
     }
     
+    // the next identical files can reference this one now that its data is in the current shared block
+    if ((ret==0) && (save->dupfiles!=NULL) && (filesize>=DUPFILE_MINSIZE))
+    {   gcry_md_hash_buffer(GCRY_MD_SHA256, hash, databuf, filesize);
+        dupfile_add(save->dupfiles, relpath, filesize, save->regmultigen, hash, md5sum);
+    }
+    
     return ret;
 }
 
+// find where the next data extent of a sparse file starts and where it ends, so that the holes are not read
+// returns -1 if the filesystem cannot tell where the holes are (SEEK_DATA and SEEK_HOLE are not supported)
+int createar_regfile_nextdata(int fd, u64 filepos, u64 filesize, u64 *datastart, u64 *dataend)
+{
+    off64_t start;
+    off64_t end;
+    
+    errno=0;
+    if ((start=lseek64(fd, (off64_t)filepos, SEEK_DATA))<0)
+    {   if (errno!=ENXIO)
+            return -1;
+        start=filesize; // there is only a hole until the end of the file
+    }
+    start=min((u64)start, filesize);
+    
+    if ((u64)start>=filesize)
+        end=filesize;
+    else if ((end=lseek64(fd, start, SEEK_HOLE))<0)
+        return -1;
+    end=min((u64)end, filesize);
+    if (end<=start) // the file has been modified: read the rest of it
+        end=filesize;
+    
+    if (lseek64(fd, start, SEEK_SET)!=start)
+        return -1;
+    
+    *datastart=start;
+    *dataend=end;
+    return 0;
+}
+
+// queue the zero extents which replace the data blocks of a hole, the zeros are still part of the md5 of the file
+int createar_regfile_zeroextents(csavear *save, gcry_md_hd_t md5ctx, char *relpath, u64 offset, u64 size)
+{
+    static char zeros[65536];
+    struct s_blockinfo blkinfo;
+    u64 curlen;
+    u64 pos;
+    
+    for (pos=0; pos<size; pos+=curlen)
+    {
+        curlen=min(size-pos, FSA_MAX_ZEROEXTENT);
+        memset(&blkinfo, 0, sizeof(blkinfo));
+        blkinfo.blkdata=NULL;
+        blkinfo.blkrealsize=curlen;
+        blkinfo.blkoffset=offset+pos;
+        blkinfo.blkfsid=save->fsid;
+        blkinfo.blkzero=true;
+        if (queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_DONE)!=0) // nothing to compress
+        {   sysprintf("queue_add_block(%s) failed\n", relpath);
+            return -1;
+        }
+    }
+    
+    for (pos=0; pos<size; pos+=curlen)
+    {
+        curlen=min(size-pos, sizeof(zeros));
+        gcry_md_write(md5ctx, zeros, curlen);
+    }
+    
+    return 0;
+}
+
 int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize) // large or empty files
 {
     cdico *footerdico=NULL;
@@ -150,7 +244,18 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
     u8 *origblock;
     u8 *md5tmp;
     u8 md5sum[16];
+    u8 hash[DUPFILE_HASHLEN];
+    bool dupindex;
     u64 filepos;
+    u64 datastart=0;
+    u64 dataend=0;
+    bool zeroextents;
+    bool sparse;
+    bool firstblock=true;
+    u64 flags;
+    int failcount=0;
+    int complevel=0;
+    u16 compalgo=COMPRESS_NULL;
     int ret=0;
     int res;
     int fd;
@@ -160,29 +265,74 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         return -1;
     }
     
+    // the digest used to find the identical files is computed from the data which is archived
+    dupindex=((save->dupfiles!=NULL) && (filesize>=DUPFILE_MINSIZE));
+    if ((dupindex==true) && (gcry_md_enable(md5ctx, GCRY_MD_SHA256)!=GPG_ERR_NO_ERROR))
+    {   errprintf("gcry_md_enable() failed\n");
+        dupindex=false;
+    }
+    
     if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
     {   sysprintf("Cannot open %s for reading\n", relpath);
         return -1;
     }
     
+    // the holes of a sparse file are found with SEEK_DATA and SEEK_HOLE instead of reading their zeros
+    sparse=((dico_get_u64(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE));
+    // older versions cannot read zero extents: the holes are stored as data blocks full of zeros unless --zero-extents is used
+    zeroextents=g_options.zeroextents;
+    
     // write header with file attributes (only if open64() works)
     queue_add_header(&g_queue, header, FSA_MAGIC_OBJT, save->fsid);
     
     msgprintf(MSG_DEBUG1, "backup_obj_regfile_unique(file=%s, size=%lld)\n", relpath, (long long)filesize);
     for (filepos=0; (filesize>0) && (filepos < filesize) && (get_interrupted()==false); filepos+=curblocksize)
     {
-        remaining=filesize-filepos;
+        // a hole is replaced with zero extents when possible and the blocks stop at the end of the data extent
+        if ((sparse==true) && (eof==false) && (filepos>=dataend))
+        {
+            if (createar_regfile_nextdata(fd, filepos, filesize, &datastart, &dataend)!=0)
+            {   msgprintf(MSG_DEBUG1, "cannot find the holes of file=%s: the whole file is read\n", relpath);
+                if (lseek64(fd, (off64_t)filepos, SEEK_SET)!=(off64_t)filepos)
+                {   sysprintf("Cannot seek in %s at offset %lld\n", relpath, (long long)filepos);
+                    ret=-1;
+                    goto backup_obj_regfile_unique_error;
+                }
+                sparse=false;
+                dataend=filesize;
+            }
+            else if ((datastart>filepos) && (zeroextents==true))
+            {
+                msgprintf(MSG_DEBUG2, "----> file=%s has a hole at filepos=%lld, size=%lld\n", relpath, (long long)filepos, (long long)(datastart-filepos));
+                if (createar_regfile_zeroextents(save, md5ctx, relpath, filepos, datastart-filepos)!=0)
+                {   ret=-1;
+                    goto backup_obj_regfile_unique_error;
+                }
+                filepos=datastart;
+                if (filepos>=filesize)
+                    break;
+            }
+        }
+        
+        if ((sparse==true) && (filepos<datastart)) // the blocks of zeros stop at the end of the hole
+            remaining=datastart-filepos;
+        else
+            remaining=(((sparse==true) && (eof==false))?(dataend):(filesize))-filepos;
         curblocksize=min(remaining, g_options.datablocksize);
         msgprintf(MSG_DEBUG2, "----> filepos=%lld, remaining=%lld, curblocksize=%lld\n", (long long)filepos, (long long)remaining, (long long)curblocksize);
         
-        origblock=malloc(curblocksize);
+        origblock=bufpool_alloc(&g_bufpool, curblocksize);
         if (!origblock)
-        {   errprintf("malloc(%ld) failed: cannot allocate data block\n", (long)origblock);
+        {   errprintf("bufpool_alloc(%ld) failed: cannot allocate data block\n", (long)curblocksize);
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
         
-        if (eof==false) // file has not been truncated: read the next block
+        if ((sparse==true) && (filepos<datastart)) // hole of a sparse file: the zeros are not read
+        {
+            memset(origblock, 0, curblocksize);
+        }
+        else if (eof==false) // file has not been truncated: read the next block
         {
             if ((res=read(fd, origblock, (long)curblocksize))!=curblocksize)
             {   ret=-1;
@@ -194,6 +344,7 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
                 }
                 else if (res<0) // read error
                 {   sysprintf("Cannot read data block from %s, block=%ld and res=%ld\n", relpath, (long)curblocksize, (long)res);
+                    bufpool_free(&g_bufpool, origblock);
                     ret=-1;
                     goto backup_obj_regfile_unique_error;
                 }
@@ -206,14 +357,44 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         
         gcry_md_write(md5ctx, origblock, curblocksize);
         
+        // the compression policy is selected using the name, the size and the first bytes of the file
+        if ((firstblock==true) && (comppolicy_select(&g_options.comppolicy, relpath, origblock, curblocksize, filesize, &compalgo, &complevel)>=0))
+            msgprintf(MSG_DEBUG1, "file=%s is compressed with algo=%d level=%d by the compression policy\n", relpath, (int)compalgo, complevel);
+        firstblock=false;
+        
         // add block to the queue
         memset(&blkinfo, 0, sizeof(blkinfo));
         blkinfo.blkrealsize=curblocksize;
         blkinfo.blkdata=(char*)origblock;
         blkinfo.blkoffset=filepos;
         blkinfo.blkfsid=save->fsid;
+        
+        // a block identical to a block already archived is replaced with a reference to the first copy
+        if ((dedup_enabled(&g_dedup)==true) && (curblocksize>=DEDUP_MINBLKSIZE))
+        {
+            dedup_hash_block(blkinfo.blkhash, origblock, curblocksize);
+            if ((blkinfo.blkdedup=dedup_lookup(&g_dedup, blkinfo.blkhash, curblocksize))==BLKDEDUP_REF)
+            {
+                bufpool_free(&g_bufpool, origblock);
+                blkinfo.blkdata=NULL;
+                if (queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_DONE)!=0) // nothing to compress
+                {   sysprintf("queue_add_block(%s) failed\n", relpath);
+                    ret=-1;
+                    goto backup_obj_regfile_unique_error;
+                }
+                continue;
+            }
+        }
+        
+        blkinfo.blkreqalgo=compalgo;
+        blkinfo.blkreqlevel=complevel;
+        if (compalgo==COMPRESS_NONE) // the compression policy says the data must not be compressed
+            blkinfo.blknocomp=true;
+        else
+            blkinfo.blknocomp=entropy_check_block(&g_entropy, origblock, curblocksize, &failcount);
         if (queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_TODO)!=0)
         {   sysprintf("queue_add_block(%s) failed\n", relpath);
+            bufpool_free(&g_bufpool, origblock);
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
@@ -232,6 +413,8 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         goto backup_obj_regfile_unique_error;
     }
     memcpy(md5sum, md5tmp, 16);
+    if (dupindex==true)
+        memcpy(hash, gcry_md_read(md5ctx, GCRY_MD_SHA256), DUPFILE_HASHLEN);
     gcry_md_close(md5ctx);
     
     msgprintf(MSG_DEBUG1, "--> finished loop for file=%s, size=%lld, md5=[%s]\n", relpath, (long long)filesize, format_md5(text, sizeof(text), md5sum));
@@ -253,6 +436,10 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
         }
     }
     
+    // the next identical files can reference this one only if its contents have been archived completely
+    if ((ret==0) && (dupindex==true))
+        dupfile_add(save->dupfiles, relpath, filesize, 0, hash, md5sum);
+    
 backup_obj_regfile_unique_error:
     close(fd);
     return ret;
@@ -407,6 +594,9 @@ int createar_item_stdattr(csavear *save, char *root, char *relpath, struct stat6
     char buffer2[PATH_MAX];
     char directory[PATH_MAX];
     char *linktarget=NULL;
+    ccatalogentry *entry;
+    u8 md5sum[16];
+    u64 dupgroup;
     u64 flags;
     int res;
     int i;
@@ -540,11 +730,45 @@ int createar_item_stdattr(csavear *save, char *root, char *relpath, struct stat6
                     *objtype=OBJTYPE_REGFILEUNIQUE;
                 // empty files are considered as OBJTYPE_REGFILEUNIQUE (statbuf->st_size==0)
             }
+            // the inode number tells if the file has been replaced by another file with the same size and mtime
+            dico_add_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_INODE, (u64)statbuf->st_ino);
             if (*objtype==OBJTYPE_REGFILEUNIQUE || *objtype==OBJTYPE_REGFILEMULTI)
             {
                 if (((u64)statbuf->st_blocks) * ((u64)DEV_BSIZE) < ((u64)statbuf->st_size))
                     flags|=FSA_FILEFLAGS_SPARSE;
             }
+            // incremental archive: a file which has not changed since the base archive only refers to its contents there
+            if ((save->catalog!=NULL) && (*objtype==OBJTYPE_REGFILEUNIQUE) && (statbuf->st_size>0) &&
+                ((entry=catalog_find(save->catalog, save->fsid, relpath))!=NULL) && (entry->size==(u64)statbuf->st_size) &&
+                (entry->mtime==(u64)statbuf->st_mtime) && ((entry->inode==0) || (entry->inode==(u64)statbuf->st_ino)))
+            {
+                msgprintf(MSG_DEBUG1, "UNCHANGED: file=[%s] is in volume %ld of the base archive\n", relpath, (long)entry->volume);
+                dico_add_data(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, entry->md5sum, 16);
+                dico_add_u32(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEVOLUME, entry->volume);
+                dico_add_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEPOSITION, entry->position);
+                *filecost-=statbuf->st_size;
+                *objtype=OBJTYPE_UNCHANGED;
+            }
+            // a file identical to a file already archived only references the contents of the first copy
+            if ((save->dupfiles!=NULL) && (statbuf->st_size>=DUPFILE_MINSIZE) &&
+                (*objtype==OBJTYPE_REGFILEUNIQUE || *objtype==OBJTYPE_REGFILEMULTI) &&
+                (dupfile_find(save->dupfiles, relpath, statbuf->st_size, buffer, sizeof(buffer), &dupgroup, md5sum)==0))
+            {
+                // the first copy must be restored first: it may still be in the shared block of small files
+                if ((dupgroup!=0) && (dupgroup==save->regmultigen))
+                {   if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
+                    {   errprintf("Cannot queue block of small-files\n");
+                        return -1;
+                    }
+                    regmulti_empty(&save->regmulti);
+                    save->regmultigen++;
+                }
+                msgprintf(MSG_DEBUG1, "DUPFILE: file=[%s] has the same contents as [%s]\n", relpath, buffer);
+                dico_add_string(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DUPFILE, buffer);
+                dico_add_data(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, md5sum, 16);
+                flags&=~FSA_FILEFLAGS_SPARSE;
+                *objtype=OBJTYPE_DUPFILE;
+            }
             break;
         case S_IFCHR:
             dico_add_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_RDEV, statbuf->st_rdev);
@@ -610,6 +834,10 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
     // --- cost required for the progression info
     if (costeval!=NULL) 
     {   *costeval+=filecost;
+        if ((save->sampler!=NULL) && (objtype==OBJTYPE_REGFILEMULTI))
+            zstddict_sampler_add_file(save->sampler, fullpath, statbuf->st_size);
+        if ((save->benchset!=NULL) && ((objtype==OBJTYPE_REGFILEUNIQUE) || (objtype==OBJTYPE_REGFILEMULTI)))
+            bench_add_file(save->benchset, fullpath, statbuf->st_size);
         dico_destroy(dicoattr);
         return 0;
     }
@@ -685,6 +913,34 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
             }
             save->stats.cnt_hardlink++;
             break;
+        case OBJTYPE_DUPFILE:
+            if (attrerrors>0)
+            {   save->stats.err_regfile++;
+                dico_destroy(dicoattr);
+                return 0; // error is not fatal, operation must continue
+            }
+            if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
+            {   errprintf("queue_add_header(%s) failed\n", relpath);
+                return -1; // fatal error
+            }
+            save->stats.cnt_regfile++;
+            save->stats.cnt_dupfile++;
+            save->stats.dupfilebytes+=statbuf->st_size;
+            break;
+        case OBJTYPE_UNCHANGED:
+            if (attrerrors>0)
+            {   save->stats.err_regfile++;
+                dico_destroy(dicoattr);
+                return 0; // error is not fatal, operation must continue
+            }
+            if (queue_add_header(&g_queue, dicoattr, FSA_MAGIC_OBJT, save->fsid)!=0)
+            {   errprintf("queue_add_header(%s) failed\n", relpath);
+                return -1; // fatal error
+            }
+            save->stats.cnt_regfile++;
+            save->stats.cnt_unchanged++;
+            save->stats.unchangedbytes+=statbuf->st_size;
+            break;
         case OBJTYPE_CHARDEV:
         case OBJTYPE_BLOCKDEV:
         case OBJTYPE_FIFO:
@@ -837,6 +1093,14 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
         return -1;
     }
     
+    // the files are only compared when they are archived, not when the cost is evaluated
+    save->dupfiles=NULL;
+    if ((g_options.dedupfiles==true) && (costeval==NULL) && ((save->dupfiles=dupfile_alloc(root))==NULL))
+    {   errprintf("dupfiles=dupfile_alloc() failed\n");
+        return -1;
+    }
+    save->regmultigen=1;
+    
     if (regmulti_init(&save->regmulti, g_options.datablocksize)!=0)
     {   errprintf("regmulti_init failed\n");
         return -1;
@@ -852,6 +1116,10 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
     
     // dico for hard links not required anymore
     dichl_destroy(save->dichardlinks);
+    if (save->dupfiles!=NULL)
+    {   dupfile_destroy(save->dupfiles);
+        save->dupfiles=NULL;
+    }
     
     return ret;
 }
@@ -859,7 +1127,8 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
 int createar_write_mainhead(csavear *save, int archtype, int fscount)
 {
     u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckcrypt[FSA_AEAD_NONCELEN+FSA_CHECKPASSBUF_SIZE+FSA_AEAD_TAGLEN];
+    u8 salt[FSA_AEAD_SALTLEN];
     u64 cryptsize;
     u8 md5sum[16];
     struct timeval now;
@@ -888,9 +1157,13 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     dico_add_u32(d, 0, MAINHEADKEY_ENCRYPTALGO, g_options.encryptalgo);
     dico_add_u32(d, 0, MAINHEADKEY_FSACOMPLEVEL, g_options.fsacomplevel);
     dico_add_u32(d, 0, MAINHEADKEY_HASDIRSINFOHEAD, true);
+    if (g_options.datablocksize>FSA_MAX_BLKSIZE) // long mode: older versions reject these blocks
+        dico_add_u32(d, 0, MAINHEADKEY_MAXBLKSIZE, g_options.datablocksize);
+    if (save->catalog!=NULL) // incremental archive: the base archive is required to restore the unchanged files
+        dico_add_u32(d, 0, MAINHEADKEY_BASEARCHID, save->catalog->archid);
     
     // minimum fsarchiver version required to restore that archive
-    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, FSA_VERSION_BUILD(0, 6, 4, 0));
+    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, g_options.minfsaversion);
     
     if (archtype==ARCHTYPE_FILESYSTEMS)
     {   
@@ -898,7 +1171,7 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     }
     
     // if encryption is enabled, save the md5sum of a random buffer to check the password
-    if (g_options.encryptalgo!=ENCRYPT_NONE)
+    if (g_options.encryptalgo==ENCRYPT_BLOWFISH)
     {
         memset(md5sum, 0, sizeof(md5sum));
         crypto_random(bufcheckclear, FSA_CHECKPASSBUF_SIZE);
@@ -910,6 +1183,34 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
         assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCLEARMD5, md5sum, 16)==0);
         assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, FSA_CHECKPASSBUF_SIZE)==0);
     }
+    else if (g_options.encryptalgo==ENCRYPT_AES256GCM)
+    {
+        // derive the key used by the compression threads from the password and a random salt
+        crypto_random(salt, FSA_AEAD_SALTLEN);
+        if (crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_AEAD_SALTLEN,
+            g_options.encryptkey, FSA_AEAD_KEYLEN)!=0)
+        {   errprintf("crypto_derive_key() failed\n");
+            dico_destroy(d);
+            return -1;
+        }
+        assert(dico_add_data(d, 0, MAINHEADKEY_CRYPTSALT, salt, FSA_AEAD_SALTLEN)==0);
+        
+        // the test buffer is stored as nonce+ciphertext+tag
+        memset(md5sum, 0, sizeof(md5sum));
+        crypto_random(bufcheckclear, FSA_CHECKPASSBUF_SIZE);
+        crypto_nonce(bufcheckcrypt, FSA_AEAD_NONCELEN);
+        if (crypto_aes256gcm(FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt+FSA_AEAD_NONCELEN,
+            g_options.encryptkey, bufcheckcrypt, NULL, 0, true)!=0)
+        {   errprintf("crypto_aes256gcm() failed\n");
+            dico_destroy(d);
+            return -1;
+        }
+        
+        gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, bufcheckclear, FSA_CHECKPASSBUF_SIZE);
+        
+        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCLEARMD5, md5sum, 16)==0);
+        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, FSA_AEAD_NONCELEN+cryptsize)==0);
+    }
     
     if (queue_add_header(&g_queue, d, FSA_MAGIC_MAIN, FSA_FILESYSID_NULL)!=0)
     {   errprintf("cannot write dico for main header\n");
@@ -920,6 +1221,38 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     return 0;
 }
 
+int createar_write_zstddict(csavear *save, u16 fsid)
+{
+    cdico *d;
+    
+    if (save->sampler==NULL)
+        return 0;
+    
+    // not enough small files: their blocks are compressed without any dictionary
+    if (zstddict_train(&g_zstddict[fsid], save->sampler, g_options.compresslevel)!=0)
+        return 0;
+    
+    if ((d=dico_alloc())==NULL)
+    {   errprintf("dico_alloc() failed\n");
+        return -1;
+    }
+    if (zstddict_write_dico(&g_zstddict[fsid], d)!=0)
+    {   errprintf("zstddict_write_dico() failed\n");
+        dico_destroy(d);
+        return -1;
+    }
+    
+    // the dictionary must be written before the blocks which use it
+    if (queue_add_header(&g_queue, d, FSA_MAGIC_ZDIC, fsid)!=0)
+    {   errprintf("queue_add_header(FSA_MAGIC_ZDIC) failed\n");
+        return -1;
+    }
+    
+    msgprintf(MSG_VERB1, "zstd dictionary %08x of %ld bytes trained from %d small files\n",
+        (unsigned int)g_zstddict[fsid].dictid, (long)g_zstddict[fsid].size, save->sampler->count);
+    return 0;
+}
+
 int filesystem_mount_partition(cdevinfo *devinfo, cdico *dicofsinfo, u16 fsid)
 {
     char fsbuf[FSA_MAX_FSNAMELEN];
@@ -1165,6 +1498,21 @@ int createar_oper_savedir(csavear *save, char *rootdir)
     return 0;
 }
 
+// walk through a directory as during the evaluation of savedir to sample the data of the files
+int oper_save_sample(char *root, cbenchset *set)
+{
+    csavear save;
+    u64 cost=0;
+    int ret;
+    
+    memset(&save, 0, sizeof(save));
+    archwriter_init(&save.ai);
+    save.benchset=set;
+    ret=createar_save_directory_wrapper(&save, root, "/", &cost);
+    archwriter_destroy(&save.ai);
+    return ret;
+}
+
 int oper_save(char *archive, int argc, char **argv, int archtype)
 {
     pthread_t thread_comp[FSA_MAX_COMPJOBS];
@@ -1175,6 +1523,7 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     u64 totalerr=0;
     cdico *dicoend=NULL;
     cdico *dirsinfo=NULL;
+    czstdsampler sampler;
     struct stat64 st;
     csavear save;
     int ret=0;
@@ -1183,6 +1532,8 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     // init
     memset(&save, 0, sizeof(save));
     save.cost_global=0;
+    save.sampler=NULL;
+    zstddict_sampler_init(&sampler);
     
     // init archive
     archwriter_init(&save.ai);
@@ -1225,6 +1576,43 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
         }
     }
     
+    // incremental archive: read which files are in the base archive before anything is written
+    if (g_options.basearch[0]!=0)
+    {
+        if ((save.catalog=catalog_alloc())==NULL)
+        {   errprintf("catalog_alloc() failed\n");
+            ret=-1;
+            goto do_create_error;
+        }
+        msgprintf(MSG_VERB1, "Reading the list of the files of the base archive %s...\n", g_options.basearch);
+        if (catalog_load(save.catalog, g_options.basearch)!=0)
+        {   msgprintf(MSG_STACK, "catalog_load(%s) failed\n", g_options.basearch);
+            ret=-1;
+            goto do_create_error;
+        }
+        if (strcmp(save.catalog->basepath, save.ai.basepath)==0)
+        {   errprintf("the base archive cannot be replaced by the incremental archive which refers to it\n");
+            ret=-1;
+            goto do_create_error;
+        }
+        if (save.catalog->archtype!=archtype)
+        {   errprintf("the base archive %s must have been created with the same command\n", g_options.basearch);
+            ret=-1;
+            goto do_create_error;
+        }
+    }
+    
+    // the archive requires a recent version to be restored when it uses one of the new features
+    if ((g_options.encryptalgo==ENCRYPT_AES256GCM) || (g_options.zstddict==true) || (g_options.datablocksize>FSA_MAX_BLKSIZE) ||
+        (dedup_enabled(&g_dedup)==true) || (g_options.dedupfiles==true) || (save.catalog!=NULL) || (g_options.zeroextents==true) ||
+        (g_options.sumalgo!=SUMALGO_FLETCHER32))
+        g_options.minfsaversion=FSA_VERSION_BUILD(0, 8, 10, 0);
+    else
+        g_options.minfsaversion=FSA_VERSION_BUILD(0, 6, 4, 0);
+    
+    // buffers large enough for a block after compression and encryption are recycled
+    bufpool_set_bufsize(&g_bufpool, BUFPOOL_BOUND(g_options.datablocksize));
+    
     // create compression threads
     for (i=0; (i<g_options.compressjobs) && (i<FSA_MAX_COMPJOBS); i++)
     {
@@ -1275,6 +1663,9 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
         {
             // evaluate the cost of the operation
             cost_evalfs=0;
+            if (g_options.zstddict==true)
+                save.sampler=&sampler;
+            save.fsid=i;
             msgprintf(MSG_VERB1, "Analysing filesystem on %s...\n", devinfo[i].devpath);
             if (createar_save_directory_wrapper(&save, devinfo[i].partmount, "/", &cost_evalfs)!=0)
             {   sysprintf("cannot run evaluation createar_save_directory(%s)\n", devinfo[i].partmount);
@@ -1292,6 +1683,14 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
                 goto do_create_error;
             }
             dicofsinfo[i]=NULL;
+            
+            // train the dictionary of the small files of this filesystem
+            if (createar_write_zstddict(&save, i)!=0)
+            {   msgprintf(MSG_STACK, "createar_write_zstddict(%s) failed\n", devinfo[i].devpath);
+                goto do_create_error;
+            }
+            zstddict_sampler_destroy(&sampler); // the next filesystem gets its own sample
+            save.sampler=NULL;
         }
     }
     
@@ -1299,6 +1698,8 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     if (archtype==ARCHTYPE_DIRECTORIES)
     {
         // analyse each directory to eval the cost of the operation
+        if (g_options.zstddict==true)
+            save.sampler=&sampler;
         for (i=0; (i < argc) && (argv[i]); i++)
         {
             cost_evalfs=0;
@@ -1325,6 +1726,13 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
             goto do_create_error;
         }
         dirsinfo=NULL;
+        
+        // all the directories are saved as filesystem 0 which has one dictionary
+        if (createar_write_zstddict(&save, 0)!=0)
+        {   msgprintf(MSG_STACK, "createar_write_zstddict() failed\n");
+            goto do_create_error;
+        }
+        save.sampler=NULL;
     }
     
     // init counters to zero before real savefs/savedir
@@ -1415,6 +1823,19 @@ do_create_success:
     if (thread_writer && pthread_join(thread_writer, NULL) != 0)
         errprintf("pthread_join(thread_writer) failed\n");
     
+    // the writer can also fail after all the data have been queued, when it writes the end of the archive
+    if ((ret==0) && (get_stopfillqueue()==true))
+    {   errprintf("the archive %s could not be written completely\n", save.ai.basepath);
+        ret=-1;
+    }
+    
+    queue_show_stats(&g_queue);
+    bufpool_show_stats(&g_bufpool);
+    entropy_show_stats(&g_entropy);
+    adaptlevel_show_stats(&g_adaptlevel);
+    dedup_show_stats(&g_dedup);
+    archwriter_show_stats(&save.ai);
+    
     if (ret!=0)
         archwriter_remove(&save.ai);
     
@@ -1422,6 +1843,9 @@ do_create_success:
     if (totalerr>0)
         ret=-1;
     
+    zstddict_sampler_destroy(&sampler);
+    if (save.catalog!=NULL)
+        catalog_destroy(save.catalog);
     archwriter_destroy(&save.ai);
     return ret;
 }
@@ -18,6 +18,9 @@
 #ifndef __OPER_SAVE_H__
 #define __OPER_SAVE_H__
 
+struct s_benchset;
+
 int oper_save(char *archive, int argc, char **argv, int archtype);
+int oper_save_sample(char *root, struct s_benchset *set);
 
 #endif // __OPER_SAVE_H__
@@ -32,6 +32,8 @@ int options_init()
     memset(&g_options, 0, sizeof(coptions));
     if (strlist_init(&g_options.exclude)!=0)
         return -1;
+    if (comppolicy_init(&g_options.comppolicy)!=0)
+        return -1;
     return 0;
 }
 
@@ -39,6 +41,8 @@ int options_destroy()
 {
     if (strlist_destroy(&g_options.exclude)!=0)
         return -1;
+    if (comppolicy_destroy(&g_options.comppolicy)!=0)
+        return -1;
     memset(&g_options, 0, sizeof(coptions));
     return 0;
 }
@@ -18,7 +18,9 @@
 #ifndef __OPTIONS_H__
 #define __OPTIONS_H__
 
+#include <limits.h>
 #include "strlist.h"
+#include "comppolicy.h"
 
 struct s_options;
 typedef struct s_options coptions;
@@ -35,13 +37,28 @@ struct s_options
     int      compressjobs;
     u16      compressalgo;
     u32      datablocksize;
+    u32      longblksize; // size of the blocks in long mode (0 when disabled)
+    u64      dedupmem; // memory used by the index of the block deduplication (0 when disabled)
     u32      smallfilethresh;
     u64      splitsize;
+    u64      queuemem;
+    u64      benchtarget; // write speed of the destination in bytes per second for the benchmark
+    u64      minfsaversion; // minimum fsarchiver version required to restore the archive being created
     u16      encryptalgo;
+    u16      cryptcipher;
     u16      fsacomplevel;
+    u16      sumalgo; // checksum of the data blocks of the archive being created (SUMALGO_xxx)
+    bool     zstddict; // train a zstd dictionary for the blocks of small files
+    bool     dedupfiles; // archive the files identical to a file already archived as a reference to it
+    bool     sparseall; // restore the pages of zeros of all the regular files as holes
+    bool     zeroextents; // archive the holes of the sparse files as zero extents instead of blocks of zeros
 	char     archlabel[FSA_MAX_LABELLEN];
+    char     basearch[PATH_MAX]; // base archive of an incremental archive (empty when not used)
     u8       encryptpass[FSA_MAX_PASSLEN+1];
+    u8       encryptkey[FSA_AEAD_KEYLEN]; // key derived from encryptpass for ENCRYPT_AES256GCM
+    u8       basekey[FSA_AEAD_KEYLEN]; // key derived from encryptpass with the salt of the base archive
     cstrlist exclude;
+    ccomppolicy comppolicy; // compression algorithm and level to use for each file
 };
 
 extern coptions g_options;
@@ -23,24 +23,215 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <time.h>
 #include <limits.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 
 #include "fsarchiver.h"
 #include "queue.h"
 #include "dico.h"
 #include "common.h"
 #include "syncthread.h"
+#include "bufpool.h"
 #include "error.h"
 
-struct timespec get_timeout()
+// ---- the queuelocked_*() functions must be called with the mutex locked
+
+bool queuelocked_get_end_of_queue(cqueue *q)
+{
+    bool res;
+    if (!q)
+    {   errprintf("q is NULL\n");
+        return FSAERR_EINVAL;
+    }
+
+    res=((q->itemcount<1) && (q->endofqueue==true));
+    return res;
+}
+
+
+// change the status of an item and keep the list of blocks to process and the counters up to date
+void queuelocked_set_status(cqueue *q, cqueueitem *item, int newstatus)
+{
+    cqueuetodo *todo;
+    
+    if (item->status==QITEM_STATUS_TODO) // unlink the item from the todo list
+    {
+        todo=&q->todo;
+        if (item->prevtodo!=NULL)
+            item->prevtodo->nexttodo=item->nexttodo;
+        else
+            todo->head=item->nexttodo;
+        if (item->nexttodo!=NULL)
+            item->nexttodo->prevtodo=item->prevtodo;
+        else
+            todo->tail=item->prevtodo;
+        item->nexttodo=NULL;
+        item->prevtodo=NULL;
+        todo->count--;
+    }
+    
+    if (newstatus==QITEM_STATUS_TODO) // the block goes at the end of the todo list
+    {
+        todo=&q->todo;
+        item->nexttodo=NULL;
+        item->prevtodo=todo->tail;
+        if (todo->tail!=NULL)
+            todo->tail->nexttodo=item;
+        else
+            todo->head=item;
+        todo->tail=item;
+        todo->count++;
+    }
+    
+    if (item->status!=QITEM_STATUS_NULL)
+        q->statuscount[item->status]--;
+    if (newstatus!=QITEM_STATUS_NULL)
+        q->statuscount[newstatus]++;
+    if ((item->type==QITEM_TYPE_BLOCK) && (item->status!=QITEM_STATUS_NULL))
+        q->blkstatuscount[item->status]--;
+    if ((item->type==QITEM_TYPE_BLOCK) && (newstatus!=QITEM_STATUS_NULL))
+        q->blkstatuscount[newstatus]++;
+    
+    // wake up the threads which are waiting for this particular event only
+    if (newstatus==QITEM_STATUS_TODO) // one more block for a compression thread
+        pthread_cond_signal(&q->condtodo);
+    if (item==q->head) // the first item may now be ready for the writer or the main thread
+        pthread_cond_broadcast(&q->condready);
+    else if ((newstatus==QITEM_STATUS_DONE) && (q->head!=NULL) && (q->head->status!=QITEM_STATUS_DONE))
+        q->reorderhighwater=max(q->reorderhighwater, q->statuscount[QITEM_STATUS_DONE]);
+    if ((item->status==QITEM_STATUS_TODO || item->status==QITEM_STATUS_PROGRESS) &&
+        (q->statuscount[QITEM_STATUS_TODO]+q->statuscount[QITEM_STATUS_PROGRESS]==0))
+        pthread_cond_broadcast(&q->condidle); // no more block to be processed
+    
+    item->status=newstatus;
+}
+
+// the consumer waits until the first item of the queue is ready or the end of the queue is reached
+void queuelocked_wait_first_item_ready(cqueue *q)
+{
+    struct timespec t1, t2;
+    bool holwait;
+    
+    if (((q->head!=NULL) && (q->head->status==QITEM_STATUS_DONE)) || queuelocked_get_end_of_queue(q))
+        return;
+    
+    // head-of-line blocking: other items are ready but they have to wait for the first one
+    if ((holwait=(q->statuscount[QITEM_STATUS_DONE]>0))==true)
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    while ( ((q->head==NULL) || (q->head->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
+        pthread_cond_wait(&q->condready, &q->mutex);
+    
+    if (holwait==true)
+    {   clock_gettime(CLOCK_MONOTONIC, &t2);
+        q->holwaits++;
+        q->holwaitns+=(u64)(t2.tv_sec-t1.tv_sec)*1000000000LL+(t2.tv_nsec-t1.tv_nsec);
+    }
+}
+
+// memory accounted for a block: the buffer either contains the data in the normal or in the archive state
+u64 queue_block_memsize(cblockinfo *blkinfo)
+{
+    if (blkinfo->blkdata==NULL) // reference to a duplicate block or zero extent: there is no data
+        return sizeof(cqueueitem);
+    return sizeof(cqueueitem)+max(blkinfo->blkrealsize, blkinfo->blkarsize);
+}
+
+// true when there is not enough space in the queue for an item which requires memsize bytes
+bool queuelocked_is_full(cqueue *q, u64 memsize)
+{
+    if (q->memmax>0) // the memory budget is used instead of the number of blocks
+        return (q->memused>0) && (q->memused+memsize > q->memmax);
+    else
+        return (q->blkcount > q->blkmax);
+}
+
+// make the index bigger when there are more items in the queue than slots in the index
+int queuelocked_grow_index(cqueue *q)
+{
+    cqueueitem **newindex;
+    cqueueitem *cur;
+    u64 newsize;
+    
+    newsize=q->indexsize*2;
+    if ((newindex=calloc(newsize, sizeof(cqueueitem*)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)newsize);
+        return -1;
+    }
+    for (cur=q->head; cur!=NULL; cur=cur->next)
+        newindex[cur->itemnum & (newsize-1)]=cur;
+    free(q->index);
+    q->index=newindex;
+    q->indexsize=newsize;
+    return 0;
+}
+
+// add an item at the end of the queue and give it a new itemnum
+int queuelocked_append(cqueue *q, cqueueitem *item, int status)
+{
+    if ((q->itemcount >= q->indexsize) && (queuelocked_grow_index(q)!=0))
+        return -1;
+    
+    item->next=NULL;
+    item->nexttodo=NULL;
+    item->prevtodo=NULL;
+    item->status=QITEM_STATUS_NULL;
+    item->itemnum=q->curitemnum++;
+    q->index[item->itemnum & (q->indexsize-1)]=item;
+    
+    if (q->tail==NULL) // if list empty: item is head
+        q->head=item;
+    else // list not empty: add items at the end
+        q->tail->next=item;
+    q->tail=item;
+    
+    if (item->type==QITEM_TYPE_BLOCK)
+        q->blkcount++;
+    q->itemcount++;
+    q->memused+=item->memsize;
+    q->memhighwater=max(q->memhighwater, q->memused);
+    q->blkhighwater=max(q->blkhighwater, q->blkcount);
+    queuelocked_set_status(q, item, status);
+    return 0;
+}
+
+// unlink the first item from the queue: the caller has to free it
+cqueueitem *queuelocked_remove_first(cqueue *q)
 {
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
-    t.tv_sec++;
-    return t;
+    cqueueitem *cur;
+    
+    if ((cur=q->head)==NULL)
+        return NULL;
+    
+    q->head=cur->next;
+    if (q->head==NULL)
+        q->tail=NULL;
+    q->index[cur->itemnum & (q->indexsize-1)]=NULL;
+    queuelocked_set_status(q, cur, QITEM_STATUS_NULL);
+    if (cur->type==QITEM_TYPE_BLOCK)
+    {   q->blkcount--;
+        pthread_cond_signal(&q->condnotfull);
+    }
+    q->itemcount--;
+    q->memused-=cur->memsize;
+    
+    pthread_cond_broadcast(&q->condready); // there is a new first item
+    if (queuelocked_get_end_of_queue(q)) // the compression threads must exit now
+        pthread_cond_broadcast(&q->condtodo);
+    return cur;
+}
+
+// find an item from its itemnum (items in the queue always have contiguous itemnums)
+cqueueitem *queuelocked_find_item(cqueue *q, s64 itemnum)
+{
+    cqueueitem *cur;
+    
+    if ((q->head==NULL) || (itemnum < q->head->itemnum) || (itemnum >= q->curitemnum))
+        return NULL;
+    cur=q->index[itemnum & (q->indexsize-1)];
+    return ((cur!=NULL) && (cur->itemnum==itemnum)) ? cur : NULL;
 }
 
 s64 queue_init(cqueue *q, s64 blkmax)
@@ -54,11 +245,29 @@ s64 queue_init(cqueue *q, s64 blkmax)
     
     // ---- init default attributes
     q->head=NULL;
+    q->tail=NULL;
+    memset(&q->todo, 0, sizeof(q->todo));
+    q->holwaits=0;
+    q->holwaitns=0;
+    q->reorderhighwater=0;
     q->curitemnum=1;
     q->itemcount=0;
     q->blkcount=0;
     q->blkmax=blkmax;
+    q->memmax=0;
+    q->memused=0;
+    q->memhighwater=0;
+    q->blkhighwater=0;
     q->endofqueue=false;
+    memset(q->statuscount, 0, sizeof(q->statuscount));
+    memset(q->blkstatuscount, 0, sizeof(q->blkstatuscount));
+    
+    // ---- init the index used to find an item from its itemnum
+    q->indexsize=QUEUE_INDEX_MINSIZE;
+    if ((q->index=calloc(q->indexsize, sizeof(cqueueitem*)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)q->indexsize);
+        return FSAERR_ENOMEM;
+    }
     
     // ---- init pthread structures
     assert(pthread_mutexattr_init(&attr)==0);
@@ -68,7 +277,8 @@ s64 queue_init(cqueue *q, s64 blkmax)
         return FSAERR_UNKNOWN;
     }
     
-    if (pthread_cond_init(&q->cond,NULL)!=0)
+    if ((pthread_cond_init(&q->condnotfull, NULL)!=0) || (pthread_cond_init(&q->condtodo, NULL)!=0) ||
+        (pthread_cond_init(&q->condready, NULL)!=0) || (pthread_cond_init(&q->condidle, NULL)!=0))
     {   msgprintf(3, "pthread_cond_init failed\n");
         return FSAERR_UNKNOWN;
     }
@@ -94,45 +304,82 @@ s64 queue_destroy(cqueue *q)
         free(cur);
     }
     q->head=NULL;
+    q->tail=NULL;
+    memset(&q->todo, 0, sizeof(q->todo));
     q->itemcount=0;
+    q->blkcount=0;
+    memset(q->statuscount, 0, sizeof(q->statuscount));
+    memset(q->blkstatuscount, 0, sizeof(q->blkstatuscount));
+    free(q->index);
+    q->index=NULL;
+    q->indexsize=0;
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
     assert(pthread_mutex_destroy(&q->mutex)==0);
-    assert(pthread_cond_destroy(&q->cond)==0);
+    assert(pthread_cond_destroy(&q->condnotfull)==0);
+    assert(pthread_cond_destroy(&q->condtodo)==0);
+    assert(pthread_cond_destroy(&q->condready)==0);
+    assert(pthread_cond_destroy(&q->condidle)==0);
     
     return FSAERR_SUCCESS;
 }
 
-s64 queue_set_end_of_queue(cqueue *q, bool state)
+// limit the queue with an amount of memory rather than a number of blocks
+s64 queue_set_mem_budget(cqueue *q, u64 memmax)
 {
     if (!q)
     {   errprintf("q is NULL\n");
         return FSAERR_EINVAL;
     }
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    q->memmax=memmax;
+    pthread_cond_broadcast(&q->condnotfull);
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    return FSAERR_SUCCESS;
+}
 
+// show how deep the queue has been so that its memory budget can be sized
+s64 queue_show_stats(cqueue *q)
+{
+    char buffer1[256];
+    char buffer2[256];
+    
+    if (!q)
+    {   errprintf("q is NULL\n");
+        return FSAERR_EINVAL;
+    }
+    
     assert(pthread_mutex_lock(&q->mutex)==0);
-    q->endofqueue=state;
+    msgprintf(MSG_VERB1, "Queue high-water mark: %s used by %lld data blocks (limit: %s)\n",
+        format_size(q->memhighwater, buffer1, sizeof(buffer1), 'h'), (long long)q->blkhighwater,
+        (q->memmax>0)?format_size(q->memmax, buffer2, sizeof(buffer2), 'h'):"fixed number of blocks");
+    msgprintf(MSG_VERB1, "Queue reordering: %lld waits for the first item (%.3f sec) with up to %lld items ready behind it\n",
+        (long long)q->holwaits,
+        (double)q->holwaitns/1000000000.0, (long long)q->reorderhighwater);
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     return FSAERR_SUCCESS;
 }
 
-bool queue_get_end_of_queue(cqueue *q)
+s64 queue_set_end_of_queue(cqueue *q, bool state)
 {
-    bool res;
     if (!q)
     {   errprintf("q is NULL\n");
         return FSAERR_EINVAL;
     }
 
     assert(pthread_mutex_lock(&q->mutex)==0);
-    res=((q->itemcount<1) && (q->endofqueue==true));
+    q->endofqueue=state;
+    // all the threads which are waiting must check the end of the queue
+    pthread_cond_broadcast(&q->condnotfull);
+    pthread_cond_broadcast(&q->condtodo);
+    pthread_cond_broadcast(&q->condready);
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    return res;
+    return FSAERR_SUCCESS;
 }
 
-bool queuelocked_get_end_of_queue(cqueue *q)
+bool queue_get_end_of_queue(cqueue *q)
 {
     bool res;
     if (!q)
@@ -140,7 +387,9 @@ bool queuelocked_get_end_of_queue(cqueue *q)
         return FSAERR_EINVAL;
     }
 
+    assert(pthread_mutex_lock(&q->mutex)==0);
     res=((q->itemcount<1) && (q->endofqueue==true));
+    assert(pthread_mutex_unlock(&q->mutex)==0);
     return res;
 }
 
@@ -164,21 +413,41 @@ s64 queue_count(cqueue *q)
 // how many items in the queue have a particular status
 s64 queue_count_status(cqueue *q, int status)
 {
-    cqueueitem *cur;
-    int count=0;
+    s64 count;
     
-    if (!q)
-    {   errprintf("q is NULL\n");
+    if (!q || status<QITEM_STATUS_NULL || status>QITEM_STATUS_DONE)
+    {   errprintf("invalid param\n");
         return FSAERR_EINVAL;
     }
 
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
-    {
-        if (status==QITEM_STATUS_NULL || cur->status==status)
-            count++;
+    if (status==QITEM_STATUS_NULL)
+        count=q->itemcount;
+    else
+        count=q->statuscount[status];
+    
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    
+    return count;
+}
+
+// how many blocks in the queue have a particular status (the headers are not counted)
+s64 queue_count_blocks_status(cqueue *q, int status)
+{
+    s64 count;
+    
+    if (!q || status<QITEM_STATUS_NULL || status>QITEM_STATUS_DONE)
+    {   errprintf("invalid param\n");
+        return FSAERR_EINVAL;
     }
+
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    
+    if (status==QITEM_STATUS_NULL)
+        count=q->blkcount;
+    else
+        count=q->blkstatuscount[status];
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
@@ -189,10 +458,9 @@ s64 queue_count_status(cqueue *q, int status)
 s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
 {
     cqueueitem *item;
-    cqueueitem *cur;
     
-    if (!q || !blkinfo)
-    {   errprintf("a parameter is NULL\n");
+    if (!q || !blkinfo || status<=QITEM_STATUS_NULL || status>QITEM_STATUS_DONE)
+    {   errprintf("a parameter is invalid\n");
         return FSAERR_EINVAL;
     }
     
@@ -203,9 +471,8 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
         return FSAERR_ENOMEM;
     }
     item->type=QITEM_TYPE_BLOCK;
-    item->status=status;
     item->blkinfo=*blkinfo;
-    item->next=NULL;
+    item->memsize=queue_block_memsize(blkinfo);
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
@@ -217,28 +484,16 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
     }
     
     // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while (queuelocked_is_full(q, item->memsize))
+        pthread_cond_wait(&q->condnotfull, &q->mutex);
     
-    if (q->head==NULL) // if list empty: item is head
-    {
-        q->head=item;
-    }
-    else // list not empty: add items at the end
-    {
-        for (cur=q->head; (cur!=NULL) && (cur->next!=NULL); cur=cur->next);
-        cur->next=item;
+    if (queuelocked_append(q, item, status)!=0)
+    {   free(item);
+        assert(pthread_mutex_unlock(&q->mutex)==0);
+        return FSAERR_ENOMEM;
     }
     
-    q->blkcount++;
-    q->itemcount++;
-    item->itemnum=q->curitemnum++;
-    
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     
     return FSAERR_SUCCESS;
 }
@@ -263,7 +518,6 @@ s64 queue_add_header(cqueue *q, cdico *d, char *magic, u16 fsid)
 s64 queue_add_header_internal(cqueue *q, cheadinfo *headinfo)
 {
     cqueueitem *item;
-    cqueueitem *cur;
     
     if (!q || !headinfo)
     {   errprintf("parameter is null\n");
@@ -279,8 +533,7 @@ s64 queue_add_header_internal(cqueue *q, cheadinfo *headinfo)
     
     item->headinfo=*headinfo;
     item->type=QITEM_TYPE_HEADER;
-    item->status=QITEM_STATUS_DONE;
-    item->next=NULL;
+    item->memsize=0; // headers are not limited by the size of the queue
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
@@ -292,26 +545,16 @@ s64 queue_add_header_internal(cqueue *q, cheadinfo *headinfo)
     }
     
     // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    while (queuelocked_is_full(q, item->memsize))
+        pthread_cond_wait(&q->condnotfull, &q->mutex);
     
-    item->itemnum=q->curitemnum++;
-    if (q->head==NULL) // if list empty
-    {
-        q->head=item;
-    }
-    else // list not empty
-    {
-        for (cur=q->head; (cur!=NULL) && (cur->next!=NULL); cur=cur->next);
-        cur->next=item;
+    if (queuelocked_append(q, item, QITEM_STATUS_DONE)!=0) // an header is always ready
+    {   free(item);
+        assert(pthread_mutex_unlock(&q->mutex)==0);
+        return FSAERR_ENOMEM;
     }
     
-    q->itemcount++;
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     
     return FSAERR_SUCCESS;
 }
@@ -321,40 +564,37 @@ s64 queue_replace_block(cqueue *q, s64 itemnum, cblockinfo *blkinfo, int newstat
 {
     cqueueitem *cur;
     
-    if (!q || !blkinfo)
-    {   errprintf("a parameter is null\n");
+    if (!q || !blkinfo || newstatus<=QITEM_STATUS_NULL || newstatus>QITEM_STATUS_DONE)
+    {   errprintf("a parameter is invalid\n");
         return FSAERR_EINVAL;
     }
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    if (q->head==NULL)
+    if ((cur=queuelocked_find_item(q, itemnum))==NULL)
     {   assert(pthread_mutex_unlock(&q->mutex)==0);
-        msgprintf(MSG_DEBUG1, "q->head is NULL: list is empty\n");
+        msgprintf(MSG_DEBUG1, "item %ld not found in the queue\n", (long)itemnum);
         return FSAERR_ENOENT; // item not found
     }
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
-    {
-        if (cur->itemnum==itemnum) // block found
-        {
-            cur->status=newstatus;
-            cur->blkinfo=*blkinfo;
-            assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
-            return FSAERR_SUCCESS;
-        }
-    }
+    queuelocked_set_status(q, cur, newstatus);
+    cur->blkinfo=*blkinfo;
     
+    // the size of the block may have changed after compression or decompression
+    q->memused-=cur->memsize;
+    cur->memsize=queue_block_memsize(blkinfo);
+    q->memused+=cur->memsize;
+    q->memhighwater=max(q->memhighwater, q->memused);
+    if (queuelocked_is_full(q, 0)==false)
+        pthread_cond_signal(&q->condnotfull);
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    return FSAERR_ENOENT; // not found
+    return FSAERR_SUCCESS;
 }
 
 // get number of items to be processed
 s64 queue_count_items_todo(cqueue *q)
 {
-    cqueueitem *cur;
-    s64 count=0;
+    s64 count;
     
     if (!q)
     {   errprintf("a parameter is null\n");
@@ -363,17 +603,30 @@ s64 queue_count_items_todo(cqueue *q)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    for (cur=q->head; cur!=NULL; cur=cur->next)
-    {
-        if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status!=QITEM_STATUS_DONE))
-            count++;
-    }
+    // only blocks can be in the todo or progress states (headers are always ready)
+    count=q->statuscount[QITEM_STATUS_TODO]+q->statuscount[QITEM_STATUS_PROGRESS];
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
     return count;
 }
 
+// wait until the compression threads have processed all the blocks which are in the queue
+s64 queue_wait_items_todo(cqueue *q)
+{
+    if (!q)
+    {   errprintf("a parameter is null\n");
+        return FSAERR_EINVAL;
+    }
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    while (q->statuscount[QITEM_STATUS_TODO]+q->statuscount[QITEM_STATUS_PROGRESS] > 0)
+        pthread_cond_wait(&q->condidle, &q->mutex);
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    
+    return FSAERR_SUCCESS;
+}
+
 // the compression thread requires the first block which has not yet been compressed
 s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
 {
@@ -390,34 +643,25 @@ s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
     
     while (queuelocked_get_end_of_queue(q)==false)
     {
-        for (cur=q->head; cur!=NULL; cur=cur->next)
+        if ((cur=q->todo.head)!=NULL) // oldest block which has not been processed yet
         {
-            if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_TODO))
-            {
-                *blkinfo=cur->blkinfo;
-                cur->status=QITEM_STATUS_PROGRESS;
-                itemfound=cur->itemnum;
-                assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
-                return itemfound; // ">0" means item found
-            }
+            *blkinfo=cur->blkinfo;
+            queuelocked_set_status(q, cur, QITEM_STATUS_PROGRESS);
+            itemfound=cur->itemnum;
+            assert(pthread_mutex_unlock(&q->mutex)==0);
+            return itemfound; // ">0" means item found
         }
         
-        struct timespec t=get_timeout();
-        if ((res=pthread_cond_timedwait(&q->cond, &q->mutex, &t))!=0 && res!=ETIMEDOUT)
+        if ((res=pthread_cond_wait(&q->condtodo, &q->mutex))!=0)
         {   assert(pthread_mutex_unlock(&q->mutex)==0);
             return FSAERR_UNKNOWN;
         }
-        
     }
     
     // if it failed at the other end of the queue
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
-    if (queuelocked_get_end_of_queue(q))
-        return FSAERR_ENDOFFILE;
-    else
-        return FSAERR_UNKNOWN;
+    return FSAERR_ENDOFFILE;
 }
 
 // the writer thread requires the first block of the queue if it ready to go
@@ -441,15 +685,11 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
         {
             if (cur->type==QITEM_TYPE_BLOCK) // item to dequeue is a block
             {
-                q->blkcount--;
                 *type=cur->type;
                 itemfound=cur->itemnum;
                 *blkinfo=cur->blkinfo;
-                q->head=cur->next;
-                free(cur);
-                q->itemcount--;
+                free(queuelocked_remove_first(q));
                 assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
                 return itemfound; // ">0" means item found
             }
             else if (cur->type==QITEM_TYPE_HEADER) // item to dequeue is a dico
@@ -457,11 +697,8 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
                 *headinfo=cur->headinfo;
                 *type=cur->type;
                 itemfound=cur->itemnum;
-                q->head=cur->next;
-                free(cur);
-                q->itemcount--;
+                free(queuelocked_remove_first(q));
                 assert(pthread_mutex_unlock(&q->mutex)==0);
-                pthread_cond_broadcast(&q->cond);
                 return itemfound; // ">0" means item found
             }
             else
@@ -472,8 +709,7 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
             }
         }
         
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
+        queuelocked_wait_first_item_ready(q);
     }
     
     // if it failed at the other end of the queue
@@ -496,12 +732,8 @@ s64 queue_dequeue_block(cqueue *q, cblockinfo *blkinfo)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    // wait while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
+    queuelocked_wait_first_item_ready(q);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -516,20 +748,15 @@ s64 queue_dequeue_block(cqueue *q, cblockinfo *blkinfo)
     if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_DONE))
     {
         *blkinfo=cur->blkinfo;
-        q->head=cur->next;
         itemnum=cur->itemnum;
-        free(cur);
-        q->blkcount--;
-        q->itemcount--;
+        free(queuelocked_remove_first(q));
         assert(pthread_mutex_unlock(&q->mutex)==0);
-        pthread_cond_broadcast(&q->cond);
         return itemnum;
     }
     else
     {
         errprintf("dequeue - wrong type of data in the queue: wanted a block, found an header\n");
         assert(pthread_mutex_unlock(&q->mutex)==0);
-        pthread_cond_broadcast(&q->cond);
         return FSAERR_WRONGTYPE;  // ok but not found
     }
 }
@@ -568,12 +795,8 @@ s64 queue_dequeue_header_internal(cqueue *q, cheadinfo *headinfo)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    // wait while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
+    queuelocked_wait_first_item_ready(q);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -588,23 +811,18 @@ s64 queue_dequeue_header_internal(cqueue *q, cheadinfo *headinfo)
     switch (cur->type)
     {
         case QITEM_TYPE_HEADER:
-            q->head=cur->next;
             *headinfo=cur->headinfo;
             itemnum=cur->itemnum;
-            free(cur);
-            q->itemcount--;
+            free(queuelocked_remove_first(q));
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return itemnum;
         case QITEM_TYPE_BLOCK:
             errprintf("dequeue - wrong type of data in the queue: expected a dico and found a block\n");
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return FSAERR_WRONGTYPE;  // ok but not found
         default: // should never happen
             errprintf("dequeue - wrong type of data in the queue: expected a dico and found an unknown item\n");
             assert(pthread_mutex_unlock(&q->mutex)==0);
-            pthread_cond_broadcast(&q->cond);
             return FSAERR_WRONGTYPE;  // ok but not found
     }
 }
@@ -644,12 +862,8 @@ s64 queue_check_next_item(cqueue *q, int *type, char *magic)
     
     assert(pthread_mutex_lock(&q->mutex)==0);
     
-    // while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
-    while ( (((cur=q->head)==NULL) || (cur->status!=QITEM_STATUS_DONE)) && (queuelocked_get_end_of_queue(q)==false) )
-    {
-        struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+    // wait while ((first-item-of-the-queue-is-not-ready) && (not-at-the-end-of-the-queue))
+    queuelocked_wait_first_item_ready(q);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -683,7 +897,6 @@ s64 queue_check_next_item(cqueue *q, int *type, char *magic)
     }
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     
     return FSAERR_ENOENT;  // not found
 }
@@ -702,9 +915,7 @@ s64 queue_destroy_first_item(cqueue *q)
     
     // while ((first-item-of-the-queue-is-not-ready or first-item-is-being-processed-by-comp-thread) && (not-at-the-end-of-the-queue))
     while ( (((cur=q->head)==NULL) || (cur->status==QITEM_STATUS_PROGRESS)) && (queuelocked_get_end_of_queue(q)==false) )
-    {   struct timespec t=get_timeout();
-        pthread_cond_timedwait(&q->cond, &q->mutex, &t);
-    }
+        pthread_cond_wait(&q->condready, &q->mutex);
     
     // if it failed at the other end of the queue
     if (queuelocked_get_end_of_queue(q))
@@ -718,18 +929,14 @@ s64 queue_destroy_first_item(cqueue *q)
     switch (cur->type)
     {
         case QITEM_TYPE_BLOCK:
-            q->blkcount--;
-            free(cur->blkinfo.blkdata);
+            bufpool_free(&g_bufpool, cur->blkinfo.blkdata);
             break;
         case QITEM_TYPE_HEADER:
             dico_destroy(cur->headinfo.dico);
             break;
     }
     
-    q->head=cur->next;
-    free(cur);
-    q->itemcount--;
+    free(queuelocked_remove_first(q));
     assert(pthread_mutex_unlock(&q->mutex)==0);
-    pthread_cond_broadcast(&q->cond);
     return FSAERR_SUCCESS;
 }
@@ -23,6 +23,8 @@
 enum {QITEM_STATUS_NULL=0, QITEM_STATUS_TODO, QITEM_STATUS_PROGRESS, QITEM_STATUS_DONE};
 enum {QITEM_TYPE_NULL=0, QITEM_TYPE_BLOCK, QITEM_TYPE_HEADER};
 
+#define QUEUE_INDEX_MINSIZE      1024 // initial number of slots in the itemnum index (must be a power of two)
+
 struct s_dico;
 
 struct s_blockinfo;
@@ -34,6 +36,9 @@ typedef struct s_headinfo cheadinfo;
 struct s_queueitem;
 typedef struct s_queueitem cqueueitem;
 
+struct s_queuetodo;
+typedef struct s_queuetodo cqueuetodo;
+
 struct s_queue;
 typedef struct s_queue cqueue;
 
@@ -42,11 +47,22 @@ struct s_blockinfo // used when (type==QITEM_TYPE_BLOCK)
     u32                  blkrealsize; // size of the data in the normal state (not compressed and not crypted)
     u64                  blkoffset; // offset of the block in the normal file
     u32                  blkarcsum; // checksum of the block as it it when it's in the archive (compressed and encrypted)
+    u16                  blksumalgo; // algorithm of blkarcsum (SUMALGO_FLETCHER32 in the archives which do not say it)
     u32                  blkarsize; // size of the block as it is in the archive (compressed and encrypted)
     u16                  blkcompalgo; // algo used to compressed the block
     u32                  blkcompsize; // size of the block after compression and before encryption
     u16                  blkcryptalgo; // algo used to compressed the block
+    u8                   blkcryptnonce[FSA_AEAD_NONCELEN]; // nonce used to encrypt the block with ENCRYPT_AES256GCM
     u16                  blkfsid; // id of filesystem to which the block belongs
+    bool                 blknocomp; // true if the block must be stored without trying to compress it
+    u16                  blkreqalgo; // algo requested by the compression policy (COMPRESS_NULL to use the options)
+    int                  blkreqlevel; // level requested by the compression policy
+    u32                  blkdictid; // id of the zstd dictionary of the filesystem used by the block (0 if none)
+    u8                   blkdedup; // BLKDEDUP_REF if the block is a duplicate of a block written before in the archive
+    u8                   blkhash[FSA_DEDUP_HASHLEN]; // digest of the contents used to find the duplicate blocks
+    u64                  blkrefoffset; // offset in its own file of the block a reference points to (authenticated when encrypted)
+    bool                 blkbase; // true if the block has been read from the base archive (encrypted with its own key)
+    bool                 blkzero; // true if the block is a hole of a sparse file made of blkrealsize zeros (blkdata is NULL)
     bool                 blklocked; // true if locked (being processed in the compress/crypt thread)
 };
 
@@ -61,18 +77,43 @@ struct s_queueitem
     int                  status; // compressed, being-compressed, not-yet-compressed
     s64                  itemnum; // unique identifier of the item in the queue
     cqueueitem           *next; // next block in the linked list
+    cqueueitem           *nexttodo; // next item in the list of blocks waiting to be processed (status==QITEM_STATUS_TODO)
+    cqueueitem           *prevtodo; // previous item in the list of blocks waiting to be processed
+    u64                  memsize; // how many bytes of memory are accounted for this item in the queue
     cblockinfo           blkinfo; // used when type==QITEM_TYPE_BLOCK (for blocks only)
     cheadinfo            headinfo; // used when type==QITEM_TYPE_HEADER (for headers only)
 };
 
+struct s_queuetodo // list of blocks waiting to be processed in the order of the queue
+{   cqueueitem           *head; // oldest block in the list
+    cqueueitem           *tail; // newest block in the list
+    u64                  count; // how many blocks there are in the list
+};
+
 struct s_queue
 {   cqueueitem           *head; // head of the queue: first item
+    cqueueitem           *tail; // tail of the queue: last item (where new items are added)
+    cqueuetodo           todo; // blocks waiting to be processed by the compression threads
+    cqueueitem           **index; // ring of pointers to the items indexed by itemnum (itemnums in the queue are contiguous)
+    u64                  indexsize; // number of slots in the index (always a power of two)
+    u64                  statuscount[QITEM_STATUS_DONE+1]; // how many items there are for each status
+    u64                  blkstatuscount[QITEM_STATUS_DONE+1]; // how many blocks there are for each status (headers excluded)
     pthread_mutex_t      mutex; // pthread mutex for data protection
-    pthread_cond_t       cond; // condition for pthread synchronization
+    pthread_cond_t       condnotfull; // signaled when a block is removed: the queue may not be full any more
+    pthread_cond_t       condtodo; // signaled when there is a new block for the compression threads
+    pthread_cond_t       condready; // signaled when the first item of the queue changes or becomes ready
+    pthread_cond_t       condidle; // signaled when there is no more block to be processed by the compression threads
     s64                  curitemnum; // unique id given to every new item (block or header)
     u64                  itemcount; // how many items there are (headers + blocks)
     u64                  blkcount; // how many blocks items there are (items where type==QITEM_TYPE_BLOCK only)
     u64                  blkmax; // how many blocks items there can be before the queue is considered as full
+    u64                  memmax; // how many bytes the blocks can use before the queue is full (replaces blkmax when non zero)
+    u64                  memused; // how many bytes are used by the blocks which are in the queue
+    u64                  memhighwater; // highest value of memused since the queue has been initialized
+    u64                  blkhighwater; // highest value of blkcount since the queue has been initialized
+    u64                  holwaits; // how many times the consumer waited for the first item while others were ready
+    u64                  holwaitns; // total time spent by the consumer in these waits (in nanoseconds)
+    u64                  reorderhighwater; // highest number of items ready behind a first item which was not ready
     bool                 endofqueue; // set to true when no more data to put in queue (like eof): reader must stop
 };
 
@@ -84,13 +125,17 @@ struct s_queue
 // init and destroy
 s64  queue_init(cqueue *l, s64 blkmax);
 s64  queue_destroy(cqueue *l);
+s64  queue_set_mem_budget(cqueue *q, u64 memmax);
 
 // information functions
 s64  queue_count(cqueue *l);
 s64  queue_count_status(struct s_queue *l, int status);
+s64  queue_count_blocks_status(cqueue *q, int status);
 s64  queue_is_first_item_ready(struct s_queue *q);
 s64  queue_check_next_item(cqueue *q, int *type, char *magic);
 s64  queue_count_items_todo(cqueue *q);
+s64  queue_wait_items_todo(cqueue *q);
+s64  queue_show_stats(cqueue *q);
 
 // modification functions
 s64  queue_add_block(cqueue *q, cblockinfo *blkinfo, int status);
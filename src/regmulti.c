@@ -28,6 +28,10 @@
 #include "regmulti.h"
 #include "common.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "syncthread.h"
+#include "entropy.h"
+#include "zstddict.h"
 #include "error.h"
 
 int regmulti_empty(cregmulti *m)
@@ -41,6 +45,9 @@ int regmulti_empty(cregmulti *m)
     
     m->count=0;
     m->usedsize=0;
+    m->policyrule=-1;
+    m->compalgo=COMPRESS_NULL;
+    m->complevel=0;
     
     for (i=0; i < m->maxitems; i++)
         m->objhead[i]=NULL;
@@ -108,6 +115,30 @@ int regmulti_save_addfile(cregmulti *m, cdico *header, char *data, u32 datsize)
     return 0;
 }
 
+// files are only packed with other files which use the same compression policy
+bool regmulti_save_same_policy(cregmulti *m, int policyrule)
+{
+    if (!m)
+    {   errprintf("invalid param\n");
+        return false;
+    }
+    
+    return (m->count==0) || (m->policyrule==policyrule);
+}
+
+int regmulti_save_set_policy(cregmulti *m, int policyrule, u16 compalgo, int complevel)
+{
+    if (!m)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    m->policyrule=policyrule;
+    m->compalgo=compalgo;
+    m->complevel=complevel;
+    return 0;
+}
+
 // add headers and datblock at the end of the queue
 int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
 {
@@ -159,8 +190,8 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
     }
     
     // make a copy of the static block to dynamic memory
-    if ((dynblock=malloc(m->usedsize)) == NULL)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)m->usedsize);
+    if ((dynblock=bufpool_alloc(&g_bufpool, m->usedsize)) == NULL)
+    {   errprintf("bufpool_alloc(%ld) failed: out of memory\n", (long)m->usedsize);
         return -1;
     }
     memcpy(dynblock, m->data, m->usedsize);
@@ -170,6 +201,13 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
     blkinfo.blkdata=(char*)dynblock;
     blkinfo.blkoffset=0; // no meaning for multi-regfiles
     blkinfo.blkfsid=fsid;
+    blkinfo.blkdictid=g_zstddict[fsid].dictid; // the dictionary is only used if the block is compressed with zstd
+    blkinfo.blkreqalgo=m->compalgo;
+    blkinfo.blkreqlevel=m->complevel;
+    if (m->compalgo==COMPRESS_NONE) // the compression policy says the data must not be compressed
+        blkinfo.blknocomp=true;
+    else
+        blkinfo.blknocomp=entropy_check_block(&g_entropy, (u8*)dynblock, m->usedsize, NULL);
     if (queue_add_block(q, &blkinfo, QITEM_STATUS_TODO)!=0)
     {   errprintf("queue_add_block() failed\n");
         return -1;
@@ -37,6 +37,11 @@ struct s_regmulti
     // common block to be compressed
     char           data[FSA_MAX_BLKSIZE];
     u32            usedsize; // how many bytes are used in data
+    
+    // compression policy shared by all the files of the block
+    int            policyrule; // index of the rule of the compression policy (-1 if no rule matches)
+    u16            compalgo; // algo requested by the rule (COMPRESS_NULL to use the options)
+    int            complevel; // level requested by the rule
 };
 
 int  regmulti_empty(cregmulti *m);
@@ -44,6 +49,8 @@ int  regmulti_init(cregmulti *m, u32 maxblksize);
 int  regmulti_count(cregmulti *m, struct s_dico *header, char *data, u32 datsize);
 bool regmulti_save_enough_space_for_new_file(cregmulti *m, u32 filesize);
 int  regmulti_save_addfile(cregmulti *m, struct s_dico *header, char *data, u32 datsize);
+bool regmulti_save_same_policy(cregmulti *m, int policyrule);
+int  regmulti_save_set_policy(cregmulti *m, int policyrule, u16 compalgo, int complevel);
 int  regmulti_save_enqueue(cregmulti *m, struct s_queue *q, int fsid);
 int  regmulti_rest_addheader(cregmulti *m, struct s_dico *header);
 int  regmulti_rest_setdatablock(cregmulti *m, char *data, u32 datsize);
@@ -25,10 +25,30 @@
 #include "fsarchiver.h"
 #include "syncthread.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "entropy.h"
+#include "zstddict.h"
+#include "adaptlevel.h"
+#include "dedup.h"
 
 // queue use to share data between the three sort of threads
 cqueue g_queue;
 
+// data block buffers which are recycled between the threads
+cbufpool g_bufpool;
+
+// detects incompressible data blocks so that the compression threads don't waste time on them
+centropy g_entropy;
+
+// zstd dictionaries used to compress the blocks of small files of each filesystem
+czstddict g_zstddict[FSA_MAX_FSPERARCH];
+
+// adaptive zstd level controller
+cadaptlevel g_adaptlevel;
+
+// index of the data blocks already archived used by the block deduplication
+cdedup g_dedup;
+
 // filesystem bitmap used by do_extract() to say to threadio_readimg which filesystems to skip
 // eg: "g_fsbitmap[0]=1,g_fsbitmap[1]=0" means that we want to read filesystem 0 and skip fs 1
 u8 g_fsbitmap[FSA_MAX_FSPERARCH];
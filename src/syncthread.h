@@ -18,8 +18,15 @@
 #ifndef __SYNCTHREAD_H__
 #define __SYNCTHREAD_H__
 
+#include "zstddict.h"
+
 // global threads sync data
 extern struct s_queue g_queue; // queue use to share data between the three sort of threads
+extern struct s_bufpool g_bufpool; // data block buffers recycled between the threads
+extern struct s_entropy g_entropy; // detects incompressible data blocks and keeps statistics about it
+extern struct s_adaptlevel g_adaptlevel; // chooses the zstd level of the blocks at runtime
+extern struct s_dedup g_dedup; // index of the data blocks already archived for the deduplication
+extern czstddict g_zstddict[FSA_MAX_FSPERARCH]; // dictionary used by the blocks of small files of each filesystem
 
 // global threads sync functions
 int get_abort(); // returns true if threads must exit because an error or signal received
@@ -31,6 +31,63 @@
 #include "error.h"
 #include "syncthread.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "crypto.h"
+#include "options.h"
+#include "zstddict.h"
+#include "dedup.h"
+
+// write a reference to the first copy of a block in place of a duplicate block
+int thread_writer_blockref(carchwriter *ai, struct s_blockinfo *blkinfo)
+{
+    struct s_headinfo headinfo;
+    s64 position;
+    u32 volume;
+    int res;
+    
+    // the first copy is before the reference in the queue so it has already been written
+    if (dedup_get_location(&g_dedup, blkinfo->blkhash, blkinfo->blkrealsize, &volume, &position)!=0)
+    {   errprintf("cannot find the location of the first copy of the block at blockoffset=%ld\n", (long)blkinfo->blkoffset);
+        return -1;
+    }
+    
+    memset(&headinfo, 0, sizeof(headinfo));
+    if ((headinfo.dico=dico_alloc())==NULL)
+    {   errprintf("dico_alloc() failed\n");
+        return -1;
+    }
+    memcpy(headinfo.magic, FSA_MAGIC_BREF, FSA_SIZEOF_MAGIC);
+    headinfo.fsid=blkinfo->blkfsid;
+    dico_add_u64(headinfo.dico, 0, BLOCKREFKEY_BLOCKOFFSET, blkinfo->blkoffset);
+    dico_add_u32(headinfo.dico, 0, BLOCKREFKEY_REALSIZE, blkinfo->blkrealsize);
+    dico_add_u32(headinfo.dico, 0, BLOCKREFKEY_VOLUME, volume);
+    dico_add_u64(headinfo.dico, 0, BLOCKREFKEY_POSITION, position);
+    
+    res=archwriter_dowrite_header(ai, &headinfo);
+    dico_destroy(headinfo.dico);
+    return res;
+}
+
+// write a zero extent in place of the data blocks of a hole of a sparse file
+int thread_writer_blockzero(carchwriter *ai, struct s_blockinfo *blkinfo)
+{
+    struct s_headinfo headinfo;
+    int res;
+    
+    memset(&headinfo, 0, sizeof(headinfo));
+    if ((headinfo.dico=dico_alloc())==NULL)
+    {   errprintf("dico_alloc() failed\n");
+        return -1;
+    }
+    memcpy(headinfo.magic, FSA_MAGIC_BLKZ, FSA_SIZEOF_MAGIC);
+    headinfo.fsid=blkinfo->blkfsid;
+    dico_add_u64(headinfo.dico, 0, BLOCKZEROKEY_BLOCKOFFSET, blkinfo->blkoffset);
+    dico_add_u32(headinfo.dico, 0, BLOCKZEROKEY_REALSIZE, blkinfo->blkrealsize);
+    
+    res=archwriter_dowrite_header(ai, &headinfo);
+    dico_destroy(headinfo.dico);
+    return res;
+}
 
 void *thread_writer_fct(void *args)
 {
@@ -71,11 +128,31 @@ void *thread_writer_fct(void *args)
             switch (type)
             {
                 case QITEM_TYPE_BLOCK:
+                    if (blkinfo.blkdedup==BLKDEDUP_REF) // duplicate block: it has no data
+                    {
+                        if (thread_writer_blockref(ai, &blkinfo)!=0)
+                        {   msgprintf(MSG_STACK, "thread_writer_blockref() failed\n");
+                            goto thread_writer_fct_error;
+                        }
+                        break;
+                    }
+                    if (blkinfo.blkzero==true) // hole of a sparse file: it has no data
+                    {
+                        if (thread_writer_blockzero(ai, &blkinfo)!=0)
+                        {   msgprintf(MSG_STACK, "thread_writer_blockzero() failed\n");
+                            goto thread_writer_fct_error;
+                        }
+                        break;
+                    }
                     if (archwriter_dowrite_block(ai, &blkinfo)!=0)
                     {   msgprintf(MSG_STACK, "archive_dowrite_block() failed\n");
                         goto thread_writer_fct_error;
                     }
-                    free(blkinfo.blkdata);
+                    if ((blkinfo.blkdedup==BLKDEDUP_FIRST) && (dedup_set_location(&g_dedup, blkinfo.blkhash,
+                        blkinfo.blkrealsize, ai->lastblkvol, ai->lastblkpos)!=0))
+                    {   errprintf("cannot record the location of the block at blockoffset=%ld\n", (long)blkinfo.blkoffset);
+                    }
+                    bufpool_free(&g_bufpool, blkinfo.blkdata);
                     break;
                 case QITEM_TYPE_HEADER:
                     if (archwriter_dowrite_header(ai, &headinfo)!=0)
@@ -96,7 +173,10 @@ void *thread_writer_fct(void *args)
     {   msgprintf(MSG_STACK, "cannot write volume footer: archio_write_volfooter() failed\n");
         goto thread_writer_fct_error;
     }
-    archwriter_close(ai);
+    if (archwriter_close(ai)!=0)
+    {   msgprintf(MSG_STACK, "cannot close the last volume: archwriter_close() failed\n");
+        goto thread_writer_fct_error;
+    }
     msgprintf(MSG_DEBUG1, "THREAD-WRITER: exit success\n");
     dec_secthreads();
     return NULL;
@@ -106,22 +186,228 @@ thread_writer_fct_error:
     set_stopfillqueue(); // say to the create.c thread that it must stop
     while (queue_get_end_of_queue(&g_queue)==false) // wait until all the compression threads exit
         queue_destroy_first_item(&g_queue); // empty queue
-    archwriter_close(ai);
+    if ((ai!=NULL) && (ai->archfd>=0) && (archwriter_close(ai)!=0))
+        msgprintf(MSG_STACK, "archwriter_close() failed\n");
     dec_secthreads();
     return NULL;
 }
 
+// open the base archive of an incremental archive: the contents of the unchanged files are read from there
+int thread_reader_openbase(carchreader *ai, carchreader *baseai, u32 basearchid)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    u8 salt[FSA_AEAD_SALTLEN];
+    cdico *dico=NULL;
+    u32 maxblksize;
+    u16 saltsize;
+    u32 archid;
+    u16 fsid;
+    int ret=-1;
+    
+    if (g_options.basearch[0]==0)
+    {   errprintf("this archive only contains the files which changed since its base archive, the path to the base archive "
+            "must be given on the command line using option '--base'\n");
+        return -1;
+    }
+    
+    path_force_extension(baseai->basepath, PATH_MAX, g_options.basearch, ".fsa");
+    if ((archreader_volpath(baseai)!=0) || (archreader_open(baseai)!=0) || (archreader_read_volheader(baseai)!=0))
+    {   errprintf("cannot open the base archive %s\n", baseai->basepath);
+        return -1;
+    }
+    
+    if ((archreader_read_header(baseai, magic, &dico, false, &fsid)!=FSAERR_SUCCESS) ||
+        (dico_get_u32(dico, 0, MAINHEADKEY_ARCHIVEID, &archid)!=0))
+    {   errprintf("cannot read the main header of the base archive %s\n", baseai->basepath);
+        goto thread_reader_openbase_end;
+    }
+    
+    if (archid!=basearchid)
+    {   errprintf("%s is not the base archive of this archive: archive-id=[%.8x], expected=[%.8x]\n",
+            baseai->basepath, archid, basearchid);
+        goto thread_reader_openbase_end;
+    }
+    baseai->archid=archid;
+    
+    // the buffers and the queue must be able to hold the blocks of both archives
+    if (dico_get_u32(dico, 0, MAINHEADKEY_MAXBLKSIZE, &maxblksize)==0)
+    {
+        if ((maxblksize<FSA_MAX_BLKSIZE) || (maxblksize>FSA_MAX_LONGBLKSIZE))
+        {   errprintf("the size of the blocks in the base archive is invalid: %ld\n", (long)maxblksize);
+            goto thread_reader_openbase_end;
+        }
+        baseai->maxblksize=maxblksize;
+        if (g_options.queuemem==0)
+        {   g_options.queuemem=FSA_LONG_QUEUEMEM(baseai->maxblksize, g_options.compressjobs);
+            queue_set_mem_budget(&g_queue, g_options.queuemem);
+        }
+        bufpool_set_bufsize(&g_bufpool, BUFPOOL_BOUND(max(baseai->maxblksize, ai->maxblksize)));
+    }
+    
+    // the base archive has its own salt so its blocks are decrypted with another key
+    if ((dico_get_u32(dico, 0, MAINHEADKEY_ENCRYPTALGO, &baseai->cryptalgo)==0) && (baseai->cryptalgo==ENCRYPT_AES256GCM) &&
+        (g_options.encryptalgo!=ENCRYPT_NONE))
+    {
+        if ((dico_get_data(dico, 0, MAINHEADKEY_CRYPTSALT, salt, FSA_AEAD_SALTLEN, &saltsize)!=0) || (saltsize!=FSA_AEAD_SALTLEN))
+        {   errprintf("cannot get MAINHEADKEY_CRYPTSALT from the main header of the base archive\n");
+            goto thread_reader_openbase_end;
+        }
+        if (crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_AEAD_SALTLEN,
+            g_options.basekey, FSA_AEAD_KEYLEN)!=0)
+        {   errprintf("crypto_derive_key() failed\n");
+            goto thread_reader_openbase_end;
+        }
+    }
+    
+    msgprintf(MSG_VERB2, "Base archive is [%s]\n", baseai->basepath);
+    ret=0;
+    
+thread_reader_openbase_end:
+    if (dico!=NULL)
+        dico_destroy(dico);
+    return ret;
+}
+
+// queue the blocks and the footer of an unchanged file as they are in the base archive, so
+// that the main thread restores it in the same way as a file which has its data in this archive
+int thread_reader_basefile(carchreader *baseai, carchreader *baserefai, u16 fsid, u32 volume, u64 position, u64 filesize)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    struct s_blockinfo blkinfo;
+    u32 endofarchive=false;
+    cdico *dico=NULL;
+    bool filedone=false;
+    u64 basesize;
+    u16 basefsid;
+    int status;
+    int sumok;
+    s64 lres;
+    
+    // open the volume which contains the file if this is not the one already open
+    if ((baseai->archfd<0) || (baseai->curvol!=volume))
+    {
+        archreader_close(baseai);
+        baseai->curvol=volume;
+        if ((archreader_volpath(baseai)!=0) || (archreader_open(baseai)!=0))
+        {   errprintf("cannot open volume %ld of the base archive\n", (long)volume);
+            return -1;
+        }
+    }
+    
+    if (lseek64(baseai->archfd, (off64_t)position, SEEK_SET)!=(off64_t)position)
+    {   sysprintf("lseek64(pos=%lld, SEEK_SET) failed in volume %s\n", (long long)position, baseai->volpath);
+        return -1;
+    }
+    
+    if ((archreader_read_header(baseai, magic, &dico, false, &basefsid)!=FSAERR_SUCCESS) ||
+        (memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)!=0) ||
+        (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &basesize)!=0) || (basesize!=filesize))
+    {   errprintf("the file is not in the base archive at the location given: volume=%ld, position=%lld\n",
+            (long)volume, (long long)position);
+        if (dico!=NULL)
+            dico_destroy(dico);
+        return -1;
+    }
+    dico_destroy(dico);
+    
+    while (filedone==false)
+    {
+        if (archreader_read_header(baseai, magic, &dico, false, &basefsid)!=FSAERR_SUCCESS)
+        {   errprintf("cannot read the next header in the base archive %s\n", baseai->volpath);
+            if (dico!=NULL)
+                dico_destroy(dico);
+            return -1;
+        }
+        
+        if (strncmp(magic, FSA_MAGIC_VOLF, FSA_SIZEOF_MAGIC)==0) // the file continues in the next volume
+        {
+            archreader_close(baseai);
+            if ((dico_get_u32(dico, 0, VOLUMEFOOTKEY_LASTVOL, &endofarchive)!=0) || (endofarchive==true) ||
+                (archreader_incvolume(baseai, false)!=0) || (archreader_open(baseai)!=0) || (archreader_read_volheader(baseai)!=0))
+            {   errprintf("cannot open volume %ld of the base archive: %s\n", (long)baseai->curvol, baseai->volpath);
+                dico_destroy(dico);
+                return -1;
+            }
+            dico_destroy(dico);
+            continue;
+        }
+        else if (strncmp(magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0) // the footer has the checksum of the file
+        {
+            if ((lres=queue_add_header(&g_queue, dico, magic, fsid))!=FSAERR_SUCCESS)
+            {   msgprintf(MSG_STACK, "queue_add_header()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
+                return -1;
+            }
+            filedone=true;
+            continue;
+        }
+        else if (strncmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)==0)
+        {
+            if (archreader_read_block(baseai, dico, false, &sumok, &blkinfo)!=0)
+            {   msgprintf(MSG_STACK, "archreader_read_block() failed\n");
+                dico_destroy(dico);
+                return -1;
+            }
+        }
+        else if (strncmp(magic, FSA_MAGIC_BREF, FSA_SIZEOF_MAGIC)==0)
+        {
+            if (archreader_read_blockref(baseai, baserefai, dico, &sumok, &blkinfo)!=0)
+            {   msgprintf(MSG_STACK, "archreader_read_blockref() failed\n");
+                dico_destroy(dico);
+                return -1;
+            }
+        }
+        else if (strncmp(magic, FSA_MAGIC_BLKZ, FSA_SIZEOF_MAGIC)==0)
+        {
+            if (archreader_read_blockzero(baseai, dico, &blkinfo)!=0)
+            {   msgprintf(MSG_STACK, "archreader_read_blockzero() failed\n");
+                dico_destroy(dico);
+                return -1;
+            }
+        }
+        else
+        {   errprintf("unexpected header in the base archive: found=[%.4s] where the data of a file were expected\n", magic);
+            dico_destroy(dico);
+            return -1;
+        }
+        dico_destroy(dico);
+        
+        blkinfo.blkfsid=fsid;
+        blkinfo.blkbase=true;
+        status=(((blkinfo.blkzero==false) && (sumok==true))?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
+        if ((lres=queue_add_block(&g_queue, &blkinfo, status))!=FSAERR_SUCCESS)
+        {   if (lres!=FSAERR_NOTOPEN)
+                errprintf("queue_add_block()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
 void *thread_reader_fct(void *args)
 {
+    u8 salt[FSA_AEAD_SALTLEN];
     char magic[FSA_SIZEOF_MAGIC];
     struct s_blockinfo blkinfo;
     u32 endofarchive=false;
     carchreader *ai=NULL;
+    carchreader refai;
+    carchreader baseai;
+    carchreader baserefai;
+    u32 basearchid;
+    u32 basevolume;
+    u64 baseposition;
+    u64 filesize;
+    u32 objtype;
+    bool basefile;
     cdico *dico=NULL;
     int skipblock;
     u16 fsid;
     int sumok;
     int status;
+    u32 maxblksize;
+    u32 cryptalgo;
+    u16 saltsize;
     u64 errors;
     s64 lres;
     int res;
@@ -129,6 +415,9 @@ void *thread_reader_fct(void *args)
     // init
     errors=0;
     inc_secthreads();
+    archreader_init(&refai);
+    archreader_init(&baseai);
+    archreader_init(&baserefai);
 
     if ((ai=(carchreader *)args)==NULL)
     {   errprintf("ai is NULL\n");
@@ -163,6 +452,41 @@ void *thread_reader_fct(void *args)
         goto thread_reader_fct_error;
     }
     
+    // archives created in long mode: the buffers and the queue must be able to hold the large blocks
+    if (dico_get_u32(dico, 0, MAINHEADKEY_MAXBLKSIZE, &maxblksize)==0) // the default size is kept when it's not there
+    {
+        if ((maxblksize<FSA_MAX_BLKSIZE) || (maxblksize>FSA_MAX_LONGBLKSIZE))
+        {   errprintf("the size of the blocks in the archive is invalid: %ld\n", (long)maxblksize);
+            goto thread_reader_fct_error;
+        }
+        ai->maxblksize=maxblksize;
+        if (g_options.queuemem==0)
+        {   g_options.queuemem=FSA_LONG_QUEUEMEM(ai->maxblksize, g_options.compressjobs);
+            queue_set_mem_budget(&g_queue, g_options.queuemem);
+        }
+        bufpool_set_bufsize(&g_bufpool, BUFPOOL_BOUND(ai->maxblksize));
+    }
+    
+    // derive the key before the blocks are queued so that the decompression threads can use it
+    if ((dico_get_u32(dico, 0, MAINHEADKEY_ENCRYPTALGO, &cryptalgo)==0) && (cryptalgo==ENCRYPT_AES256GCM) && (g_options.encryptalgo!=ENCRYPT_NONE))
+    {
+        if ((dico_get_data(dico, 0, MAINHEADKEY_CRYPTSALT, salt, FSA_AEAD_SALTLEN, &saltsize)!=0) || (saltsize!=FSA_AEAD_SALTLEN))
+        {   errprintf("cannot get MAINHEADKEY_CRYPTSALT from main header\n");
+            goto thread_reader_fct_error;
+        }
+        if (crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_AEAD_SALTLEN,
+            g_options.encryptkey, FSA_AEAD_KEYLEN)!=0)
+        {   errprintf("crypto_derive_key() failed\n");
+            goto thread_reader_fct_error;
+        }
+    }
+    
+    // incremental archive: the base archive is required for the files which have not changed
+    if ((dico_get_u32(dico, 0, MAINHEADKEY_BASEARCHID, &basearchid)==0) && (thread_reader_openbase(ai, &baseai, basearchid)!=0))
+    {   msgprintf(MSG_STACK, "thread_reader_openbase() failed\n");
+        goto thread_reader_fct_error;
+    }
+    
     if ((lres=queue_add_header(&g_queue, dico, magic, fsid))!=FSAERR_SUCCESS)
     {   errprintf("queue_add_header()=%ld=%s failed to add the archive header\n", (long)lres, error_int_to_string(lres));
         goto thread_reader_fct_error;
@@ -237,6 +561,7 @@ void *thread_reader_fct(void *args)
                 
                 if (skipblock==false)
                 {
+                    blkinfo.blkfsid=fsid;
                     status=((sumok==true)?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
                     if ((lres=queue_add_block(&g_queue, &blkinfo, status))!=FSAERR_SUCCESS)
                     {   if (lres!=FSAERR_NOTOPEN)
@@ -247,15 +572,83 @@ void *thread_reader_fct(void *args)
                     dico_destroy(dico);
                 }
             }
+            else if (strncmp(magic, FSA_MAGIC_BREF, FSA_SIZEOF_MAGIC)==0) // reference to a duplicate data block
+            {
+                if (g_fsbitmap[fsid]==1)
+                {
+                    // the first copy of the block is read again and passed as if it was stored here
+                    if (archreader_read_blockref(ai, &refai, dico, &sumok, &blkinfo)!=0)
+                    {   msgprintf(MSG_STACK, "archreader_read_blockref() failed\n");
+                        dico_destroy(dico);
+                        goto thread_reader_fct_error;
+                    }
+                    blkinfo.blkfsid=fsid;
+                    status=((sumok==true)?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
+                    if ((lres=queue_add_block(&g_queue, &blkinfo, status))!=FSAERR_SUCCESS)
+                    {   if (lres!=FSAERR_NOTOPEN)
+                            errprintf("queue_add_block()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
+                        dico_destroy(dico);
+                        goto thread_reader_fct_error;
+                    }
+                    if (sumok==false) errors++;
+                }
+                dico_destroy(dico);
+            }
+            else if (strncmp(magic, FSA_MAGIC_BLKZ, FSA_SIZEOF_MAGIC)==0) // hole of a sparse file
+            {
+                if (g_fsbitmap[fsid]==1)
+                {
+                    // there is nothing to decompress: the zeros are written or skipped by the restoration
+                    if (archreader_read_blockzero(ai, dico, &blkinfo)!=0)
+                    {   msgprintf(MSG_STACK, "archreader_read_blockzero() failed\n");
+                        dico_destroy(dico);
+                        goto thread_reader_fct_error;
+                    }
+                    blkinfo.blkfsid=fsid;
+                    if ((lres=queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_DONE))!=FSAERR_SUCCESS)
+                    {   if (lres!=FSAERR_NOTOPEN)
+                            errprintf("queue_add_block()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
+                        dico_destroy(dico);
+                        goto thread_reader_fct_error;
+                    }
+                }
+                dico_destroy(dico);
+            }
+            else if (strncmp(magic, FSA_MAGIC_ZDIC, FSA_SIZEOF_MAGIC)==0) // zstd dictionary of a filesystem
+            {
+                // it must be loaded before the blocks which use it are queued for the decompression threads
+                if ((fsid<FSA_MAX_FSPERARCH) && (g_fsbitmap[fsid]==1) && (zstddict_read_dico(&g_zstddict[fsid], dico)!=0))
+                {   errprintf("cannot load the zstd dictionary of filesystem %d\n", (int)fsid);
+                    errors++;
+                }
+                dico_destroy(dico);
+            }
             else // another higher level header
             {
                 // if it's a global header or a if this local header belongs to a filesystem that the main thread needs
                 if (fsid==FSA_FILESYSID_NULL || g_fsbitmap[fsid]==1)
                 {
+                    // the header is owned by the queue once added: get the location of an unchanged file before
+                    basefile=((strncmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0) &&
+                        (dico_get_u32(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_OBJTYPE, &objtype)==0) && (objtype==OBJTYPE_UNCHANGED));
+                    if ((basefile==true) && ((dico_get_u32(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEVOLUME, &basevolume)!=0) ||
+                        (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_BASEPOSITION, &baseposition)!=0) ||
+                        (dico_get_u64(dico, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &filesize)!=0)))
+                    {   errprintf("cannot get the location of an unchanged file in the base archive\n");
+                        dico_destroy(dico);
+                        goto thread_reader_fct_error;
+                    }
+                    
                     if ((lres=queue_add_header(&g_queue, dico, magic, fsid))!=FSAERR_SUCCESS)
                     {   msgprintf(MSG_STACK, "queue_add_header()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
                         goto thread_reader_fct_error;
                     }
+                    
+                    // the contents of an unchanged file are passed after its header as if they were stored here
+                    if ((basefile==true) && (thread_reader_basefile(&baseai, &baserefai, fsid, basevolume, baseposition, filesize)!=0))
+                    {   msgprintf(MSG_STACK, "thread_reader_basefile() failed\n");
+                        goto thread_reader_fct_error;
+                    }
                 }
                 else // header not used: remove data strucutre in dynamic memory
                 {
@@ -266,6 +659,9 @@ void *thread_reader_fct(void *args)
     }
     
 thread_reader_fct_error:
+    archreader_close(&refai);
+    archreader_close(&baseai);
+    archreader_close(&baserefai);
     msgprintf(MSG_DEBUG1, "THREAD-READER: queue_set_end_of_queue(&g_queue, true)\n");
     queue_set_end_of_queue(&g_queue, true); // don't wait for more data from this thread
     dec_secthreads();
@@ -20,7 +20,10 @@
 
 #include <pthread.h>
 
+struct s_archreader;
+
 void *thread_writer_fct(void *args);
 void *thread_reader_fct(void *args);
+int  thread_reader_openbase(struct s_archreader *ai, struct s_archreader *baseai, u32 basearchid);
 
 #endif // __THREAD_WRITER_H__
@@ -34,16 +34,52 @@
 #include "comp_lzo.h"
 #include "comp_lz4.h"
 #include "comp_zstd.h"
+#include "compctx.h"
 #include "crypto.h"
 #include "syncthread.h"
 #include "thread_comp.h"
+#include "dedup.h"
 #include "error.h"
 #include "queue.h"
+#include "bufpool.h"
+#include "entropy.h"
+#include "zstddict.h"
+#include "adaptlevel.h"
+#include "checksum.h"
 
-int compress_block_generic(struct s_blockinfo *blkinfo)
+// additional authenticated data of a block encrypted with an aead cipher: the fields of
+// the block header which are required to restore the data are authenticated with the data
+void crypt_block_aad(struct s_blockinfo *blkinfo, u8 *aad)
+{
+    // the data of a deduplicated block has been authenticated with the offset of its first copy
+    u64 offset=cpu_to_le64((blkinfo->blkdedup==BLKDEDUP_REF)?(blkinfo->blkrefoffset):(blkinfo->blkoffset));
+    u32 realsize=cpu_to_le32(blkinfo->blkrealsize);
+    u32 compsize=cpu_to_le32(blkinfo->blkcompsize);
+    u16 compalgo=cpu_to_le16(blkinfo->blkcompalgo);
+    
+    memcpy(aad, &offset, sizeof(offset));
+    memcpy(aad+8, &realsize, sizeof(realsize));
+    memcpy(aad+12, &compsize, sizeof(compsize));
+    memcpy(aad+16, &compalgo, sizeof(compalgo));
+}
+
+// how many threads can compress a large block: the threads which have no block to process
+// (eg: a single huge file) are shared between the blocks being compressed
+int compress_block_workers()
+{
+    s64 count;
+    
+    if ((count=queue_count_items_todo(&g_queue))<1)
+        count=1;
+    return max(g_options.compressjobs/count, 1);
+}
+
+int compress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx, ccryptctx *cryptctx)
 {
     char *bufcomp=NULL;
+    bool adaptive=false;
     int attempt=0;
+    u64 cputime;
     int compalgo;
     int complevel;
     u64 compsize;
@@ -56,247 +92,346 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
 #endif
 
     bufsize = (blkinfo->blkrealsize) + (blkinfo->blkrealsize / 16) + 64 + 3; // alloc bigger buffer else lzo will crash
-    if ((bufcomp=malloc(bufsize))==NULL)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize);
-        return -1;
+
+    if (blkinfo->blknocomp==true) // the entropy estimator found the block is not worth compressing
+    {
+        res=FSAERR_SUCCESS;
+        compsize=blkinfo->blkrealsize;
     }
+    else
+    {
+        if ((bufcomp=bufpool_alloc(&g_bufpool, bufsize))==NULL)
+        {   errprintf("bufpool_alloc(%ld) failed: out of memory\n", (long)bufsize);
+            return -1;
+        }
 
-    // compression level/algo to use for the first attempt
-    compalgo=g_options.compressalgo;
-    complevel=g_options.compresslevel;
+        // compression level/algo to use for the first attempt
+        if (blkinfo->blkreqalgo!=COMPRESS_NULL) // chosen by the compression policy
+        {   compalgo=blkinfo->blkreqalgo;
+            complevel=blkinfo->blkreqlevel;
+        }
+        else
+        {   compalgo=g_options.compressalgo;
+            complevel=g_options.compresslevel;
+            if ((compalgo==COMPRESS_ZSTD) && (adaptlevel_enabled(&g_adaptlevel)==true))
+            {   complevel=adaptlevel_get_level(&g_adaptlevel); // chosen using the state of the queue
+                adaptive=true;
+            }
+        }
+        cputime=entropy_thread_cputime();
 
-    // compress the block
-    do
-    {
-        switch (compalgo)
+        // compress the block
+        do
         {
+            switch (compalgo)
+            {
 #ifdef OPTION_LZO_SUPPORT
-            case COMPRESS_LZO:
-                res=compress_block_lzo(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_LZO;
-                break;
+                case COMPRESS_LZO:
+                    res=compress_block_lzo(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_LZO;
+                    break;
 #endif // OPTION_LZO_SUPPORT
-            case COMPRESS_GZIP:
-                res=compress_block_gzip(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_GZIP;
-                break;
-            case COMPRESS_BZIP2:
-                res=compress_block_bzip2(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_BZIP2;
-                break;
+                case COMPRESS_GZIP:
+                    res=compress_block_gzip(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_GZIP;
+                    break;
+                case COMPRESS_BZIP2:
+                    res=compress_block_bzip2(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_BZIP2;
+                    break;
 #ifdef OPTION_LZMA_SUPPORT
-            case COMPRESS_LZMA:
-                res=compress_block_lzma(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_LZMA;
-                break;
+                case COMPRESS_LZMA:
+                    res=compress_block_lzma(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_LZMA;
+                    break;
 #endif // OPTION_LZMA_SUPPORT
 #ifdef OPTION_LZ4_SUPPORT
-            case COMPRESS_LZ4:
-                res=compress_block_lz4(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_LZ4;
-                break;
+                case COMPRESS_LZ4:
+                    res=compress_block_lz4(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_LZ4;
+                    break;
 #endif // OPTION_LZ4_SUPPORT
 #ifdef OPTION_ZSTD_SUPPORT
-            case COMPRESS_ZSTD:
-                res=compress_block_zstd(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
-                blkinfo->blkcompalgo=COMPRESS_ZSTD;
-                break;
+                case COMPRESS_ZSTD:
+                    if ((blkinfo->blkdictid!=0) && (g_zstddict[blkinfo->blkfsid].dictid==blkinfo->blkdictid)) // block of small files
+                        res=compress_block_zstd_dict(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, &g_zstddict[blkinfo->blkfsid]);
+                    else if (blkinfo->blkrealsize>FSA_MAX_BLKSIZE) // block of the long mode
+                        res=compress_block_zstd_long(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel, compress_block_workers());
+                    else
+                        res=compress_block_zstd(ctx, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkcompalgo=COMPRESS_ZSTD;
+                    break;
 #endif // OPTION_ZSTD_SUPPORT
-            default:
-                free(bufcomp);
-                errprintf("unsupported compression algorithm: %d\n", compalgo);
-                return -1;
-        }
+                default:
+                    bufpool_free(&g_bufpool, bufcomp);
+                    errprintf("unsupported compression algorithm: %d\n", compalgo);
+                    return -1;
+            }
 
-        // retry if high compression was used and compression failed because of FSAERR_ENOMEM
-        // at this point, if zstd is not supported, compalgo == COMPRESS_ZSTD cannot be true
-        if (res == FSAERR_ENOMEM && ((compalgo == COMPRESS_ZSTD && complevel > FSA_DEF_COMPRESS_LEVEL) ||
-                                      compalgo != FSA_DEF_COMPRESS_ALGO))
-        {
-            errprintf("attempt to compress the current block using an alternative algorithm (\"%s%d\")\n",
-                      zstd ? "-Z" : "-z", zstd ? FSA_DEF_COMPRESS_LEVEL : FSA_DEF_FSACOMP_LEVEL);
-            compalgo = FSA_DEF_COMPRESS_ALGO;
-            complevel = FSA_DEF_COMPRESS_LEVEL;
-        }
+            // retry if high compression was used and compression failed because of FSAERR_ENOMEM
+            // at this point, if zstd is not supported, compalgo == COMPRESS_ZSTD cannot be true
+            if (res == FSAERR_ENOMEM && ((compalgo == COMPRESS_ZSTD && complevel > FSA_DEF_COMPRESS_LEVEL) ||
+                                          compalgo != FSA_DEF_COMPRESS_ALGO))
+            {
+                errprintf("attempt to compress the current block using an alternative algorithm (\"%s%d\")\n",
+                          zstd ? "-Z" : "-z", zstd ? FSA_DEF_COMPRESS_LEVEL : FSA_DEF_FSACOMP_LEVEL);
+                compalgo = FSA_DEF_COMPRESS_ALGO;
+                complevel = FSA_DEF_COMPRESS_LEVEL;
+            }
+
+        } while ((res == FSAERR_ENOMEM) && (attempt++ == 0));
 
-    } while ((res == FSAERR_ENOMEM) && (attempt++ == 0));
+        entropy_account_compression(&g_entropy, blkinfo->blkrealsize, entropy_thread_cputime()-cputime,
+            (res==FSAERR_SUCCESS) && (compsize < blkinfo->blkrealsize));
+        if ((adaptive==true) && (res==FSAERR_SUCCESS))
+            adaptlevel_account(&g_adaptlevel, complevel, blkinfo->blkrealsize, min(compsize, blkinfo->blkrealsize));
+    }
 
     // check compression status and efficiency
     if ((res==FSAERR_SUCCESS) && (compsize < blkinfo->blkrealsize)) // compression worked and saved space
-    {   free(blkinfo->blkdata); // free old buffer (with uncompressed data)
+    {   bufpool_free(&g_bufpool, blkinfo->blkdata); // free old buffer (with uncompressed data)
         blkinfo->blkdata=bufcomp; // new buffer (with compressed data)
         blkinfo->blkcompsize=compsize; // size after compression and before encryption
         blkinfo->blkarsize=compsize; // in case there is no encryption to set this
         //errprintf("COMP_DBG: block successfully compressed using algorithm %d level %d\n", compalgo, complevel);
     }
-    else // compressed version is bigger or compression failed: keep the original block
-    {   memcpy(bufcomp, blkinfo->blkdata, blkinfo->blkrealsize);
-        free(blkinfo->blkdata); // free old buffer
-        blkinfo->blkdata=bufcomp; // new buffer
+    else // compressed version is bigger, compression failed or was skipped: keep the original block
+    {   if (bufcomp!=NULL)
+            bufpool_free(&g_bufpool, bufcomp); // compressed data are not used
+        bufcomp=blkinfo->blkdata; // the original buffer is stored as it is without any copy
         blkinfo->blkcompsize=blkinfo->blkrealsize; // size after compression and before encryption
         blkinfo->blkarsize=blkinfo->blkrealsize;  // in case there is no encryption to set this
         blkinfo->blkcompalgo=COMPRESS_NONE;
         //errprintf("COMP_DBG: block copied uncompressed, attempted using algorithm %d level %d\n", compalgo, complevel);
     }
 
+    // the zstd dictionary is only used by blocks which have been compressed with zstd
+    if ((blkinfo->blkcompalgo!=COMPRESS_ZSTD) || (g_zstddict[blkinfo->blkfsid].dictid!=blkinfo->blkdictid))
+        blkinfo->blkdictid=0;
+
     u64 cryptsize;
     char *bufcrypt=NULL;
     if (g_options.encryptalgo==ENCRYPT_BLOWFISH)
     {
-        if ((bufcrypt=malloc(bufsize+8))==NULL)
-        {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize+8);
+        if ((bufcrypt=bufpool_alloc(&g_bufpool, bufsize+8))==NULL)
+        {   errprintf("bufpool_alloc(%ld) failed: out of memory\n", (long)bufsize+8);
             return -1;
         }
-        if ((res=crypto_blowfish(blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt,
+        if ((res=crypto_blowfish_ctx(cryptctx, blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt,
             g_options.encryptpass, strlen((char*)g_options.encryptpass), 1))!=0)
         {   errprintf("crypt_block_blowfish() failed with res=%d\n", res);
+            bufpool_free(&g_bufpool, bufcrypt);
             return -1;
         }
-        free(bufcomp);
+        bufpool_free(&g_bufpool, bufcomp);
         blkinfo->blkdata=bufcrypt;
         blkinfo->blkarsize=cryptsize;
         blkinfo->blkcryptalgo=ENCRYPT_BLOWFISH;
     }
+    else if (g_options.encryptalgo==ENCRYPT_AES256GCM)
+    {
+        u8 aad[FSA_AEAD_AADLEN];
+        if ((bufcrypt=bufpool_alloc(&g_bufpool, bufsize+FSA_AEAD_TAGLEN))==NULL)
+        {   errprintf("bufpool_alloc(%ld) failed: out of memory\n", (long)bufsize+FSA_AEAD_TAGLEN);
+            return -1;
+        }
+        crypto_nonce(blkinfo->blkcryptnonce, FSA_AEAD_NONCELEN);
+        crypt_block_aad(blkinfo, aad);
+        if ((res=crypto_aes256gcm_ctx(cryptctx, blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt,
+            g_options.encryptkey, blkinfo->blkcryptnonce, aad, sizeof(aad), 1))!=0)
+        {   errprintf("crypto_aes256gcm_ctx() failed with res=%d\n", res);
+            bufpool_free(&g_bufpool, bufcrypt);
+            return -1;
+        }
+        bufpool_free(&g_bufpool, bufcomp);
+        blkinfo->blkdata=bufcrypt;
+        blkinfo->blkarsize=cryptsize;
+        blkinfo->blkcryptalgo=ENCRYPT_AES256GCM;
+    }
     else
     {
         blkinfo->blkcryptalgo=ENCRYPT_NONE;
     }
 
     // calculates the final block checksum (block as it will be stored in the archive)
-    blkinfo->blkarcsum=fletcher32((void*)blkinfo->blkdata, blkinfo->blkarsize);
+    // the authentication tag already protects blocks encrypted with an aead cipher
+    // older versions only know fletcher32: crc32c is only used when it is selected with --checksum
+    blkinfo->blksumalgo=g_options.sumalgo;
+    if (blkinfo->blkcryptalgo==ENCRYPT_AES256GCM)
+        blkinfo->blkarcsum=0;
+    else if (blkinfo->blksumalgo==SUMALGO_CRC32C)
+        blkinfo->blkarcsum=crc32c((void*)blkinfo->blkdata, blkinfo->blkarsize);
+    else
+        blkinfo->blkarcsum=fletcher32((void*)blkinfo->blkdata, blkinfo->blkarsize);
 
     return 0;
 }
 
-int decompress_block_generic(struct s_blockinfo *blkinfo)
+// replace the data of a corrupt block with zeros (the file is restored with a hole in place of the block)
+int decompress_block_zero(struct s_blockinfo *blkinfo)
+{
+    char *bufzero;
+    
+    // the buffer received from the reader has a capacity of blkarsize bytes: reuse it when it is big enough
+    if (blkinfo->blkarsize>=blkinfo->blkrealsize)
+    {   memset(blkinfo->blkdata, 0, blkinfo->blkrealsize);
+        return 0;
+    }
+    
+    if ((bufzero=bufpool_alloc(&g_bufpool, blkinfo->blkrealsize))==NULL)
+    {   errprintf("bufpool_alloc(%ld) failed: cannot allocate memory for uncompressed block\n", (long)blkinfo->blkrealsize);
+        return -1;
+    }
+    memset(bufzero, 0, blkinfo->blkrealsize);
+    bufpool_free(&g_bufpool, blkinfo->blkdata);
+    blkinfo->blkdata=bufzero;
+    return 0;
+}
+
+int decompress_block_generic(struct s_blockinfo *blkinfo, ccompctx *ctx, ccryptctx *cryptctx)
 {
     u64 checkorigsize;
     char *bufcomp=NULL;
+    u64 clearsize;
     int res;
 
-    // allocate memory for uncompressed data
-    if ((bufcomp=malloc(blkinfo->blkrealsize))==NULL)
-    {   errprintf("malloc(%ld) failed: cannot allocate memory for compressed block\n", (long)blkinfo->blkrealsize);
+    // the checksum has been verified by the reader: the corrupt blocks are replaced with zeros and not queued here
+    if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
+    {   msgprintf(MSG_DEBUG1, "this archive has been encrypted, you have to provide a password "
+            "on the command line using option '-c'\n");
         return -1;
     }
 
-    // check the block checksum
-    if (fletcher32((u8*)blkinfo->blkdata, blkinfo->blkarsize)!=(blkinfo->blkarcsum))
-    {   errprintf("block is corrupt at blockoffset=%ld, blksize=%ld\n", (long)blkinfo->blkoffset, (long)blkinfo->blkrealsize);
-        memset(bufcomp, 0, blkinfo->blkrealsize);
-    }
-    else // data not corrupted, decompresses the block
+    // the block is decrypted in place: the buffer which has been filled by the reader with the
+    // encrypted data then holds the compressed data, so decryption does not require another buffer
+    if (blkinfo->blkcryptalgo==ENCRYPT_BLOWFISH)
     {
-        if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
-        {   msgprintf(MSG_DEBUG1, "this archive has been encrypted, you have to provide a password "
-                "on the command line using option '-c'\n");
-            free (bufcomp);
+        if ((res=crypto_blowfish_ctx(cryptctx, blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)blkinfo->blkdata,
+            g_options.encryptpass, strlen((char*)g_options.encryptpass), 0))!=0)
+        {   errprintf("crypt_block_blowfish() failed\n");
             return -1;
         }
+        if (clearsize!=blkinfo->blkcompsize)
+        {   errprintf("clearsize does not match blkcompsize: clearsize=%ld and blkcompsize=%ld\n",
+                (long)clearsize, (long)blkinfo->blkcompsize);
+            return -1;
+        }
+    }
+    else if (blkinfo->blkcryptalgo==ENCRYPT_AES256GCM)
+    {
+        u8 aad[FSA_AEAD_AADLEN];
+        crypt_block_aad(blkinfo, aad);
+        if ((crypto_aes256gcm_ctx(cryptctx, blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)blkinfo->blkdata,
+            (blkinfo->blkbase==true)?(g_options.basekey):(g_options.encryptkey), blkinfo->blkcryptnonce, aad, sizeof(aad), 0)!=0) || (clearsize!=blkinfo->blkcompsize))
+        {   // the authentication tag does not match: the block or its header has been modified
+            errprintf("block is corrupt at blockoffset=%ld, blksize=%ld\n", (long)blkinfo->blkoffset, (long)blkinfo->blkrealsize);
+            return decompress_block_zero(blkinfo);
+        }
+    }
 
-        char *bufcrypt=NULL;
-        u64 clearsize;
-        if (blkinfo->blkcryptalgo==ENCRYPT_BLOWFISH)
-        {
-            if ((bufcrypt=malloc(blkinfo->blkrealsize+8))==NULL)
-            {   errprintf("malloc(%ld) failed: out of memory\n", (long)blkinfo->blkrealsize+8);
-                free(bufcomp);
-                return -1;
-            }
-            if ((res=crypto_blowfish(blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt,
-                g_options.encryptpass, strlen((char*)g_options.encryptpass), 0))!=0)
-            {   errprintf("crypt_block_blowfish() failed\n");
-                free(bufcomp);
-                return -1;
-            }
-            if (clearsize!=blkinfo->blkcompsize)
-            {   errprintf("clearsize does not match blkcompsize: clearsize=%ld and blkcompsize=%ld\n",
-                    (long)clearsize, (long)blkinfo->blkcompsize);
-                free(bufcomp);
-                return -1;
-            }
-            free(blkinfo->blkdata);
-            blkinfo->blkdata=bufcrypt;
+    // blocks which are not compressed are passed to the writer with no copy: the ownership
+    // of the buffer received from the reader is transferred with the block
+    if (blkinfo->blkcompalgo==COMPRESS_NONE)
+    {
+        if (blkinfo->blkcompsize!=blkinfo->blkrealsize)
+        {   errprintf("block is corrupt at blockoffset=%ld: blkcompsize=%ld does not match blkrealsize=%ld\n",
+                (long)blkinfo->blkoffset, (long)blkinfo->blkcompsize, (long)blkinfo->blkrealsize);
+            return decompress_block_zero(blkinfo);
         }
+        return 0;
+    }
 
-        switch (blkinfo->blkcompalgo)
-        {
-            case COMPRESS_NONE:
-                memcpy(bufcomp, blkinfo->blkdata, blkinfo->blkarsize);
-                res=0;
-                break;
+    // allocate memory for uncompressed data (recycled from the buffers released by the writer)
+    if ((bufcomp=bufpool_alloc(&g_bufpool, blkinfo->blkrealsize))==NULL)
+    {   errprintf("bufpool_alloc(%ld) failed: cannot allocate memory for uncompressed block\n", (long)blkinfo->blkrealsize);
+        return -1;
+    }
+
+    switch (blkinfo->blkcompalgo)
+    {
 #ifdef OPTION_LZO_SUPPORT
-            case COMPRESS_LZO:
-                if ((res=uncompress_block_lzo(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_lzo()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
+        case COMPRESS_LZO:
+            if ((res=uncompress_block_lzo(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            {   errprintf("uncompress_block_lzo()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
 #endif // OPTION_LZO_SUPPORT
-            case COMPRESS_GZIP:
-                if ((res=uncompress_block_gzip(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_gzip()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
-            case COMPRESS_BZIP2:
-                if ((res=uncompress_block_bzip2(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_bzip2()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
+        case COMPRESS_GZIP:
+            if ((res=uncompress_block_gzip(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            {   errprintf("uncompress_block_gzip()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
+        case COMPRESS_BZIP2:
+            if ((res=uncompress_block_bzip2(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            {   errprintf("uncompress_block_bzip2()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
 #ifdef OPTION_LZMA_SUPPORT
-            case COMPRESS_LZMA:
-                if ((res=uncompress_block_lzma(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_lzma()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
+        case COMPRESS_LZMA:
+            if ((res=uncompress_block_lzma(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            {   errprintf("uncompress_block_lzma()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
 #endif // OPTION_LZMA_SUPPORT
 #ifdef OPTION_LZ4_SUPPORT
-            case COMPRESS_LZ4:
-                if ((res=uncompress_block_lz4(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_lz4()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
+        case COMPRESS_LZ4:
+            if ((res=uncompress_block_lz4(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+            {   errprintf("uncompress_block_lz4()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
 #endif // OPTION_LZ4_SUPPORT
 #ifdef OPTION_ZSTD_SUPPORT
-            case COMPRESS_ZSTD:
-                if ((res=uncompress_block_zstd(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
-                {   errprintf("uncompress_block_zstd()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
-                        res, (long)blkinfo->blkarsize, (long)checkorigsize);
-                    memset(bufcomp, 0, blkinfo->blkrealsize);
-                    // TODO: inc(error_counter);
-                }
-                break;
+        case COMPRESS_ZSTD:
+            if ((blkinfo->blkdictid!=0) && (g_zstddict[blkinfo->blkfsid].dictid!=blkinfo->blkdictid))
+            {   errprintf("the zstd dictionary %08x required to decompress block at blockoffset=%ld is not available\n",
+                    (unsigned int)blkinfo->blkdictid, (long)blkinfo->blkoffset);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+            }
+            else if ((res=((blkinfo->blkdictid!=0)?
+                (uncompress_block_zstd_dict(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata, &g_zstddict[blkinfo->blkfsid])):
+                (uncompress_block_zstd(ctx, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))))!=0)
+            {   errprintf("uncompress_block_zstd()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
+                    res, (long)blkinfo->blkarsize, (long)checkorigsize);
+                memset(bufcomp, 0, blkinfo->blkrealsize);
+                // TODO: inc(error_counter);
+            }
+            break;
 #endif // OPTION_ZSTD_SUPPORT
-            default:
-                errprintf("unsupported compression algorithm: %d\n", blkinfo->blkcompalgo);
-                return -1;
-        }
-        free(blkinfo->blkdata); // free old buffer (with compressed data)
-        blkinfo->blkdata=bufcomp; // pointer to new buffer with uncompressed data
+        default:
+            errprintf("unsupported compression algorithm: %d\n", blkinfo->blkcompalgo);
+            bufpool_free(&g_bufpool, bufcomp);
+            return -1;
     }
+    bufpool_free(&g_bufpool, blkinfo->blkdata); // free old buffer (with compressed data)
+    blkinfo->blkdata=bufcomp; // pointer to new buffer with uncompressed data
     return 0;
 }
 
 int compression_function(int oper)
 {
     struct s_blockinfo blkinfo;
+    ccryptctx cryptctx;
+    ccompctx ctx;
     s64 blknum;
     int res;
 
+    compctx_init(&ctx);
+    cryptctx_init(&cryptctx);
     while (queue_get_end_of_queue(&g_queue)==false)
     {
         if ((blknum=queue_get_first_block_todo(&g_queue, &blkinfo))>0) // block found
@@ -304,10 +439,10 @@ int compression_function(int oper)
             switch (oper)
             {
                 case COMPTHR_COMPRESS:
-                    res=compress_block_generic(&blkinfo);
+                    res=compress_block_generic(&blkinfo, &ctx, &cryptctx);
                     break;
                 case COMPTHR_DECOMPRESS:
-                    res=decompress_block_generic(&blkinfo);
+                    res=decompress_block_generic(&blkinfo, &ctx, &cryptctx);
                     break;
                 default:
                     errprintf("oper is invalid: %d\n", oper);
@@ -322,10 +457,14 @@ int compression_function(int oper)
         }
     }
 
+    compctx_destroy(&ctx);
+    cryptctx_destroy(&cryptctx);
     msgprintf(MSG_DEBUG1, "THREAD-COMP: exit success\n");
     return 0;
 
 thread_comp_fct_error:
+    compctx_destroy(&ctx);
+    cryptctx_destroy(&cryptctx);
     get_stopfillqueue();
     msgprintf(MSG_DEBUG1, "THREAD-COMP: exit error\n");
     return 0;
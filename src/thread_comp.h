@@ -20,7 +20,10 @@
 
 enum {COMPTHR_COMPRESS=1, COMPTHR_DECOMPRESS=2};
 
+struct s_blockinfo;
+
 void *thread_comp_fct(void *args);
 void *thread_decomp_fct(void *args);
+void crypt_block_aad(struct s_blockinfo *blkinfo, u8 *aad);
 
 #endif // __THREAD_COMP_H__
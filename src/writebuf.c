@@ -30,6 +30,23 @@
 #include "error.h"
 #include "queue.h"
 #include "dico.h"
+#include "checksum.h"
+
+void writebuf_init(cwritebuf *wb)
+{
+    wb->data=wb->inlbuf;
+    wb->size=0;
+    wb->capacity=sizeof(wb->inlbuf);
+    wb->extdata=NULL;
+    wb->extsize=0;
+}
+
+void writebuf_release(cwritebuf *wb)
+{
+    if (wb->data && wb->data!=wb->inlbuf)
+        free(wb->data);
+    writebuf_init(wb);
+}
 
 cwritebuf *writebuf_alloc()
 {
@@ -38,8 +55,7 @@ cwritebuf *writebuf_alloc()
     {   errprintf("malloc(%d) failed: cannot allocate memory for writebuf\n", (int)sizeof(cwritebuf));
         return NULL;
     }
-    wb->size=0;
-    wb->data=NULL;
+    writebuf_init(wb);
     return wb;
 }
 
@@ -50,20 +66,46 @@ int writebuf_destroy(cwritebuf *wb)
         return -1;
     }
     
-    if (wb->data)
+    writebuf_release(wb);
+    free(wb);
+    return 0;
+}
+
+u64 writebuf_get_size(cwritebuf *wb)
+{
+    return wb->size+wb->extsize;
+}
+
+// make sure there is space for size more bytes after the data already in the buffer
+int writebuf_reserve(cwritebuf *wb, u64 size)
+{
+    u64 newcapacity;
+    char *newdata;
+    
+    if (wb->size+size+4 <= wb->capacity) // "+4" required else the last byte of the buffer may be alterred (see release-0.3.3)
+        return 0;
+    
+    for (newcapacity=wb->capacity; newcapacity < wb->size+size+4; newcapacity*=2);
+    if (wb->data==wb->inlbuf)
     {
-        free(wb->data);
-        wb->data=NULL;
+        if ((newdata=malloc(newcapacity))!=NULL)
+            memcpy(newdata, wb->data, wb->size);
     }
-    wb->size=0;
-    free(wb);
+    else
+    {
+        newdata=realloc(wb->data, newcapacity);
+    }
+    if (!newdata)
+    {   errprintf("realloc(oldsize=%ld, newsize=%ld) failed\n", (long)wb->capacity, (long)newcapacity);
+        return -1;
+    }
+    wb->data=newdata;
+    wb->capacity=newcapacity;
     return 0;
 }
 
 int writebuf_add_data(cwritebuf *wb, void *data, u64 size)
 {
-    u64 newsize;
-    
     if (wb==NULL)
     {   errprintf("wb is NULL\n");
         return -1;
@@ -74,12 +116,8 @@ int writebuf_add_data(cwritebuf *wb, void *data, u64 size)
         return -1;
     }
     
-    newsize=wb->size+size;
-    wb->data=realloc(wb->data, newsize+4); // "+4" required else the last byte of the buffer may be alterred (see release-0.3.3)
-    if (!wb->data)
-    {   errprintf("realloc(oldsize=%ld, newsize=%ld) failed\n", (long)wb->size, (long)newsize+4);
+    if (writebuf_reserve(wb, size)!=0)
         return -1;
-    }
     memcpy(wb->data+wb->size, data, size);
     
     wb->size+=size;
@@ -94,6 +132,7 @@ int writebuf_add_dico(cwritebuf *wb, cdico *d, char *magic)
     u32 checksum;
     u8 *buffer;
     u8 *bufpos;
+    u64 oldsize;
     u16 temp16;
     u32 temp32;
     u16 count;
@@ -125,12 +164,15 @@ int writebuf_add_dico(cwritebuf *wb, cdico *d, char *magic)
     }
     msgprintf(MSG_DEBUG2, "calculated headerlen for that dico: headerlen=%d\n", (int)headerlen);
     
-    // 3. allocate memory for header
-    bufpos=buffer=malloc(headerlen);
-    if (!buffer)
+    // 3. reserve space for header-len, header-data, header-checksum and write them in place
+    oldsize=wb->size;
+    if (writebuf_reserve(wb, sizeof(u32)+headerlen+sizeof(u32))!=0)
     {   errprintf("cannot allocate memory for buffer");
         return -1;
     }
+    temp32=cpu_to_le32(headerlen);
+    memcpy(wb->data+oldsize, &temp32, sizeof(temp32));
+    bufpos=buffer=(u8*)wb->data+oldsize+sizeof(u32);
     
     // 4. write items count in buffer
     temp16=cpu_to_le16(count);
@@ -163,26 +205,12 @@ int writebuf_add_dico(cwritebuf *wb, cdico *d, char *magic)
     }
     msgprintf(MSG_DEBUG2, "all %d items mempcopied to buffer\n", (int)itemnum);
     
-    // 6. write header-len, header-data, header-checksum
-    temp32=cpu_to_le32(headerlen);
-    if (writebuf_add_data(wb, &temp32, sizeof(temp32))!=0)
-    {   free(buffer);
-        return -1;
-    }
-    
-    if (writebuf_add_data(wb, buffer, headerlen)!=0)
-    {   free(buffer);
-        return -1;
-    }
-    
+    // 6. write header-checksum after header-data
     checksum=fletcher32(buffer, headerlen);
     temp32=cpu_to_le32(checksum);
-    if (writebuf_add_data(wb, &temp32, sizeof(temp32))!=0)
-    {   free(buffer);
-        return -1;
-    }
+    memcpy(bufpos, &temp32, sizeof(temp32));
+    wb->size=oldsize+sizeof(u32)+headerlen+sizeof(u32);
     
-    free(buffer);
     msgprintf(MSG_DEBUG2, "end of archio_write_dico(wb=%p, dico=%p, magic=[%c%c%c%c])\n", wb, d, magic[0], magic[1], magic[2], magic[3]);
     
     return 0;
@@ -253,8 +281,14 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARSIZE, blkinfo->blkarsize);
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_COMPSIZE, blkinfo->blkcompsize);
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, blkinfo->blkarcsum);
+    if (blkinfo->blksumalgo!=SUMALGO_FLETCHER32)
+        dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_SUMALGO, blkinfo->blksumalgo);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_COMPRESSALGO, blkinfo->blkcompalgo);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_ENCRYPTALGO, blkinfo->blkcryptalgo);
+    if (blkinfo->blkcryptalgo==ENCRYPT_AES256GCM)
+        dico_add_data(blkdico, 0, BLOCKHEADITEMKEY_CRYPTNONCE, blkinfo->blkcryptnonce, FSA_AEAD_NONCELEN);
+    if (blkinfo->blkdictid!=0)
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ZSTDDICTID, blkinfo->blkdictid);
     
     // write block header
     res=writebuf_add_header(wb, blkdico, FSA_MAGIC_BLKH, archid, fsid);
@@ -264,11 +298,9 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
         return -1;
     }
     
-    // write block data
-    if (writebuf_add_data(wb, blkinfo->blkdata, blkinfo->blkarsize)!=0)
-    {   msgprintf(MSG_STACK, "cannot write data block: writebuf_add_data() failed\n");
-        return -1;
-    }
+    // reference block data: it is passed to writev() with the header so it is not copied
+    wb->extdata=blkinfo->blkdata;
+    wb->extsize=blkinfo->blkarsize;
     
     return 0;
 }
@@ -24,13 +24,23 @@ struct s_blockinfo;
 struct s_writebuf;
 typedef struct s_writebuf cwritebuf;
 
+#define WRITEBUF_INLINE_SIZE 512 // large enough for the headers of all data blocks
+
 struct s_writebuf
-{   char *data;
-    u64  size;
+{   char *data; // points to inlbuf until the contents grow beyond WRITEBUF_INLINE_SIZE
+    u64  size; // number of bytes used in data
+    u64  capacity; // number of bytes available in data
+    char *extdata; // payload which is referenced and not copied (data of a block)
+    u64  extsize; // number of bytes in extdata
+    char inlbuf[WRITEBUF_INLINE_SIZE];
 };
 
 cwritebuf *writebuf_alloc();
 int writebuf_destroy(cwritebuf *wb);
+void writebuf_init(cwritebuf *wb);
+void writebuf_release(cwritebuf *wb);
+u64 writebuf_get_size(cwritebuf *wb);
+int writebuf_reserve(cwritebuf *wb, u64 size);
 int writebuf_add_data(cwritebuf *wb, void *data, u64 size);
 int writebuf_add_dico(cwritebuf *wb, struct s_dico *d, char *magic);
 int writebuf_add_header(cwritebuf *wb, struct s_dico *d, char *magic, u32 archid, u16 fsid);
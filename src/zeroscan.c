@@ -0,0 +1,117 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define ZEROSCAN_X86
+#  include <immintrin.h>
+#endif
+
+#include "fsarchiver.h"
+#include "zeroscan.h"
+#include "common.h"
+#include "error.h"
+
+static bool (*zeroscan_fct)(const u8 *data, u64 len)=NULL;
+static pthread_once_t zeroscan_once=PTHREAD_ONCE_INIT;
+
+// portable version which reads the data as 64bit words
+bool zeroscan_generic(const u8 *data, u64 len)
+{
+    u64 acc=0;
+    u64 word;
+    u64 pos;
+    
+    for (pos=0; pos+sizeof(u64)<=len; pos+=sizeof(u64))
+    {   memcpy(&word, data+pos, sizeof(u64));
+        acc|=word;
+        if (((pos&1023)==1016) && (acc!=0)) // stop early once in a while
+            return false;
+    }
+    for (; pos<len; pos++)
+        acc|=data[pos];
+    
+    return (acc==0);
+}
+
+#ifdef ZEROSCAN_X86
+__attribute__((target("sse2"))) bool zeroscan_sse2(const u8 *data, u64 len)
+{
+    __m128i acc;
+    u64 pos;
+    
+    for (pos=0; pos+64<=len; pos+=64)
+    {
+        acc=_mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)(data+pos)), _mm_loadu_si128((const __m128i*)(data+pos+16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i*)(data+pos+32)), _mm_loadu_si128((const __m128i*)(data+pos+48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))!=0xFFFF)
+            return false;
+    }
+    
+    return zeroscan_generic(data+pos, len-pos);
+}
+
+__attribute__((target("avx2"))) bool zeroscan_avx2(const u8 *data, u64 len)
+{
+    __m256i acc;
+    u64 pos;
+    
+    for (pos=0; pos+128<=len; pos+=128)
+    {
+        acc=_mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((const __m256i*)(data+pos)), _mm256_loadu_si256((const __m256i*)(data+pos+32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(data+pos+64)), _mm256_loadu_si256((const __m256i*)(data+pos+96))));
+        if (_mm256_testz_si256(acc, acc)==0)
+            return false;
+    }
+    
+    return zeroscan_generic(data+pos, len-pos);
+}
+#endif // ZEROSCAN_X86
+
+// choose the fastest version supported by the cpu (it's only done once)
+void zeroscan_select()
+{
+    char *name="generic";
+    
+    zeroscan_fct=zeroscan_generic;
+#ifdef ZEROSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {   zeroscan_fct=zeroscan_avx2;
+        name="avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {   zeroscan_fct=zeroscan_sse2;
+        name="sse2";
+    }
+#endif // ZEROSCAN_X86
+    msgprintf(MSG_DEBUG1, "zero detection uses the %s version\n", name);
+}
+
+// returns true if all the bytes of the data are zero
+bool zeroscan_is_zero(const void *data, u64 len)
+{
+    pthread_once(&zeroscan_once, zeroscan_select);
+    return zeroscan_fct((const u8 *)data, len);
+}
@@ -0,0 +1,30 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __ZEROSCAN_H__
+#define __ZEROSCAN_H__
+
+#include "types.h"
+
+#define ZEROSCAN_PAGESIZE       4096   // granularity of the holes made in the restored files
+
+void zeroscan_select();
+bool zeroscan_generic(const u8 *data, u64 len);
+bool zeroscan_is_zero(const void *data, u64 len);
+
+#endif // __ZEROSCAN_H__
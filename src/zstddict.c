@@ -0,0 +1,296 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "fsarchiver.h"
+#include "zstddict.h"
+#include "dico.h"
+#include "common.h"
+#include "error.h"
+
+#ifdef OPTION_ZSTD_SUPPORT
+#include <zstd.h>
+#include <zdict.h>
+#endif // OPTION_ZSTD_SUPPORT
+
+int zstddict_sampler_init(czstdsampler *s)
+{
+    if (!s)
+    {   errprintf("s is NULL\n");
+        return -1;
+    }
+    
+    memset(s, 0, sizeof(czstdsampler));
+    return 0;
+}
+
+int zstddict_sampler_destroy(czstdsampler *s)
+{
+    int i;
+    
+    if (!s)
+    {   errprintf("s is NULL\n");
+        return -1;
+    }
+    
+    for (i=0; i<s->count; i++)
+        free(s->samples[i]);
+    memset(s, 0, sizeof(czstdsampler));
+    return 0;
+}
+
+// reservoir sampling: each small file has the same probability to be in the sample, and
+// only the files which are selected are read so the evaluation stays fast on large trees
+int zstddict_sampler_add_file(czstdsampler *s, char *fullpath, u64 filesize)
+{
+    size_t size;
+    ssize_t res;
+    u8 *sample;
+    int slot;
+    int fd;
+    
+    s->seen++;
+    if (s->count<ZSTDDICT_MAXSAMPLES)
+        slot=s->count;
+    else if ((slot=(int)(random()%s->seen))>=ZSTDDICT_MAXSAMPLES)
+        return 0;
+    
+    size=min(filesize, ZSTDDICT_MAXSAMPLESIZE);
+    if ((sample=malloc(size))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+        return -1;
+    }
+    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
+    {   free(sample);
+        return 0; // not an error: the file is just not part of the sample
+    }
+    res=read(fd, sample, size);
+    close(fd);
+    if (res<=0)
+    {   free(sample);
+        return 0;
+    }
+    
+    if (slot==s->count)
+        s->count++;
+    else
+        free(s->samples[slot]);
+    s->samples[slot]=sample;
+    s->sizes[slot]=(size_t)res;
+    return 0;
+}
+
+int zstddict_train(czstddict *d, czstdsampler *s, int level)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    size_t totalsize=0;
+    u8 *samples;
+    size_t res;
+    u8 *dict;
+    u64 pos;
+    int i;
+    
+    if (s->count<ZSTDDICT_MINSAMPLES)
+    {   msgprintf(MSG_VERB1, "Not enough small files (%d) to train a zstd dictionary\n", s->count);
+        return -1;
+    }
+    
+    // the samples must be contiguous in memory
+    for (i=0; i<s->count; i++)
+        totalsize+=s->sizes[i];
+    if ((samples=malloc(totalsize))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)totalsize);
+        return -1;
+    }
+    for (i=0, pos=0; i<s->count; pos+=s->sizes[i], i++)
+        memcpy(samples+pos, s->samples[i], s->sizes[i]);
+    
+    if ((dict=malloc(ZSTDDICT_SIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)ZSTDDICT_SIZE);
+        free(samples);
+        return -1;
+    }
+    res=ZDICT_trainFromBuffer(dict, ZSTDDICT_SIZE, samples, s->sizes, (unsigned)s->count);
+    free(samples);
+    if (ZDICT_isError(res))
+    {   msgprintf(MSG_VERB1, "Cannot train a zstd dictionary from %d small files: %s\n", s->count, ZDICT_getErrorName(res));
+        free(dict);
+        return -1;
+    }
+    
+    if (zstddict_load(d, dict, (u32)res)!=0)
+    {   free(dict);
+        return -1;
+    }
+    free(dict);
+    
+    if (zstddict_get_cdict(d, level)==NULL)
+    {   zstddict_destroy(d);
+        return -1;
+    }
+    
+    msgprintf(MSG_VERB1, "Trained a zstd dictionary of %ld bytes (id=%08x) from %d small files\n", (long)d->size, (unsigned int)d->dictid, s->count);
+    return 0;
+#else
+    errprintf("zstd dictionaries are not available as zstd support has been disabled at compilation time\n");
+    return -1;
+#endif // OPTION_ZSTD_SUPPORT
+}
+
+int zstddict_load(czstddict *d, u8 *data, u32 size)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    zstddict_destroy(d);
+    
+    if ((d->dictid=ZSTD_getDictID_fromDict(data, size))==0)
+    {   errprintf("the zstd dictionary is invalid\n");
+        return -1;
+    }
+    if ((d->data=malloc(size))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+        return -1;
+    }
+    memcpy(d->data, data, size);
+    d->size=size;
+    
+    if ((d->ddict=ZSTD_createDDict(d->data, d->size))==NULL)
+    {   errprintf("ZSTD_createDDict() failed\n");
+        zstddict_destroy(d);
+        return -1;
+    }
+    return 0;
+#else
+    errprintf("zstd dictionaries are not available as zstd support has been disabled at compilation time\n");
+    return -1;
+#endif // OPTION_ZSTD_SUPPORT
+}
+
+int zstddict_destroy(czstddict *d)
+{
+    int level;
+    
+    if (!d)
+    {   errprintf("d is NULL\n");
+        return -1;
+    }
+    
+#ifdef OPTION_ZSTD_SUPPORT
+    for (level=0; level<=ZSTDDICT_MAXLEVEL; level++)
+        if (d->cdict[level]!=NULL)
+            ZSTD_freeCDict(d->cdict[level]);
+    if (d->ddict!=NULL)
+        ZSTD_freeDDict(d->ddict);
+#endif // OPTION_ZSTD_SUPPORT
+    free(d->data);
+    memset(d, 0, sizeof(czstddict));
+    return 0;
+}
+
+// the digested dictionary of a level is created when the level is used for the first time: the rules of
+// the compression policy and the adaptive level can use other levels than the one of the archive
+struct ZSTD_CDict_s *zstddict_get_cdict(czstddict *d, int level)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    ZSTD_CDict *cdict;
+    
+    if ((d->data==NULL) || (level<1) || (level>ZSTDDICT_MAXLEVEL))
+        return NULL;
+    if ((cdict=d->cdict[level])!=NULL)
+        return cdict;
+    
+    if ((cdict=ZSTD_createCDict(d->data, d->size, level))==NULL)
+    {   errprintf("ZSTD_createCDict() failed\n");
+        return NULL;
+    }
+    // another compression thread may have created it at the same time: only one of them is kept
+    if (__sync_bool_compare_and_swap(&d->cdict[level], NULL, cdict)==false)
+    {   ZSTD_freeCDict(cdict);
+        cdict=d->cdict[level];
+    }
+    return cdict;
+#else
+    return NULL;
+#endif // OPTION_ZSTD_SUPPORT
+}
+
+// the dictionary is split in chunks stored in sections 1 to n of the dico
+int zstddict_write_dico(czstddict *d, cdico *dico)
+{
+    u32 pos;
+    int section;
+    
+    dico_add_u32(dico, 0, ZSTDDICTKEY_SIZE, d->size);
+    dico_add_u32(dico, 0, ZSTDDICTKEY_DICTID, d->dictid);
+    for (pos=0, section=1; pos<d->size; pos+=ZSTDDICT_CHUNKSIZE, section++)
+    {
+        if (dico_add_data(dico, section, ZSTDDICTKEY_DATA, d->data+pos, min(d->size-pos, ZSTDDICT_CHUNKSIZE))!=0)
+        {   errprintf("dico_add_data(ZSTDDICTKEY_DATA) failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int zstddict_read_dico(czstddict *d, cdico *dico)
+{
+    u32 dictid;
+    u16 chunksize;
+    u32 size;
+    u32 pos;
+    u8 *data;
+    int section;
+    int res;
+    
+    if ((dico_get_u32(dico, 0, ZSTDDICTKEY_SIZE, &size)!=0) || (size==0) || (size>ZSTDDICT_SIZE))
+    {   errprintf("cannot read ZSTDDICTKEY_SIZE from the zstd dictionary header\n");
+        return -1;
+    }
+    if (dico_get_u32(dico, 0, ZSTDDICTKEY_DICTID, &dictid)!=0)
+    {   errprintf("cannot read ZSTDDICTKEY_DICTID from the zstd dictionary header\n");
+        return -1;
+    }
+    if ((data=malloc(size))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+        return -1;
+    }
+    for (pos=0, section=1; pos<size; pos+=chunksize, section++)
+    {
+        if ((dico_get_data(dico, section, ZSTDDICTKEY_DATA, data+pos, min(size-pos, ZSTDDICT_CHUNKSIZE), &chunksize)!=0) || (chunksize==0))
+        {   errprintf("cannot read chunk %d of the zstd dictionary\n", section);
+            free(data);
+            return -1;
+        }
+    }
+    
+    res=zstddict_load(d, data, size);
+    free(data);
+    if ((res==0) && (d->dictid!=dictid))
+    {   errprintf("the id of the zstd dictionary does not match: %08x instead of %08x\n", (unsigned int)d->dictid, (unsigned int)dictid);
+        zstddict_destroy(d);
+        return -1;
+    }
+    return res;
+}
@@ -0,0 +1,64 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+#ifndef __ZSTDDICT_H__
+#define __ZSTDDICT_H__
+
+struct s_dico;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+#define ZSTDDICT_SIZE           112640 // maximum size of a dictionary
+#define ZSTDDICT_CHUNKSIZE      32768  // the dictionary is split into chunks because dico items are limited to 64KB
+#define ZSTDDICT_MAXSAMPLES     2048   // how many small files are kept to train a dictionary
+#define ZSTDDICT_MAXSAMPLESIZE  8192   // how many bytes are kept from each small file
+#define ZSTDDICT_MINSAMPLES     32     // no dictionary is trained with fewer small files
+#define ZSTDDICT_MAXLEVEL       22     // highest zstd level for which a digested dictionary can be kept
+
+struct s_zstdsampler;
+typedef struct s_zstdsampler czstdsampler;
+
+struct s_zstddict;
+typedef struct s_zstddict czstddict;
+
+struct s_zstdsampler // random sample of the small files of a filesystem read during the evaluation
+{   u8       *samples[ZSTDDICT_MAXSAMPLES]; // beginning of each file which has been selected
+    size_t   sizes[ZSTDDICT_MAXSAMPLES]; // size of each sample
+    int      count; // how many samples there are
+    u64      seen; // how many small files have been offered to the sampler
+};
+
+struct s_zstddict // dictionary used to compress the blocks of small files of a filesystem
+{   u8       *data; // contents of the dictionary (NULL if there is no dictionary)
+    u32      size; // size of the dictionary
+    u32      dictid; // id of the dictionary written in the header of the blocks which use it
+    struct ZSTD_CDict_s *cdict[ZSTDDICT_MAXLEVEL+1]; // digested dictionary of each level shared by the compression threads
+    struct ZSTD_DDict_s *ddict; // digested dictionary shared by the decompression threads
+};
+
+int  zstddict_sampler_init(czstdsampler *s);
+int  zstddict_sampler_destroy(czstdsampler *s);
+int  zstddict_sampler_add_file(czstdsampler *s, char *fullpath, u64 filesize);
+int  zstddict_train(czstddict *d, czstdsampler *s, int level);
+int  zstddict_load(czstddict *d, u8 *data, u32 size);
+int  zstddict_destroy(czstddict *d);
+struct ZSTD_CDict_s *zstddict_get_cdict(czstddict *d, int level);
+int  zstddict_write_dico(czstddict *d, struct s_dico *dico);
+int  zstddict_read_dico(czstddict *d, struct s_dico *dico);
+
+#endif // __ZSTDDICT_H__